@@ -0,0 +1,134 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * arena.c
+ */
+
+#include "arena.h"
+
+#define ALIGN(n) ( ((n) + 15) & ~(size_t)15 )
+
+#define CHUNK_SIZE (64 * 1024) /* first chunk, later chunks double */
+
+struct chunk {
+	struct chunk *next; /* older chunk */
+	size_t size; /* bytes of data */
+	size_t used;
+	uint8_t *data;
+};
+
+struct arena {
+	struct chunk *chunk; /* newest chunk, the one being carved */
+	void *last; /* most recent allocation */
+};
+
+static int
+mkchunk(struct arena *arena, size_t size)
+{
+	struct chunk *chunk;
+	size_t n;
+
+	n = arena->chunk ? (2 * arena->chunk->size) : CHUNK_SIZE;
+	while (n < size) {
+		n *= 2;
+	}
+	if (!(chunk = malloc(ALIGN(sizeof (struct chunk)) + n))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	chunk->next = arena->chunk;
+	chunk->size = n;
+	chunk->used = 0;
+	chunk->data = (uint8_t *)chunk + ALIGN(sizeof (struct chunk));
+	arena->chunk = chunk;
+	return 0;
+}
+
+struct arena *
+arena_open(void)
+{
+	struct arena *arena;
+
+	if (!(arena = malloc(sizeof (struct arena)))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(arena, 0, sizeof (struct arena));
+	return arena;
+}
+
+void
+arena_close(struct arena *arena)
+{
+	struct chunk *chunk;
+
+	if (arena) {
+		while ((chunk = arena->chunk)) {
+			arena->chunk = chunk->next;
+			FREE(chunk);
+		}
+		memset(arena, 0, sizeof (struct arena));
+	}
+	FREE(arena);
+}
+
+void *
+arena_alloc(struct arena *arena, size_t size)
+{
+	struct chunk *chunk;
+	void *p;
+
+	assert( arena );
+
+	size = ALIGN(size);
+	chunk = arena->chunk;
+	if (!chunk || ((chunk->size - chunk->used) < size)) {
+		if (mkchunk(arena, size)) {
+			TRACE(0);
+			return NULL;
+		}
+		chunk = arena->chunk;
+	}
+	p = chunk->data + chunk->used;
+	chunk->used += size;
+	memset(p, 0, size);
+	arena->last = p;
+	return p;
+}
+
+void *
+arena_grow(struct arena *arena, void *p, size_t size)
+{
+	struct chunk *chunk;
+	size_t offset, n;
+	void *q;
+
+	assert( arena );
+	assert( !p || (p == arena->last) );
+
+	if (!p) {
+		return arena_alloc(arena, size);
+	}
+	chunk = arena->chunk;
+	offset = (size_t)((uint8_t *)p - chunk->data);
+	n = chunk->used - offset;
+	size = ALIGN(size);
+	if (size <= n) {
+		return p;
+	}
+	if (size <= (chunk->size - offset)) {
+		memset(chunk->data + chunk->used, 0, size - n);
+		chunk->used = offset + size;
+		return p;
+	}
+	if (!(q = arena_alloc(arena, size))) {
+		TRACE(0);
+		return NULL;
+	}
+	memcpy(q, p, n);
+	chunk->used = offset; /* p was on top of the old chunk */
+	return q;
+}
@@ -0,0 +1,38 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * arena.h
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include "system.h"
+
+/**
+ * A bump allocator: allocations are carved, in order, out of a list of
+ * chunks of doubling size and are released all at once by arena_close().
+ * Consecutive allocations are adjacent in memory unless a chunk boundary
+ * falls between them. Every allocation is zeroed and 16-byte aligned.
+ */
+
+struct arena;
+
+struct arena *arena_open(void);
+
+void arena_close(struct arena *arena);
+
+void *arena_alloc(struct arena *arena, size_t size);
+
+/**
+ * Resizes p, which must be the most recent allocation of the arena, to size
+ * bytes. p grows in place while its chunk has room; otherwise its content
+ * moves to a new chunk, as with realloc().
+ */
+
+void *arena_grow(struct arena *arena, void *p, size_t size);
+
+#endif /* _ARENA_H_ */
@@ -0,0 +1,2892 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * bench.c
+ */
+
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <math.h>
+#include "jitc.h"
+#include "lexer.h"
+#include "codegen.h"
+#include "sigmoid.h"
+#include "mathfn.h"
+#include "registry.h"
+#include "stream.h"
+#include "tier.h"
+#include "vm.h"
+#include "system.h"
+
+/**
+ * usage: bench name [args...]
+ */
+
+static volatile double sink; /* keeps timed calls alive */
+
+struct stat_ {
+	uint64_t n;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+};
+
+static void
+stat_add(struct stat_ *stat, uint64_t t)
+{
+	if (!stat->n || (t < stat->min)) {
+		stat->min = t;
+	}
+	if (!stat->n || (t > stat->max)) {
+		stat->max = t;
+	}
+	stat->sum += t;
+	++stat->n;
+}
+
+static void
+stat_print(const char *name, const struct stat_ *stat)
+{
+	printf("%-16s %12.3f %12.3f %12.3f\n",
+	       name,
+	       1e-6 * (double)stat->sum / (double)(stat->n ? stat->n : 1),
+	       1e-6 * (double)stat->min,
+	       1e-6 * (double)stat->max);
+}
+
+static void
+rmtree(const char *dirname)
+{
+	char pathname[512];
+	struct dirent *dirent;
+	DIR *dir;
+
+	if ((dir = opendir(dirname))) {
+		while ((dirent = readdir(dir))) {
+			if (strcmp(dirent->d_name, ".") &&
+			    strcmp(dirent->d_name, "..")) {
+				safe_sprintf(pathname,
+					     sizeof (pathname),
+					     "%s/%s",
+					     dirname,
+					     dirent->d_name);
+				file_delete(pathname);
+			}
+		}
+		closedir(dir);
+	}
+	if (rmdir(dirname)) {
+		/* ignore */
+	}
+}
+
+struct text {
+	char *buf;
+	size_t size;
+	size_t capacity;
+};
+
+static int
+text_append(struct text *text, const char *s)
+{
+	size_t n, m;
+	char *buf;
+
+	n = safe_strlen(s);
+	if ((text->size + n + 1) > text->capacity) {
+		m = text->capacity ? (2 * text->capacity) : 4096;
+		while ((text->size + n + 1) > m) {
+			m *= 2;
+		}
+		if (!(buf = realloc(text->buf, m))) {
+			TRACE("out of memory");
+			return -1;
+		}
+		text->buf = buf;
+		text->capacity = m;
+	}
+	memcpy(text->buf + text->size, s, n + 1);
+	text->size += n;
+	return 0;
+}
+
+/**
+ * Appends a random expression tree of the given depth to text. Constants
+ * include zero so that the guarded division is exercised. With nvars > 0,
+ * half of the leaves are variables x0 .. x<nvars-1>.
+ */
+
+static int
+mkexpr(struct text *text, int depth, int nvars)
+{
+	const char * const VAL[] = { "0", "1", "2.5", "3", "0.125", "7" };
+	const char * const OP[] = { " + ", " - ", " * ", " / " };
+	char buf[32];
+	int err;
+
+	if (0 >= depth) {
+		if ((0 < nvars) && (rand() % 2)) {
+			safe_sprintf(buf, sizeof (buf), "x%d", rand() % nvars);
+			return text_append(text, buf);
+		}
+		return text_append(text, VAL[rand() % ARRAY_SIZE(VAL)]);
+	}
+	if (!(rand() % 8)) {
+		err = text_append(text, "-(");
+		err = err || mkexpr(text, depth - 1, nvars);
+		return err || text_append(text, ")");
+	}
+	err = text_append(text, "(");
+	err = err || mkexpr(text, depth - 1, nvars);
+	err = err || text_append(text, OP[rand() % ARRAY_SIZE(OP)]);
+	err = err || mkexpr(text, depth - 1, nvars);
+	return err || text_append(text, ")");
+}
+
+static int
+same(double a, double b)
+{
+	return (a == b) || ((a != a) && (b != b));
+}
+
+/**
+ * Parses a random expression with 2^depth leaves, saves it with
+ * parser_save() and reloads it with parser_load(), reporting the cost of
+ * each step and the sizes of the text and of the saved file. The reloaded
+ * expression must save to the same bytes and evaluate to the same value.
+ */
+
+static int
+bench_load(int argc, char *argv[])
+{
+	const double X[] = { 0.5, -1.25, 3.0, 0.0 };
+	char dirname[] = "/tmp/jitc-bench-XXXXXX";
+	char pathname[512], pathname_[512];
+	struct parser *parser, *parser_;
+	uint64_t parse, save, load;
+	const char *a, *b;
+	struct text text;
+	size_t size, size_;
+	struct vm *vm, *vm_;
+	int depth, err;
+
+	depth = (0 < argc) ? atoi(argv[0]) : 20;
+	srand(238);
+	memset(&text, 0, sizeof (text));
+	if ((0 >= depth) ||
+	    !mkdtemp(dirname) ||
+	    mkexpr(&text, depth, ARRAY_SIZE(X))) {
+		FREE(text.buf);
+		TRACE("bench setup");
+		return -1;
+	}
+	size = size_ = 0;
+	safe_sprintf(pathname, sizeof (pathname), "%s/a.dag", dirname);
+	safe_sprintf(pathname_, sizeof (pathname_), "%s/b.dag", dirname);
+	parse = ref_time();
+	parser = parser_open(text.buf);
+	parse = ref_time() - parse;
+	save = ref_time();
+	err = !parser || parser_save(parser, pathname);
+	save = ref_time() - save;
+	load = ref_time();
+	parser_ = err ? NULL : parser_load(pathname);
+	load = ref_time() - load;
+	err = err || !parser_ || parser_save(parser_, pathname_);
+	a = err ? NULL : file_map(pathname, &size);
+	b = err ? NULL : file_map(pathname_, &size_);
+	vm = err ? NULL : vm_open(parser_dag(parser));
+	vm_ = err ? NULL : vm_open(parser_dag(parser_));
+	if (!a ||
+	    !b ||
+	    (size != size_) ||
+	    memcmp(a, b, size) ||
+	    !vm ||
+	    !vm_ ||
+	    !same(vm_execute(vm, X), vm_execute(vm_, X))) {
+		err = -1;
+	}
+	else {
+		printf("%-16s %14lu\n",
+		       "nodes",
+		       (unsigned long)parser_dag(parser_)->n);
+		printf("%-16s %14lu\n", "text_bytes", (unsigned long)text.size);
+		printf("%-16s %14lu\n", "saved_bytes", (unsigned long)size);
+		printf("%-16s %14.2f\n", "parse_ms", 1e-6 * (double)parse);
+		printf("%-16s %14.2f\n", "save_ms", 1e-6 * (double)save);
+		printf("%-16s %14.2f\n", "load_ms", 1e-6 * (double)load);
+		printf("%-16s %14.1f\n", "speedup", (double)parse / (double)load);
+	}
+	vm_close(vm);
+	vm_close(vm_);
+	file_unmap(a, size);
+	file_unmap(b, size_);
+	parser_close(parser);
+	parser_close(parser_);
+	FREE(text.buf);
+	rmtree(dirname);
+	if (err) {
+		TRACE("saved and parsed expressions differ");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Compiles n distinct programs twice through the compile cache: the first
+ * round misses and runs gcc, the second round hits.
+ */
+
+static int
+bench_cache(int argc, char *argv[])
+{
+	const char * const ROUND[] = { "miss", "hit" };
+	char dirname[] = "/tmp/jitc-bench-XXXXXX";
+	char cfile[512], sofile[512], cache[512], name[32];
+	struct stat_ compile, open;
+	struct jitc *jitc;
+	evaluate_t fnc;
+	uint64_t t;
+	FILE *file;
+	int i, n, r;
+
+	n = (0 < argc) ? atoi(argv[0]) : 10;
+	if ((0 >= n) || !mkdtemp(dirname)) {
+		TRACE("bench setup");
+		return -1;
+	}
+	safe_sprintf(cfile, sizeof (cfile), "%s/out.c", dirname);
+	safe_sprintf(sofile, sizeof (sofile), "%s/out.so", dirname);
+	safe_sprintf(cache, sizeof (cache), "%s/cache", dirname);
+	if (jitc_cache(cache, 1024 * 1024 * 1024)) {
+		rmtree(dirname);
+		TRACE(0);
+		return -1;
+	}
+	printf("%-16s %12s %12s %12s\n", "phase", "mean_ms", "min_ms", "max_ms");
+	for (r=0; r<(int)ARRAY_SIZE(ROUND); ++r) {
+		memset(&compile, 0, sizeof (compile));
+		memset(&open, 0, sizeof (open));
+		for (i=0; i<n; ++i) {
+			if (!(file = fopen(cfile, "w"))) {
+				rmtree(cache);
+				rmtree(dirname);
+				TRACE("fopen()");
+				return -1;
+			}
+			fprintf(file,
+				"double evaluate(const double *x) {"
+				" (void)x; return %d.0; }\n",
+				i);
+			fclose(file);
+			t = ref_time();
+			if (jitc_compile(cfile, sofile)) {
+				rmtree(cache);
+				rmtree(dirname);
+				TRACE(0);
+				return -1;
+			}
+			stat_add(&compile, ref_time() - t);
+			t = ref_time();
+			if (!(jitc = jitc_open(sofile)) ||
+			    !(fnc = (evaluate_t)jitc_lookup(jitc,
+							     "evaluate")) ||
+			    (i != (int)fnc(NULL))) {
+				jitc_close(jitc);
+				rmtree(cache);
+				rmtree(dirname);
+				TRACE("software");
+				return -1;
+			}
+			stat_add(&open, ref_time() - t);
+			jitc_close(jitc);
+		}
+		safe_sprintf(name, sizeof (name), "%s_compile", ROUND[r]);
+		stat_print(name, &compile);
+		safe_sprintf(name, sizeof (name), "%s_open", ROUND[r]);
+		stat_print(name, &open);
+	}
+	rmtree(cache);
+	rmtree(dirname);
+	return 0;
+}
+
+/**
+ * Compiles random expressions of increasing depth with the native backend and
+ * with gcc (cache disabled), checks that both agree, and reports the compile
+ * and call latency of each.
+ */
+
+static int
+bench_native(int argc, char *argv[])
+{
+	const double X[] = { 0.5, -1.25, 3.0, 0.0 };
+	const int R = 100;
+	char dirname[] = "/tmp/jitc-bench-XXXXXX";
+	char cfile[512], sofile[512];
+	struct stat_ native, gcc;
+	evaluate_t fnc, fnc_;
+	struct parser *parser;
+	struct jitc *jitc, *jitc_;
+	struct text text;
+	int depth, n, i, err;
+	uint64_t t, t_;
+	FILE *file;
+
+	n = (0 < argc) ? atoi(argv[0]) : 10;
+	if ((0 >= n) || !mkdtemp(dirname)) {
+		TRACE("bench setup");
+		return -1;
+	}
+	safe_sprintf(cfile, sizeof (cfile), "%s/out.c", dirname);
+	safe_sprintf(sofile, sizeof (sofile), "%s/out.so", dirname);
+	jitc_cache(NULL, 0);
+	printf("%6s %16s %16s %14s %14s\n",
+	       "depth",
+	       "native_comp_us",
+	       "gcc_comp_us",
+	       "native_call_ns",
+	       "gcc_call_ns");
+	srand(238);
+	memset(&text, 0, sizeof (text));
+	for (depth=1; depth<=n; ++depth) {
+		text.size = 0;
+		if (mkexpr(&text, depth, ARRAY_SIZE(X)) ||
+		    !(parser = parser_open(text.buf))) {
+			FREE(text.buf);
+			rmtree(dirname);
+			TRACE(0);
+			return -1;
+		}
+		memset(&native, 0, sizeof (native));
+		memset(&gcc, 0, sizeof (gcc));
+		for (i=0; i<R; ++i) {
+			t = ref_time();
+			jitc = jitc_native(parser_dag(parser));
+			stat_add(&native, ref_time() - t);
+			if (!jitc) {
+				parser_close(parser);
+				FREE(text.buf);
+				rmtree(dirname);
+				TRACE(0);
+				return -1;
+			}
+			jitc_close(jitc);
+		}
+		t = ref_time();
+		jitc_ = NULL;
+		if ((file = fopen(cfile, "w"))) {
+			err = codegen(parser_dag(parser), file);
+			fclose(file);
+			if (!err && !jitc_compile(cfile, sofile)) {
+				jitc_ = jitc_open(sofile);
+			}
+		}
+		stat_add(&gcc, ref_time() - t);
+		jitc = jitc_native(parser_dag(parser));
+		parser_close(parser);
+		if (!jitc ||
+		    !jitc_ ||
+		    !(fnc = (evaluate_t)jitc_lookup(jitc, "evaluate")) ||
+		    !(fnc_ = (evaluate_t)jitc_lookup(jitc_, "evaluate")) ||
+		    !same(fnc(X), fnc_(X))) {
+			jitc_close(jitc);
+			jitc_close(jitc_);
+			FREE(text.buf);
+			rmtree(dirname);
+			TRACE("native and gcc disagree");
+			return -1;
+		}
+		t = ref_time();
+		for (i=0; i<R; ++i) {
+			sink = fnc(X);
+		}
+		t = ref_time() - t;
+		t_ = ref_time();
+		for (i=0; i<R; ++i) {
+			sink = fnc_(X);
+		}
+		t_ = ref_time() - t_;
+		printf("%6d %16.1f %16.1f %14.1f %14.1f\n",
+		       depth,
+		       1e-3 * (double)native.sum / (double)native.n,
+		       1e-3 * (double)gcc.sum,
+		       (double)t / R,
+		       (double)t_ / R);
+		jitc_close(jitc);
+		jitc_close(jitc_);
+	}
+	FREE(text.buf);
+	rmtree(dirname);
+	return 0;
+}
+
+/**
+ * Children precede their parents, so one pass over the ids sizes every
+ * subtree; memo[0], the absent child, stays 0.
+ */
+
+static uint64_t
+tree_size(const struct parser_dag *dag, uint64_t *memo)
+{
+	uint32_t i;
+
+	memo[0] = 0;
+	for (i=1; i<=dag->n; ++i) {
+		memo[i] = 1;
+		if ((PARSER_DAG_VAL != dag->op[i]) &&
+		    (PARSER_DAG_VAR != dag->op[i])) {
+			memo[i] += memo[dag->left[i]] +
+				memo[dag->right[i]] +
+				memo[dag->addend[i]];
+		}
+	}
+	return memo[dag->n];
+}
+
+/**
+ * Reports how many nodes hash-consing saves over a plain tree on random
+ * expressions of increasing depth, and the size of the generated C.
+ */
+
+static int
+bench_cse(int argc, char *argv[])
+{
+	const struct parser_dag *dag;
+	struct parser *parser;
+	uint64_t tree, *memo;
+	struct text text;
+	int depth, n;
+	FILE *file;
+
+	n = (0 < argc) ? atoi(argv[0]) : 16;
+	printf("%6s %14s %14s %8s %12s\n",
+	       "depth",
+	       "tree_nodes",
+	       "dag_nodes",
+	       "saved",
+	       "c_bytes");
+	srand(238);
+	memset(&text, 0, sizeof (text));
+	for (depth=2; depth<=n; depth+=2) {
+		text.size = 0;
+		if (mkexpr(&text, depth, 0) || !(parser = parser_open(text.buf))) {
+			FREE(text.buf);
+			TRACE(0);
+			return -1;
+		}
+		dag = parser_dag(parser);
+		if (!(memo = malloc(((size_t)dag->n + 1) * sizeof (memo[0])))) {
+			parser_close(parser);
+			FREE(text.buf);
+			TRACE("out of memory");
+			return -1;
+		}
+		tree = tree_size(dag, memo);
+		FREE(memo);
+		if (!(file = tmpfile()) || codegen(dag, file)) {
+			if (file) {
+				fclose(file);
+			}
+			parser_close(parser);
+			FREE(text.buf);
+			TRACE(0);
+			return -1;
+		}
+		printf("%6d %14lu %14lu %7.1f%% %12ld\n",
+		       depth,
+		       (unsigned long)tree,
+		       (unsigned long)dag->n,
+		       100.0 * (double)(tree - (uint64_t)dag->n) / (double)tree,
+		       ftell(file));
+		fclose(file);
+		parser_close(parser);
+	}
+	FREE(text.buf);
+	return 0;
+}
+
+/**
+ * Simplifies n random expressions with 2^depth leaves, half of them
+ * constants, with parser_optimize(), exact and fast, and reports the nodes
+ * left; the exact ones must evaluate bit-for-bit like the original. The
+ * first few are compiled with gcc before and after, and a fully constant
+ * expression is timed compiled against folded.
+ */
+
+static int
+fold_eval(const struct parser *parser, const double *x, double *v)
+{
+	struct vm *vm;
+
+	if (!(vm = vm_open(parser_dag(parser)))) {
+		TRACE(0);
+		return -1;
+	}
+	*v = vm_execute(vm, x);
+	vm_close(vm);
+	return 0;
+}
+
+static int
+fold_build(const struct parser *parser, uint64_t *t, uint64_t *ns)
+{
+	const uint64_t R = 100000;
+	struct jitc *jitc;
+	evaluate_t fnc;
+	double x[4];
+	uint64_t r;
+
+	x[0] = 0.5;
+	x[1] = -1.25;
+	x[2] = 3.0;
+	x[3] = 0.75;
+	*t -= ref_time();
+	if (!(jitc = jitc_build(parser_dag(parser))) ||
+	    !(fnc = (evaluate_t)jitc_lookup(jitc, "evaluate"))) {
+		jitc_close(jitc);
+		TRACE(0);
+		return -1;
+	}
+	*t += ref_time();
+	*ns -= ref_time();
+	for (r=0; r<R; ++r) {
+		x[0] = (double)(r & 7);
+		sink = fnc(x);
+	}
+	*ns += ref_time();
+	jitc_close(jitc);
+	return 0;
+}
+
+static int
+bench_fold(int argc, char *argv[])
+{
+	const int BUILDS = 4;
+	const uint64_t R = 100000;
+	struct parser *parser[3]; /* original, exact, fast */
+	const struct parser_dag *dag;
+	uint64_t nodes[3], t[4];
+	int n, depth, k, j, constants, differ;
+	double x[4], v[3];
+	struct text text;
+	int err;
+
+	n = (0 < argc) ? atoi(argv[0]) : 1000;
+	depth = (1 < argc) ? atoi(argv[1]) : 6;
+	if ((1 > n) || (1 > depth) || (16 < depth)) {
+		TRACE("bench setup");
+		return -1;
+	}
+	jitc_cache(NULL, 0);
+	srand(238);
+	memset(&text, 0, sizeof (text));
+	memset(nodes, 0, sizeof (nodes));
+	memset(t, 0, sizeof (t));
+	constants = 0;
+	differ = 0;
+	err = 0;
+	for (k=0; !err && (k<n); ++k) {
+		text.size = 0;
+		err = mkexpr(&text, depth, 4);
+		for (j=0; j<3; ++j) {
+			parser[j] = err ? NULL : parser_open(text.buf);
+		}
+		for (j=0; j<4; ++j) {
+			x[j] = 4.0 * ((double)rand() / RAND_MAX) - 2.0;
+		}
+		if (!parser[0] || !parser[1] || !parser[2] ||
+		    parser_optimize(parser[1], 0) ||
+		    parser_optimize(parser[2], PARSER_OPTIMIZE_FAST)) {
+			err = -1;
+		}
+		for (j=0; !err && (j<3); ++j) {
+			nodes[j] += parser_dag(parser[j])->n;
+			err = fold_eval(parser[j], x, &v[j]);
+		}
+		if (!err && !same(v[0], v[1])) {
+			TRACE("exact simplification changed a result");
+			err = -1;
+		}
+		if (!err) {
+			differ += !same(v[0], v[2]);
+			dag = parser_dag(parser[1]);
+			constants += (1 == dag->n) &&
+				(PARSER_DAG_VAL == dag->op[1]);
+		}
+		if (!err && (k < BUILDS)) {
+			err = fold_build(parser[0], &t[0], &t[2]) ||
+				fold_build(parser[1], &t[1], &t[3]);
+		}
+		for (j=0; j<3; ++j) {
+			parser_close(parser[j]);
+		}
+	}
+	if (err) {
+		FREE(text.buf);
+		TRACE(0);
+		return -1;
+	}
+	printf("%8s %12s %12s %12s %10s %12s\n",
+	       "exprs",
+	       "nodes",
+	       "exact",
+	       "fast",
+	       "constant",
+	       "fast_differs");
+	printf("%8d %12lu %11.1f%% %11.1f%% %10d %12d\n",
+	       n,
+	       (unsigned long)nodes[0],
+	       100.0 * (double)nodes[1] / (double)nodes[0],
+	       100.0 * (double)nodes[2] / (double)nodes[0],
+	       constants,
+	       differ);
+	k = (n < BUILDS) ? n : BUILDS;
+	printf("%-16s %12s %12s\n", "gcc", "original", "exact");
+	printf("%-16s %12.3f %12.3f\n",
+	       "compile_ms",
+	       1e-6 * (double)t[0] / k,
+	       1e-6 * (double)t[1] / k);
+	printf("%-16s %12.1f %12.1f\n",
+	       "eval_ns",
+	       (double)t[2] / (double)(R * k),
+	       (double)t[3] / (double)(R * k));
+
+	/* a fully constant expression: gcc against folding */
+
+	text.size = 0;
+	memset(t, 0, sizeof (t));
+	if (mkexpr(&text, depth, 0) ||
+	    !(parser[0] = parser_open(text.buf))) {
+		FREE(text.buf);
+		TRACE(0);
+		return -1;
+	}
+	t[0] = ref_time();
+	if (parser_optimize(parser[0], 0) ||
+	    (1 != parser_dag(parser[0])->n)) {
+		parser_close(parser[0]);
+		FREE(text.buf);
+		TRACE("constant expression not folded");
+		return -1;
+	}
+	t[0] = ref_time() - t[0];
+	parser_close(parser[0]);
+	if (!(parser[0] = parser_open(text.buf)) ||
+	    fold_build(parser[0], &t[1], &t[2])) {
+		parser_close(parser[0]);
+		FREE(text.buf);
+		TRACE(0);
+		return -1;
+	}
+	parser_close(parser[0]);
+	printf("%-16s %12.3f %12.3f\n",
+	       "constant_ms",
+	       1e-6 * (double)t[1],
+	       1e-6 * (double)t[0]);
+	FREE(text.buf);
+	return 0;
+}
+
+/**
+ * Sets *vectorized to whether gcc -O3, without the floating-point flags
+ * the compile profiles add, vectorizes the loop of the evaluate_batch()
+ * generated for dag, as its -fopt-info-vec report tells.
+ */
+
+static int
+batch_vectorized(const struct parser_dag *dag, int *vectorized)
+{
+	char dirname[] = "/tmp/jitc-bench-XXXXXX";
+	char pathname[512], command[1024], line[1024], loop[64];
+	const char *p, *q;
+	FILE *file, *gcc;
+	size_t size;
+	char *text;
+	int k;
+
+	text = NULL;
+	size = 0;
+	if (!mkdtemp(dirname)) {
+		TRACE("mkdtemp()");
+		return -1;
+	}
+	safe_sprintf(pathname, sizeof (pathname), "%s/batch.c", dirname);
+	if (!(file = open_memstream(&text, &size)) ||
+	    codegen(dag, file) ||
+	    fclose(file) ||
+	    !(p = strstr(text, "void evaluate_batch(")) ||
+	    !(p = strstr(p, "for (")) ||
+	    !(file = fopen(pathname, "w"))) {
+		FREE(text);
+		rmtree(dirname);
+		TRACE("bench setup");
+		return -1;
+	}
+	fwrite(text, 1, size, file);
+	fclose(file);
+	for (k=1, q=text; q<p; ++q) {
+		k += ('\n' == (*q));
+	}
+	FREE(text);
+	safe_sprintf(loop, sizeof (loop), "batch.c:%d:", k);
+	safe_sprintf(command,
+		     sizeof (command),
+		     "gcc -O3 -fPIC -S -o /dev/null -fopt-info-vec-optimized"
+		     " %s 2>&1",
+		     pathname);
+	if (!(gcc = popen(command, "r"))) {
+		rmtree(dirname);
+		TRACE("popen()");
+		return -1;
+	}
+	*vectorized = 0;
+	while (fgets(line, sizeof (line), gcc)) {
+		if (strstr(line, loop) && strstr(line, "loop vectorized")) {
+			*vectorized = 1;
+		}
+	}
+	k = pclose(gcc);
+	rmtree(dirname);
+	if (k) {
+		TRACE("gcc");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Evaluates n rows of a division-heavy expression, an eighth of whose
+ * inputs are zero, with evaluate() and evaluate_batch() under every
+ * division mode and the o3 and native profiles, and reports the
+ * throughput of each. Every mode must agree with the interpreter opened
+ * under it, row for row, and checked must count every division by zero,
+ * compiled or interpreted. evaluate_batch() ends in the default,
+ * approximate, logistic function, so it is held to a tolerance. Finally,
+ * the loop of evaluate_batch() must vectorize under every division mode at
+ * plain -O3, which the o3 profile only relaxes.
+ */
+
+static int
+bench_division(int argc, char *argv[])
+{
+	const char * const EXPR =
+		"x0 / x1 + x1 / x2 - x2 / x3 + x3 / x0"
+		" + (x0 - x1) / (x2 + 4) * (x3 / x1)";
+	const enum jitc_profile PROFILE[] = {
+		JITC_PROFILE_O3,
+		JITC_PROFILE_NATIVE
+	};
+	const unsigned long long *faults;
+	enum codegen_division d;
+	double *in, *out, x[4];
+	uint64_t i, j, n, t[2];
+	unsigned long long expected, counted;
+	evaluate_batch_t batch;
+	struct parser *parser;
+	struct jitc *jitc;
+	evaluate_t fnc;
+	struct vm *vm;
+	uint64_t differ;
+	int vectorized;
+	size_t k;
+	int err;
+
+	n = (0 < argc) ? (uint64_t)atol(argv[0]) : 1000000;
+	if (!n) {
+		TRACE("bench setup");
+		return -1;
+	}
+	jitc_cache(NULL, 0);
+	srand(238);
+	parser = parser_open(EXPR);
+	vm = parser ? vm_open(parser_dag(parser)) : NULL;
+	in = malloc(4 * n * sizeof (in[0]));
+	out = malloc(n * sizeof (out[0]));
+	if (!vm || !in || !out) {
+		vm_close(vm);
+		parser_close(parser);
+		FREE(in);
+		FREE(out);
+		TRACE(0);
+		return -1;
+	}
+	for (i=0; i<(4 * n); ++i) {
+		in[i] = (rand() % 8) ? (4.0 * ((double)rand() / RAND_MAX) - 2.0)
+			: 0.0;
+	}
+	expected = 0;
+	for (i=0; i<n; ++i) {
+		expected += 2 * (0.0 == in[1 * n + i]);
+		expected += (0.0 == in[0 * n + i]) +
+			(0.0 == in[2 * n + i]) +
+			(0.0 == in[3 * n + i]);
+	}
+	printf("%-8s %-8s %14s %14s %8s %12s %10s\n",
+	       "profile",
+	       "division",
+	       "scalar_rows/s",
+	       "batch_rows/s",
+	       "speedup",
+	       "faults",
+	       "differ");
+	err = 0;
+	for (k=0; !err && (k<ARRAY_SIZE(PROFILE)); ++k) {
+		if (jitc_set_profile(PROFILE[k])) {
+			continue; /* e.g., no -march=native */
+		}
+		for (d=0; !err && (d<CODEGEN_DIVISION_END); ++d) {
+			codegen_set_division(d);
+			vm_close(vm);
+			vm = vm_open(parser_dag(parser));
+			jitc = vm ? jitc_build(parser_dag(parser)) : NULL;
+			if (!jitc ||
+			    !(fnc = (evaluate_t)
+			      jitc_lookup(jitc, "evaluate")) ||
+			    !(batch = (evaluate_batch_t)
+			      jitc_lookup(jitc, "evaluate_batch")) ||
+			    !(faults = (const unsigned long long *)
+			      jitc_lookup(jitc, "division_faults"))) {
+				jitc_close(jitc);
+				err = -1;
+				break;
+			}
+			t[0] = ref_time();
+			for (i=0; i<n; ++i) {
+				for (j=0; j<4; ++j) {
+					x[j] = in[j * n + i];
+				}
+				sink = fnc(x);
+			}
+			t[0] = ref_time() - t[0];
+			t[1] = ref_time();
+			batch(in, out, n);
+			t[1] = ref_time() - t[1];
+			counted = *faults;
+			differ = 0;
+			for (i=0; i<n; ++i) {
+				for (j=0; j<4; ++j) {
+					x[j] = in[j * n + i];
+				}
+				if (!same(fnc(x), vm_execute(vm, x))) {
+					++differ;
+				}
+				else if (1e-15 < fabs(out[i] - fnc(x))) {
+					TRACE("evaluate_batch() disagrees");
+					err = -1;
+				}
+			}
+			printf("%-8s %-8s %14.3e %14.3e %8.2f %12llu %10lu\n",
+			       jitc_profile_name(PROFILE[k]),
+			       codegen_division_name(d),
+			       1e9 * (double)n / (double)t[0],
+			       1e9 * (double)n / (double)t[1],
+			       (double)t[0] / (double)t[1],
+			       counted,
+			       (unsigned long)differ);
+			if (differ) {
+				TRACE("division differs from the interpreter");
+				err = -1;
+			}
+			if ((CODEGEN_DIVISION_CHECKED == d) &&
+			    (((2 * expected) != counted) ||
+			     (vm_division_faults(vm) != expected))) {
+				TRACE("wrong count of divisions by zero");
+				err = -1;
+			}
+			jitc_close(jitc);
+		}
+	}
+	if (!err) {
+		printf("%-8s %-8s %14s\n", "gcc", "division", "batch_loop");
+	}
+	for (d=0; !err && (d<CODEGEN_DIVISION_END); ++d) {
+		codegen_set_division(d);
+		if (batch_vectorized(parser_dag(parser), &vectorized)) {
+			err = -1;
+			break;
+		}
+		printf("%-8s %-8s %14s\n",
+		       "-O3",
+		       codegen_division_name(d),
+		       vectorized ? "vectorized" : "scalar");
+		if (!vectorized) {
+			TRACE("evaluate_batch() not vectorized");
+			err = -1;
+		}
+	}
+	codegen_set_division(CODEGEN_DIVISION_BLEND);
+	jitc_set_profile(JITC_PROFILE_O3);
+	vm_close(vm);
+	parser_close(parser);
+	FREE(in);
+	FREE(out);
+	if (err) {
+		TRACE(0);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Compiles expression k of a family of distinct expressions in memory and
+ * checks its value against the interpreter.
+ */
+
+static int
+build(int k)
+{
+	const double X[] = { 0.75 };
+	struct parser *parser;
+	struct jitc *jitc;
+	evaluate_t fnc;
+	struct vm *vm;
+	char buf[64];
+	int err;
+
+	safe_sprintf(buf, sizeof (buf), "x * %d + 1 / (x - %d)", k, k);
+	if (!(parser = parser_open(buf))) {
+		TRACE(0);
+		return -1;
+	}
+	jitc = jitc_build(parser_dag(parser));
+	vm = vm_open(parser_dag(parser));
+	parser_close(parser);
+	err = !jitc ||
+		!vm ||
+		!(fnc = (evaluate_t)jitc_lookup(jitc, "evaluate")) ||
+		!same(fnc(X), vm_execute(vm, X));
+	jitc_close(jitc);
+	vm_close(vm);
+	return err ? -1 : 0;
+}
+
+static void *
+build_thread(void *arg)
+{
+	int *k;
+
+	k = (int *)arg;
+	if (build(k[0])) {
+		k[1] = -1;
+	}
+	return NULL;
+}
+
+/**
+ * Compiles n distinct expressions (cache disabled), once through files, as
+ * codegen() to a file, jitc_compile() and jitc_open(), and once in memory
+ * through jitc_build(); then compiles them again from t threads at once,
+ * checking every module.
+ */
+
+static int
+bench_memfd(int argc, char *argv[])
+{
+	char dirname[] = "/tmp/jitc-bench-XXXXXX";
+	char cfile[512], sofile[512], buf[64];
+	struct stat_ files, memory;
+	struct parser *parser;
+	pthread_t *thread;
+	struct jitc *jitc;
+	int i, j, n, t, *k;
+	FILE *file;
+	uint64_t t0;
+	int err;
+
+	n = (0 < argc) ? atoi(argv[0]) : 10;
+	t = (1 < argc) ? atoi(argv[1]) : 4;
+	if ((0 >= n) || (0 >= t) || !mkdtemp(dirname)) {
+		TRACE("bench setup");
+		return -1;
+	}
+	safe_sprintf(cfile, sizeof (cfile), "%s/out.c", dirname);
+	safe_sprintf(sofile, sizeof (sofile), "%s/out.so", dirname);
+	jitc_cache(NULL, 0);
+	memset(&files, 0, sizeof (files));
+	memset(&memory, 0, sizeof (memory));
+	for (i=0; i<n; ++i) {
+		safe_sprintf(buf, sizeof (buf), "x * %d + 1 / (x - %d)", i, i);
+		if (!(parser = parser_open(buf))) {
+			rmtree(dirname);
+			TRACE(0);
+			return -1;
+		}
+		t0 = ref_time();
+		jitc = NULL;
+		err = -1;
+		if ((file = fopen(cfile, "w"))) {
+			err = codegen(parser_dag(parser), file);
+			fclose(file);
+			if (!err && !jitc_compile(cfile, sofile)) {
+				jitc = jitc_open(sofile);
+			}
+			file_delete(cfile);
+			file_delete(sofile);
+		}
+		stat_add(&files, ref_time() - t0);
+		jitc_close(jitc);
+		parser_close(parser);
+		t0 = ref_time();
+		err = err || !jitc || build(i);
+		stat_add(&memory, ref_time() - t0);
+		if (err) {
+			rmtree(dirname);
+			TRACE(0);
+			return -1;
+		}
+	}
+	rmtree(dirname);
+	printf("%-16s %12s %12s %12s\n", "path", "mean_ms", "min_ms", "max_ms");
+	stat_print("files", &files);
+	stat_print("memory", &memory);
+	thread = malloc(t * sizeof (thread[0]));
+	k = malloc(2 * t * sizeof (k[0]));
+	if (!thread || !k) {
+		FREE(thread);
+		FREE(k);
+		TRACE("out of memory");
+		return -1;
+	}
+	err = 0;
+	t0 = ref_time();
+	for (i=0; i<n; i+=t) {
+		for (j=0; (j<t) && ((i + j) < n); ++j) {
+			k[2 * j + 0] = n + i + j;
+			k[2 * j + 1] = 0;
+			if (pthread_create(&thread[j], NULL, build_thread, &k[2 * j])) {
+				k[2 * j + 1] = -1;
+				thread[j] = pthread_self();
+			}
+		}
+		for (j=0; (j<t) && ((i + j) < n); ++j) {
+			if (!pthread_equal(thread[j], pthread_self())) {
+				pthread_join(thread[j], NULL);
+			}
+			err = err || k[2 * j + 1];
+		}
+	}
+	printf("%-16s %12.3f %12s %12s\n",
+	       "memory_threads",
+	       1e-6 * (double)(ref_time() - t0) / n,
+	       "",
+	       "");
+	FREE(thread);
+	FREE(k);
+	if (err) {
+		TRACE("concurrent builds failed");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Compiles n random expressions (10000 by default) over four variables at
+ * startup, once with jitc_build_many() and, for the first m of them (50 by
+ * default), with one jitc_build() each, the latter extrapolated to n. The
+ * cache is disabled and every batched entry point is checked against the
+ * interpreter.
+ */
+
+static int
+bench_many(int argc, char *argv[])
+{
+	const double X[] = { 0.5, -1.25, 3.0, 0.0 };
+	const struct parser_dag **dags;
+	struct parser **parsers;
+	struct jitc *jitc;
+	evaluate_t *table;
+	struct text text;
+	uint64_t t, t_;
+	size_t i, n, m;
+	struct vm *vm;
+	int err;
+
+	n = (0 < argc) ? (size_t)atol(argv[0]) : 10000;
+	m = (1 < argc) ? (size_t)atol(argv[1]) : 50;
+	m = (m < n) ? m : n;
+	parsers = malloc(n * sizeof (parsers[0]));
+	dags = malloc(n * sizeof (dags[0]));
+	table = malloc(n * sizeof (table[0]));
+	if (!n || !m || !parsers || !dags || !table) {
+		FREE(parsers);
+		FREE(dags);
+		FREE(table);
+		TRACE("bench setup");
+		return -1;
+	}
+	memset(parsers, 0, n * sizeof (parsers[0]));
+	memset(&text, 0, sizeof (text));
+	jitc_cache(NULL, 0);
+	srand(238);
+	err = 0;
+	for (i=0; (i<n) && !err; ++i) {
+		text.size = 0;
+		err = mkexpr(&text, 4, ARRAY_SIZE(X)) ||
+			!(parsers[i] = parser_open(text.buf));
+		dags[i] = err ? NULL : parser_dag(parsers[i]);
+	}
+	FREE(text.buf);
+
+	/* before */
+
+	t = ref_time();
+	for (i=0; (i<m) && !err; ++i) {
+		jitc = jitc_build(dags[i]);
+		err = !jitc || !jitc_lookup(jitc, "evaluate");
+		jitc_close(jitc);
+	}
+	t = (ref_time() - t) * n / m;
+
+	/* after */
+
+	t_ = ref_time();
+	jitc = err ? NULL : jitc_build_many(dags, n, table);
+	t_ = ref_time() - t_;
+	err = err || !jitc;
+	for (i=0; (i<n) && !err; ++i) {
+		if (!(vm = vm_open(dags[i])) ||
+		    !same(table[i](X), vm_execute(vm, X))) {
+			err = 1;
+		}
+		vm_close(vm);
+	}
+	jitc_close(jitc);
+	for (i=0; i<n; ++i) {
+		parser_close(parsers[i]);
+	}
+	FREE(parsers);
+	FREE(dags);
+	FREE(table);
+	if (err) {
+		TRACE("batched and interpreted results disagree");
+		return -1;
+	}
+	printf("%-24s %12lu\n", "expressions", (unsigned long)n);
+	printf("%-24s %12.2f\n", "one_by_one_s", 1e-9 * (double)t);
+	printf("%-24s %12.2f\n", "batched_s", 1e-9 * (double)t_);
+	printf("%-24s %12.1f\n", "speedup", (double)t / (double)t_);
+	return 0;
+}
+
+/**
+ * Writes a machine-generated expression of about size bytes to file: a long
+ * chain of terms over 64 variables, with a parenthesis opened every 64
+ * terms and all of them closed at the end, so the nesting grows with size.
+ */
+
+static int
+mkfile(FILE *file, size_t size)
+{
+	const char OP[] = { '+', '-', '*', '/' };
+	long depth, i;
+
+	depth = 0;
+	for (i=0; ftell(file) < (long)size; ++i) {
+		if (!(i % 64)) {
+			fprintf(file, "%s(", i ? " - " : "");
+			++depth;
+		}
+		else {
+			fprintf(file, " %c ", OP[rand() % ARRAY_SIZE(OP)]);
+		}
+		fprintf(file, "x%d * %ld.25", rand() % 64, i % 100000);
+	}
+	while (depth--) {
+		fputc(')', file);
+	}
+	return ferror(file) ? -1 : 0;
+}
+
+/**
+ * Maps, parses and generates C for expressions of 1 MB up to n MB (100 by
+ * default), reporting the time of each phase and the overall throughput.
+ */
+
+static int
+bench_scale(int argc, char *argv[])
+{
+	const size_t MB = 1024 * 1024;
+	const int SIZE[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000 };
+	char pathname[] = "/tmp/jitc-bench-XXXXXX";
+	uint64_t t0, t1, t2, t3;
+	struct parser *parser;
+	FILE *file, *null;
+	size_t size, i;
+	const char *s;
+	int fd, n;
+
+	n = (0 < argc) ? atoi(argv[0]) : 100;
+	if ((0 >= n) || (0 > (fd = mkstemp(pathname)))) {
+		TRACE("bench setup");
+		return -1;
+	}
+	close(fd);
+	if (!(null = fopen("/dev/null", "w"))) {
+		file_delete(pathname);
+		TRACE("fopen()");
+		return -1;
+	}
+	printf("%6s %12s %10s %10s %12s %8s\n",
+	       "mb",
+	       "dag_nodes",
+	       "map_ms",
+	       "parse_ms",
+	       "codegen_ms",
+	       "mb_per_s");
+	srand(238);
+	for (i=0; (i<ARRAY_SIZE(SIZE)) && (SIZE[i] <= n); ++i) {
+		if (!(file = fopen(pathname, "w")) ||
+		    mkfile(file, (size_t)SIZE[i] * MB)) {
+			if (file) {
+				fclose(file);
+			}
+			fclose(null);
+			file_delete(pathname);
+			TRACE("bench setup");
+			return -1;
+		}
+		fclose(file);
+		t0 = ref_time();
+		if (!(s = file_map(pathname, &size))) {
+			fclose(null);
+			file_delete(pathname);
+			TRACE(0);
+			return -1;
+		}
+		t1 = ref_time();
+		parser = parser_open(s);
+		t2 = ref_time();
+		if (!parser || codegen(parser_dag(parser), null)) {
+			parser_close(parser);
+			file_unmap(s, size);
+			fclose(null);
+			file_delete(pathname);
+			TRACE(0);
+			return -1;
+		}
+		fflush(null);
+		t3 = ref_time();
+		printf("%6.0f %12u %10.1f %10.1f %12.1f %8.1f\n",
+		       (double)size / MB,
+		       parser_dag(parser)->n,
+		       1e-6 * (double)(t1 - t0),
+		       1e-6 * (double)(t2 - t1),
+		       1e-6 * (double)(t3 - t2),
+		       1e9 * ((double)size / MB) / (double)(t3 - t0));
+		fflush(stdout);
+		parser_close(parser);
+		file_unmap(s, size);
+	}
+	fclose(null);
+	file_delete(pathname);
+	return 0;
+}
+
+static int
+compare_u64(const void *a, const void *b)
+{
+	uint64_t a_, b_;
+
+	a_ = *(const uint64_t *)a;
+	b_ = *(const uint64_t *)b;
+	return (a_ > b_) - (a_ < b_);
+}
+
+/**
+ * Returns the q-quantile of the n samples in t by nearest rank, sorting t.
+ */
+
+static uint64_t
+quantile(uint64_t *t, int n, double q)
+{
+	int i;
+
+	qsort(t, n, sizeof (t[0]), compare_u64);
+	i = (int)ceil(q * n) - 1;
+	return t[(0 > i) ? 0 : i];
+}
+
+/**
+ * Times every phase of the pipeline on n distinct random expressions (20 by
+ * default) over four variables, at tree depths 2, 4, ... up to d (10 by
+ * default), i.e., about 2^depth leaves each. The compile cache is disabled.
+ * The parser phase includes its own lexing; an evaluate sample is the mean
+ * of 1000 calls, as a single call is close to the clock's resolution.
+ * Prints one CSV row per depth and phase, in microseconds.
+ */
+
+static int
+bench_phases(int argc, char *argv[])
+{
+	const char * const PHASE[] = {
+		"lexer",
+		"parser",
+		"codegen",
+		"compile",
+		"open",
+		"evaluate"
+	};
+	const double X[] = { 0.5, 1.5, -2.0, 3.0 };
+	char dirname[] = "/tmp/jitc-bench-XXXXXX";
+	char cfile[512], sofile[512];
+	struct parser *parser;
+	struct lexer *lexer;
+	struct jitc *jitc;
+	struct text text;
+	uint64_t *t, t0;
+	evaluate_t fnc;
+	size_t bytes;
+	int i, j, k, n, d, depth;
+	FILE *file;
+	int err;
+
+	n = (0 < argc) ? atoi(argv[0]) : 20;
+	d = (1 < argc) ? atoi(argv[1]) : 10;
+	if ((0 >= n) || (2 > d) || !mkdtemp(dirname)) {
+		TRACE("bench setup");
+		return -1;
+	}
+	if (!(t = malloc(ARRAY_SIZE(PHASE) * n * sizeof (t[0])))) {
+		rmtree(dirname);
+		TRACE("out of memory");
+		return -1;
+	}
+	safe_sprintf(cfile, sizeof (cfile), "%s/out.c", dirname);
+	safe_sprintf(sofile, sizeof (sofile), "%s/out.so", dirname);
+	jitc_cache(NULL, 0);
+	memset(&text, 0, sizeof (text));
+	srand(238);
+	err = 0;
+	printf("depth,bytes,phase,n,min_us,median_us,p99_us\n");
+	for (depth=2; (depth<=d) && !err; depth+=2) {
+		bytes = 0;
+		for (i=0; (i<n) && !err; ++i) {
+			text.size = 0;
+			if (mkexpr(&text, depth, ARRAY_SIZE(X))) {
+				err = -1;
+				break;
+			}
+			bytes += text.size;
+			t0 = ref_time();
+			lexer = lexer_open(text.buf);
+			t[0 * n + i] = ref_time() - t0;
+			lexer_close(lexer);
+			t0 = ref_time();
+			parser = parser_open(text.buf);
+			t[1 * n + i] = ref_time() - t0;
+			if (!lexer || !parser) {
+				parser_close(parser);
+				err = -1;
+				break;
+			}
+			t0 = ref_time();
+			if ((file = fopen(cfile, "w"))) {
+				err = codegen(parser_dag(parser), file);
+				err = fclose(file) || err;
+			}
+			t[2 * n + i] = ref_time() - t0;
+			parser_close(parser);
+			t0 = ref_time();
+			err = err || !file || jitc_compile(cfile, sofile);
+			t[3 * n + i] = ref_time() - t0;
+			t0 = ref_time();
+			jitc = err ? NULL : jitc_open(sofile);
+			fnc = jitc ? (evaluate_t)jitc_lookup(jitc, "evaluate") : NULL;
+			t[4 * n + i] = ref_time() - t0;
+			if (!fnc) {
+				jitc_close(jitc);
+				err = -1;
+				break;
+			}
+			t0 = ref_time();
+			for (j=0; j<1000; ++j) {
+				sink = fnc(X);
+			}
+			t[5 * n + i] = (ref_time() - t0) / 1000;
+			jitc_close(jitc);
+			file_delete(cfile);
+			file_delete(sofile);
+		}
+		for (k=0; (k<(int)ARRAY_SIZE(PHASE)) && !err; ++k) {
+			printf("%d,%lu,%s,%d,%.3f,%.3f,%.3f\n",
+			       depth,
+			       (unsigned long)(bytes / n),
+			       PHASE[k],
+			       n,
+			       1e-3 * (double)quantile(t + k * n, n, 0.0),
+			       1e-3 * (double)quantile(t + k * n, n, 0.5),
+			       1e-3 * (double)quantile(t + k * n, n, 0.99));
+		}
+		fflush(stdout);
+	}
+	FREE(text.buf);
+	FREE(t);
+	rmtree(dirname);
+	if (err) {
+		TRACE("phase benchmark failed");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Compiles n distinct expressions (cache disabled), once with one blocking
+ * jitc_build() each and once by submitting all of them to the compile pool
+ * with jitc_compile_async() before waiting for any. While a compilation is
+ * pending the caller keeps serving one evaluation of its expression with the
+ * interpreter per millisecond of poll() on the completion fd; the number of
+ * evaluations served shows that the caller is not blocked on the compiler.
+ */
+
+static int
+bench_pool(int argc, char *argv[])
+{
+	const double X[] = { 0.75 };
+	struct jitc_async **async;
+	struct parser *parser;
+	struct pollfd pollfd;
+	uint64_t t0, served;
+	struct jitc *jitc;
+	struct vm **vm;
+	evaluate_t fnc;
+	int i, n, w;
+	char buf[64];
+	double t[2];
+	int err;
+
+	n = (0 < argc) ? atoi(argv[0]) : 16;
+	w = (1 < argc) ? atoi(argv[1]) : -1;
+	if ((0 >= n) || jitc_pool(w)) {
+		TRACE("bench setup");
+		return -1;
+	}
+	jitc_cache(NULL, 0);
+
+	/* blocking */
+
+	t0 = ref_time();
+	for (i=0; i<n; ++i) {
+		if (build(i)) {
+			TRACE(0);
+			return -1;
+		}
+	}
+	t[0] = 1e-9 * (double)(ref_time() - t0);
+
+	/* asynchronous */
+
+	async = malloc(n * sizeof (async[0]));
+	vm = malloc(n * sizeof (vm[0]));
+	if (!async || !vm) {
+		FREE(async);
+		FREE(vm);
+		TRACE("out of memory");
+		return -1;
+	}
+	memset(async, 0, n * sizeof (async[0]));
+	memset(vm, 0, n * sizeof (vm[0]));
+	err = 0;
+	served = 0;
+	t0 = ref_time();
+	for (i=0; i<n; ++i) {
+		safe_sprintf(buf, sizeof (buf), "x * %d + 1 / (x - %d)", n + i, i);
+		if (!(parser = parser_open(buf))) {
+			err = -1;
+			break;
+		}
+		async[i] = jitc_compile_async(parser_dag(parser));
+		vm[i] = vm_open(parser_dag(parser));
+		parser_close(parser);
+		if (!async[i] || !vm[i]) {
+			err = -1;
+			break;
+		}
+	}
+	for (i=0; i<n; ++i) {
+		if (!async[i]) {
+			vm_close(vm[i]);
+			continue;
+		}
+		pollfd.fd = jitc_async_fd(async[i]);
+		pollfd.events = POLLIN;
+		while (!err && !poll(&pollfd, 1, 1)) {
+			sink = vm_execute(vm[i], X);
+			++served;
+		}
+		jitc = jitc_async_wait(async[i]);
+		err = err ||
+			!jitc ||
+			!(fnc = (evaluate_t)jitc_lookup(jitc, "evaluate")) ||
+			!same(fnc(X), vm_execute(vm[i], X));
+		jitc_close(jitc);
+		vm_close(vm[i]);
+	}
+	t[1] = 1e-9 * (double)(ref_time() - t0);
+	FREE(async);
+	FREE(vm);
+	if (err) {
+		TRACE("asynchronous builds failed");
+		return -1;
+	}
+	printf("%-16s %12s %12s\n", "path", "total_s", "per_expr_ms");
+	printf("%-16s %12.3f %12.3f\n", "blocking", t[0], 1e3 * t[0] / n);
+	printf("%-16s %12.3f %12.3f\n", "pool", t[1], 1e3 * t[1] / n);
+	printf("speedup %.2fx, %lu interpreter evaluations served while waiting\n",
+	       t[0] / t[1],
+	       (unsigned long)served);
+	return 0;
+}
+
+/**
+ * Autotunes n random expressions (4 by default) over four variables at tree
+ * depth d (8 by default), cache disabled, printing the throughput of
+ * evaluate_batch() under every compile profile and the profile chosen.
+ */
+
+static int
+bench_tune(int argc, char *argv[])
+{
+	double ns[JITC_PROFILE_END];
+	enum jitc_profile best, p;
+	struct parser *parser;
+	struct text text;
+	int i, n, d;
+
+	n = (0 < argc) ? atoi(argv[0]) : 4;
+	d = (1 < argc) ? atoi(argv[1]) : 8;
+	if ((0 >= n) || (0 >= d)) {
+		TRACE("bench setup");
+		return -1;
+	}
+	jitc_cache(NULL, 0);
+	memset(&text, 0, sizeof (text));
+	srand(238);
+	printf("%-4s", "expr");
+	for (p=0; p<JITC_PROFILE_END; ++p) {
+		printf(" %9s", jitc_profile_name(p));
+	}
+	printf(" %9s\n", "best");
+	for (i=0; i<n; ++i) {
+		text.size = 0;
+		if (mkexpr(&text, d, 4) || !(parser = parser_open(text.buf))) {
+			FREE(text.buf);
+			TRACE(0);
+			return -1;
+		}
+		if (jitc_autotune(parser_dag(parser), &best, ns)) {
+			parser_close(parser);
+			FREE(text.buf);
+			TRACE(0);
+			return -1;
+		}
+		parser_close(parser);
+		printf("%-4d", i);
+		for (p=0; p<JITC_PROFILE_END; ++p) {
+			printf(" %9.2f", ns[p]);
+		}
+		printf(" %9s\n", jitc_profile_name(best));
+		fflush(stdout);
+	}
+	FREE(text.buf);
+	return 0;
+}
+
+/**
+ * Compiles one expression over four variables and evaluates it on n rows,
+ * once by calling evaluate() per row and once through evaluate_batch(),
+ * reporting the throughput of each and the largest difference.
+ */
+
+static int
+bench_batch(int argc, char *argv[])
+{
+	char dirname[] = "/tmp/jitc-bench-XXXXXX";
+	char cfile[512], sofile[512];
+	double *in, *out, *out_, x[4], d, e;
+	struct parser *parser;
+	evaluate_batch_t batch;
+	uint64_t i, j, n, nv;
+	struct jitc *jitc;
+	struct text text;
+	uint64_t t, t_;
+	evaluate_t fnc;
+	FILE *file;
+	int err;
+
+	n = (0 < argc) ? (uint64_t)atol(argv[0]) : 1000000;
+	if (!n || !mkdtemp(dirname)) {
+		TRACE("bench setup");
+		return -1;
+	}
+	safe_sprintf(cfile, sizeof (cfile), "%s/out.c", dirname);
+	safe_sprintf(sofile, sizeof (sofile), "%s/out.so", dirname);
+	srand(238);
+	memset(&text, 0, sizeof (text));
+	if (mkexpr(&text, (1 < argc) ? atoi(argv[1]) : 6, ARRAY_SIZE(x)) ||
+	    !(parser = parser_open(text.buf))) {
+		FREE(text.buf);
+		rmtree(dirname);
+		TRACE(0);
+		return -1;
+	}
+	FREE(text.buf);
+	nv = parser_vars(parser);
+	jitc = NULL;
+	err = -1;
+	if ((file = fopen(cfile, "w"))) {
+		err = codegen(parser_dag(parser), file);
+		fclose(file);
+		err = err || jitc_compile(cfile, sofile);
+		if (!err) {
+			jitc = jitc_open(sofile);
+		}
+	}
+	parser_close(parser);
+	rmtree(dirname);
+	in = malloc((nv ? nv : 1) * n * sizeof (in[0]));
+	out = malloc(n * sizeof (out[0]));
+	out_ = malloc(n * sizeof (out_[0]));
+	if (err ||
+	    !jitc ||
+	    !(fnc = (evaluate_t)jitc_lookup(jitc, "evaluate")) ||
+	    !(batch = (evaluate_batch_t)jitc_lookup(jitc, "evaluate_batch")) ||
+	    !in ||
+	    !out ||
+	    !out_) {
+		jitc_close(jitc);
+		FREE(in);
+		FREE(out);
+		FREE(out_);
+		TRACE(0);
+		return -1;
+	}
+	for (i=0; i<(nv * n); ++i) {
+		in[i] = 4.0 * ((double)rand() / RAND_MAX) - 2.0;
+	}
+	t = ref_time();
+	for (i=0; i<n; ++i) {
+		for (j=0; j<nv; ++j) {
+			x[j] = in[j * n + i];
+		}
+		out[i] = fnc(x);
+	}
+	t = ref_time() - t;
+	t_ = ref_time();
+	batch(in, out_, n);
+	t_ = ref_time() - t_;
+	d = 0.0;
+	for (i=0; i<n; ++i) {
+		e = (out[i] > out_[i]) ? (out[i] - out_[i]) : (out_[i] - out[i]);
+		d = (e > d) ? e : d;
+	}
+	printf("%-20s %14lu\n", "rows", (unsigned long)n);
+	printf("%-20s %14lu\n", "variables", (unsigned long)nv);
+	printf("%-20s %14.3e\n", "scalar_rows_per_s", 1e9 * (double)n / t);
+	printf("%-20s %14.3e\n", "batch_rows_per_s", 1e9 * (double)n / t_);
+	printf("%-20s %14.2f\n", "speedup", (double)t / t_);
+	printf("%-20s %14.3e\n", "max_abs_diff", d);
+	jitc_close(jitc);
+	FREE(in);
+	FREE(out);
+	FREE(out_);
+	return 0;
+}
+
+/**
+ * Evaluates expressions over the math functions on random rows with the
+ * interpreter, the native backend and the gcc module, which must agree bit
+ * for bit, and reports the cost of a row through each and through
+ * evaluate_batch(). The last expression nests its calls deeper than the
+ * native backend has registers.
+ */
+
+static int
+bench_math(int argc, char *argv[])
+{
+	const char * const EXPR[] = {
+		"exp(x0) - log(abs(x1) + 1)",
+		"pow(abs(x0), x1) + sqrt(abs(x2))",
+		"fma(x0, x1, x2) * min(x0, x3) - max(x1, x2)",
+		"exp(-x0 * x0) / (1 + pow(x1, 3)) + log(sqrt(x2 * x2 + 1))",
+		NULL
+	};
+	const int DEEP = 16;
+	double *in, *out, x[4], v;
+	uint64_t i, j, n, nv, t[4];
+	struct parser *parser;
+	evaluate_t native, gcc;
+	evaluate_batch_t batch;
+	struct jitc *jitc, *jitc_;
+	struct text text;
+	struct vm *vm;
+	size_t k;
+	int d, err;
+
+	n = (0 < argc) ? (uint64_t)atol(argv[0]) : 100000;
+	in = malloc(ARRAY_SIZE(x) * n * sizeof (in[0]));
+	out = malloc(n * sizeof (out[0]));
+	if (!n || !in || !out) {
+		FREE(in);
+		FREE(out);
+		TRACE("bench setup");
+		return -1;
+	}
+	srand(238);
+	for (i=0; i<(ARRAY_SIZE(x) * n); ++i) {
+		in[i] = 4.0 * ((double)rand() / RAND_MAX) - 2.0;
+	}
+	memset(&text, 0, sizeof (text));
+	err = 0;
+	for (d=0; d<DEEP; ++d) {
+		err = err || text_append(&text, (d % 2) ? "x1 * (" : "x0 + (");
+	}
+	err = err || text_append(&text, "pow(abs(x0), x1) + exp(x2) * "
+				 "fma(x3, x0, log(abs(x1)))");
+	for (d=0; d<DEEP; ++d) {
+		err = err || text_append(&text, ")");
+	}
+	jitc_cache(NULL, 0);
+	printf("%-44s %8s %10s %8s %8s\n",
+	       "expression",
+	       "vm_ns",
+	       "native_ns",
+	       "gcc_ns",
+	       "batch_ns");
+	for (k=0; !err && (k<ARRAY_SIZE(EXPR)); ++k) {
+		if (!(parser = parser_open(EXPR[k] ? EXPR[k] : text.buf))) {
+			err = -1;
+			break;
+		}
+		nv = parser_vars(parser);
+		vm = vm_open(parser_dag(parser));
+		jitc = jitc_native(parser_dag(parser));
+		jitc_ = jitc_build(parser_dag(parser));
+		parser_close(parser);
+		if (!vm ||
+		    !jitc ||
+		    !jitc_ ||
+		    !(native = (evaluate_t)jitc_lookup(jitc, "evaluate")) ||
+		    !(gcc = (evaluate_t)jitc_lookup(jitc_, "evaluate")) ||
+		    !(batch = (evaluate_batch_t)jitc_lookup(jitc_,
+							   "evaluate_batch"))) {
+			vm_close(vm);
+			jitc_close(jitc);
+			jitc_close(jitc_);
+			err = -1;
+			break;
+		}
+		for (i=0; !err && (i<n); ++i) {
+			for (j=0; j<nv; ++j) {
+				x[j] = in[j * n + i];
+			}
+			v = vm_execute(vm, x);
+			if (!same(v, native(x)) || !same(v, gcc(x))) {
+				TRACE("backends disagree");
+				err = -1;
+			}
+		}
+		t[0] = ref_time();
+		for (i=0; i<n; ++i) {
+			sink = vm_execute(vm, in + (i % (ARRAY_SIZE(x) * n - 3)));
+		}
+		t[0] = ref_time() - t[0];
+		t[1] = ref_time();
+		for (i=0; i<n; ++i) {
+			sink = native(in + (i % (ARRAY_SIZE(x) * n - 3)));
+		}
+		t[1] = ref_time() - t[1];
+		t[2] = ref_time();
+		for (i=0; i<n; ++i) {
+			sink = gcc(in + (i % (ARRAY_SIZE(x) * n - 3)));
+		}
+		t[2] = ref_time() - t[2];
+		t[3] = ref_time();
+		batch(in, out, n);
+		t[3] = ref_time() - t[3];
+		printf("%-44.44s %8.1f %10.1f %8.1f %8.1f\n",
+		       EXPR[k] ? EXPR[k] : "(deep)",
+		       (double)t[0] / n,
+		       (double)t[1] / n,
+		       (double)t[2] / n,
+		       (double)t[3] / n);
+		vm_close(vm);
+		jitc_close(jitc);
+		jitc_close(jitc_);
+	}
+	FREE(text.buf);
+	FREE(in);
+	FREE(out);
+	if (err) {
+		TRACE(0);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Compiles sums of nonlinear terms over v = 4, 16, 64, ... up to m
+ * variables and compares the gradient of evaluate_grad() with finite
+ * differences: the time of one gradient each way, forward differences
+ * costing v + 1 calls of evaluate(), and the largest deviation of the
+ * reverse-mode gradient from central differences.
+ */
+
+static int
+bench_grad(int argc, char *argv[])
+{
+	const char * const TERM[] = {
+		"x%d * x%d",
+		"exp(0.25 * x%d) - x%d",
+		"log(abs(x%d) + 1) * x%d",
+		"pow(abs(x%d) + 0.5, 1.5) / (x%d * x%d + 1)",
+		"min(x%d, x%d) - max(x%d, 0.5)",
+		"fma(x%d, x%d, sqrt(x%d * x%d + 1))"
+	};
+	const uint64_t R = 2000;
+	double *x, *g, *fd, f, h, a, b, err_;
+	uint64_t t[3], r;
+	struct parser *parser;
+	evaluate_grad_t grad;
+	struct jitc *jitc;
+	evaluate_t fnc;
+	struct text text;
+	char buf[128];
+	int m, v, i, j;
+	int err;
+
+	m = (0 < argc) ? atoi(argv[0]) : 256;
+	x = malloc((m + 1) * sizeof (x[0]));
+	g = malloc((m + 1) * sizeof (g[0]));
+	fd = malloc((m + 1) * sizeof (fd[0]));
+	if ((4 > m) || !x || !g || !fd) {
+		FREE(x);
+		FREE(g);
+		FREE(fd);
+		TRACE("bench setup");
+		return -1;
+	}
+	jitc_cache(NULL, 0);
+	srand(238);
+	memset(&text, 0, sizeof (text));
+	printf("%6s %8s %10s %10s %10s %8s %12s\n",
+	       "vars",
+	       "nodes",
+	       "eval_ns",
+	       "grad_ns",
+	       "fd_ns",
+	       "speedup",
+	       "max_abs_err");
+	err = 0;
+	for (v=4; !err && (v<=m); v*=4) {
+		text.size = 0;
+		err = text_append(&text, "0.05 * (");
+		for (i=0; !err && (i<v); ++i) {
+			safe_sprintf(buf,
+				     sizeof (buf),
+				     TERM[i % ARRAY_SIZE(TERM)],
+				     i,
+				     (i + 1) % v,
+				     (i + 2) % v,
+				     (i + 3) % v);
+			err = text_append(&text, i ? " + " : "") ||
+				text_append(&text, buf);
+		}
+		err = err || text_append(&text, ")");
+		parser = err ? NULL : parser_open(text.buf);
+		jitc = parser ? jitc_build(parser_dag(parser)) : NULL;
+		if (!jitc ||
+		    !(fnc = (evaluate_t)jitc_lookup(jitc, "evaluate")) ||
+		    !(grad = (evaluate_grad_t)jitc_lookup(jitc,
+							  "evaluate_grad"))) {
+			jitc_close(jitc);
+			parser_close(parser);
+			err = -1;
+			break;
+		}
+		for (i=0; i<v; ++i) {
+			x[i] = 2.0 * ((double)rand() / RAND_MAX) - 1.0;
+		}
+
+		/* accuracy against central differences */
+
+		if (!same(fnc(x), grad(x, g))) {
+			TRACE("evaluate() and evaluate_grad() disagree");
+			err = -1;
+		}
+		err_ = 0.0;
+		for (i=0; i<v; ++i) {
+			h = 1e-6;
+			x[i] += h;
+			a = fnc(x);
+			x[i] -= 2.0 * h;
+			b = fnc(x);
+			x[i] += h;
+			err_ = fmax(err_, fabs(g[i] - (a - b) / (2.0 * h)));
+		}
+
+		/* one gradient each way */
+
+		t[0] = ref_time();
+		for (r=0; r<R; ++r) {
+			sink = fnc(x);
+		}
+		t[0] = ref_time() - t[0];
+		t[1] = ref_time();
+		for (r=0; r<R; ++r) {
+			sink = grad(x, g);
+		}
+		t[1] = ref_time() - t[1];
+		t[2] = ref_time();
+		for (r=0; r<R; ++r) {
+			f = fnc(x);
+			for (j=0; j<v; ++j) {
+				h = 1e-7 * fmax(1.0, fabs(x[j]));
+				a = x[j];
+				x[j] += h;
+				fd[j] = (fnc(x) - f) / h;
+				x[j] = a;
+			}
+			sink = fd[r % v];
+		}
+		t[2] = ref_time() - t[2];
+		printf("%6d %8u %10.1f %10.1f %10.1f %8.1f %12.2e\n",
+		       v,
+		       parser_dag(parser)->n,
+		       (double)t[0] / R,
+		       (double)t[1] / R,
+		       (double)t[2] / R,
+		       (double)t[2] / (double)t[1],
+		       err_);
+		if (1e-6 < err_) {
+			TRACE("gradient differs from finite differences");
+			err = -1;
+		}
+		jitc_close(jitc);
+		parser_close(parser);
+	}
+	FREE(text.buf);
+	FREE(x);
+	FREE(g);
+	FREE(fd);
+	if (err) {
+		TRACE(0);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Evaluates n rows of a random expression with jitc_parallel_eval() on 1 to
+ * N threads, N defaulting to the number of processors, and reports the
+ * throughput and the scaling efficiency, speedup over threads, of each.
+ */
+
+static int
+bench_parallel(int argc, char *argv[])
+{
+	double *in, *out, *ref, base, rate;
+	evaluate_batch_t batch;
+	struct parser *parser;
+	uint64_t i, n, nv, t, best;
+	struct jitc *jitc;
+	struct text text;
+	int m, k, r, err;
+
+	n = (0 < argc) ? (uint64_t)atol(argv[0]) : 4000000;
+	m = (1 < argc) ? atoi(argv[1]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	srand(238);
+	memset(&text, 0, sizeof (text));
+	if (!n ||
+	    (0 >= m) ||
+	    mkexpr(&text, 6, 4) ||
+	    !(parser = parser_open(text.buf))) {
+		FREE(text.buf);
+		TRACE("bench setup");
+		return -1;
+	}
+	FREE(text.buf);
+	jitc_cache(NULL, 0);
+	nv = parser_vars(parser);
+	jitc = jitc_build(parser_dag(parser));
+	parser_close(parser);
+	in = jitc_parallel_alloc(nv, n);
+	out = jitc_parallel_alloc(1, n);
+	ref = malloc(n * sizeof (ref[0]));
+	if (!jitc ||
+	    !(batch = (evaluate_batch_t)jitc_lookup(jitc, "evaluate_batch")) ||
+	    !in ||
+	    !out ||
+	    !ref) {
+		jitc_close(jitc);
+		jitc_parallel_free(in, nv, n);
+		jitc_parallel_free(out, 1, n);
+		FREE(ref);
+		TRACE(0);
+		return -1;
+	}
+	for (i=0; i<(nv * n); ++i) {
+		in[i] = 4.0 * ((double)rand() / RAND_MAX) - 2.0;
+	}
+	batch(in, ref, n);
+	printf("%8s %14s %10s %12s\n",
+	       "threads",
+	       "rows_per_s",
+	       "speedup",
+	       "efficiency");
+	base = 0.0;
+	err = 0;
+	for (k=1; !err && (k<=m); ++k) {
+		err = jitc_parallel(k) ||
+			jitc_parallel_eval(batch, nv, in, out, n); /* warm up */
+		best = 0;
+		for (r=0; !err && (r<3); ++r) {
+			t = ref_time();
+			err = jitc_parallel_eval(batch, nv, in, out, n);
+			t = ref_time() - t;
+			best = (!best || (t < best)) ? t : best;
+		}
+		if (err || memcmp(out, ref, n * sizeof (ref[0]))) {
+			TRACE("parallel and serial results differ");
+			err = -1;
+			break;
+		}
+		rate = 1e9 * (double)n / (double)best;
+		base = (1 == k) ? rate : base;
+		printf("%8d %14.3e %10.2f %12.2f\n",
+		       k,
+		       rate,
+		       rate / base,
+		       rate / base / k);
+	}
+	jitc_parallel(0);
+	jitc_close(jitc);
+	jitc_parallel_free(in, nv, n);
+	jitc_parallel_free(out, 1, n);
+	FREE(ref);
+	if (err) {
+		TRACE(0);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * The distance of a and b, both non-negative, in units in the last place.
+ */
+
+static uint64_t
+ulps(double a, double b)
+{
+	int64_t i, j;
+
+	memcpy(&i, &a, sizeof (i));
+	memcpy(&j, &b, sizeof (j));
+	return (i > j) ? (uint64_t)(i - j) : (uint64_t)(j - i);
+}
+
+/**
+ * Builds the expression x0 with every logistic function of
+ * codegen_set_sigmoid() and reports the largest and the mean error of its
+ * evaluate_batch() against sigmoid(), over -708 <= x <= 40 evenly and over
+ * -40 <= x <= 40 at random, and the cost of a row.
+ */
+
+static int
+bench_sigmoid(int argc, char *argv[])
+{
+	double *in, *out, *poly, at, mean;
+	enum codegen_sigmoid k;
+	struct parser *parser;
+	evaluate_batch_t batch;
+	uint64_t i, n, e, max;
+	struct jitc *jitc;
+	int err;
+
+	n = (0 < argc) ? (uint64_t)atol(argv[0]) : 1000000;
+	in = malloc(2 * n * sizeof (in[0]));
+	out = malloc(2 * n * sizeof (out[0]));
+	poly = malloc(2 * n * sizeof (poly[0]));
+	if (!n || !in || !out || !poly || !(parser = parser_open("x0"))) {
+		FREE(in);
+		FREE(out);
+		FREE(poly);
+		TRACE("bench setup");
+		return -1;
+	}
+	srand(238);
+	for (i=0; i<n; ++i) {
+		in[i] = -708.0 + 748.0 * (double)i / (double)n;
+		in[n + i] = 80.0 * ((double)rand() / RAND_MAX) - 40.0;
+	}
+	jitc_cache(NULL, 0);
+	printf("%-10s %10s %12s %10s %10s\n",
+	       "sigmoid",
+	       "max_ulp",
+	       "at_x",
+	       "mean_ulp",
+	       "batch_ns");
+	err = 0;
+	for (k=0; !err && (k<CODEGEN_SIGMOID_END); ++k) {
+		if (codegen_set_sigmoid(k)) {
+			printf("%-10s %10s\n", codegen_sigmoid_name(k), "-");
+			continue;
+		}
+		if (!(jitc = jitc_build(parser_dag(parser))) ||
+		    !(batch = (evaluate_batch_t)jitc_lookup(jitc,
+							   "evaluate_batch"))) {
+			jitc_close(jitc);
+			err = -1;
+			break;
+		}
+		batch(in, out, 2 * n); /* warm up */
+		e = ref_time();
+		batch(in, out, 2 * n);
+		e = ref_time() - e;
+		jitc_close(jitc);
+		max = 0;
+		at = 0.0;
+		mean = 0.0;
+		for (i=0; i<(2 * n); ++i) {
+			mean += (double)ulps(out[i], sigmoid(in[i]));
+			if (max < ulps(out[i], sigmoid(in[i]))) {
+				max = ulps(out[i], sigmoid(in[i]));
+				at = in[i];
+			}
+		}
+		printf("%-10s %10lu %12.6g %10.3f %10.2f\n",
+		       codegen_sigmoid_name(k),
+		       (unsigned long)max,
+		       at,
+		       mean / (double)(2 * n),
+		       (double)e / (double)(2 * n));
+		if (CODEGEN_SIGMOID_POLY == k) {
+			memcpy(poly, out, 2 * n * sizeof (poly[0]));
+		}
+		if ((CODEGEN_SIGMOID_AVX2 == k) &&
+		    memcmp(poly, out, 2 * n * sizeof (poly[0]))) {
+			TRACE("avx2 and poly disagree");
+			err = -1;
+		}
+	}
+	codegen_set_sigmoid(CODEGEN_SIGMOID_POLY);
+	parser_close(parser);
+	FREE(in);
+	FREE(out);
+	FREE(poly);
+	if (err) {
+		TRACE(0);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * The node layout parser_dag had before it became a struct-of-arrays: one
+ * allocation per node, linked by pointers, kept here as the baseline of
+ * bench soa.
+ */
+
+struct link {
+	int op;
+	uint32_t id;
+	double val;
+	struct link *left;
+	struct link *right;
+	struct link *addend;
+};
+
+struct link_frame {
+	const struct link *link;
+	int expanded; /* BOOL: children pushed */
+};
+
+static double
+apply(int op, double a, double b, double c)
+{
+	switch (op) {
+	case PARSER_DAG_NEG: return - b;
+	case PARSER_DAG_MUL: return a * b;
+	case PARSER_DAG_DIV: return b ? (a / b) : 0.0;
+	case PARSER_DAG_ADD: return a + b;
+	case PARSER_DAG_SUB: return a - b;
+	case PARSER_DAG_EXP: return mathfn_exp(b);
+	case PARSER_DAG_LOG: return mathfn_log(b);
+	case PARSER_DAG_SQRT: return sqrt(b);
+	case PARSER_DAG_ABS: return fabs(b);
+	case PARSER_DAG_POW: return mathfn_pow(a, b);
+	case PARSER_DAG_MIN: return (a < b) ? a : b;
+	case PARSER_DAG_MAX: return (a > b) ? a : b;
+	case PARSER_DAG_FMA: return fma(a, b, c);
+	default:
+		EXIT("software");
+	}
+	return 0.0;
+}
+
+/**
+ * Values every node of dag into v, by id, in one pass over the arrays.
+ */
+
+static double
+soa_eval(const struct parser_dag *dag, const double *x, double *v)
+{
+	uint32_t i;
+
+	v[0] = 0.0;
+	for (i=1; i<=dag->n; ++i) {
+		if (PARSER_DAG_VAL == dag->op[i]) {
+			v[i] = dag->pool[dag->left[i]];
+		}
+		else if (PARSER_DAG_VAR == dag->op[i]) {
+			v[i] = x[dag->left[i]];
+		}
+		else {
+			v[i] = apply(dag->op[i],
+				     v[dag->left[i]],
+				     v[dag->right[i]],
+				     v[dag->addend[i]]);
+		}
+	}
+	return v[dag->n];
+}
+
+/**
+ * Values every node reachable from root into v, by id, the way the passes
+ * walked the linked layout: post-order, with an explicit stack of frames
+ * and a mark per node.
+ */
+
+static double
+link_eval(const struct link *root,
+	  const double *x,
+	  double *v,
+	  char *done,
+	  struct link_frame *frames)
+{
+	const struct link *link;
+	struct link_frame *frame;
+	size_t k;
+
+	v[0] = 0.0; /* the absent child */
+	k = 0;
+	frames[k].link = root;
+	frames[k].expanded = 0;
+	++k;
+	while (k) {
+		frame = &frames[k - 1];
+		link = frame->link;
+		if (done[link->id]) {
+			--k;
+			continue;
+		}
+		if (PARSER_DAG_VAL == link->op) {
+			v[link->id] = link->val;
+		}
+		else if (PARSER_DAG_VAR == link->op) {
+			v[link->id] = x[(int)link->val];
+		}
+		else if (frame->expanded) {
+			v[link->id] = apply(link->op,
+					    v[link->left ? link->left->id : 0],
+					    v[link->right->id],
+					    v[link->addend ? link->addend->id : 0]);
+		}
+		else {
+			frame->expanded = 1;
+			if (link->addend) {
+				frames[k].link = link->addend;
+				frames[k++].expanded = 0;
+			}
+			frames[k].link = link->right;
+			frames[k++].expanded = 0;
+			if (link->left) {
+				frames[k].link = link->left;
+				frames[k++].expanded = 0;
+			}
+			continue;
+		}
+		done[link->id] = 1;
+		--k;
+	}
+	return v[root->id];
+}
+
+/**
+ * registry: the registry under test
+ * stop    : BOOL, set once the writer is done
+ * calls   : evaluations by the reader
+ * wrong   : evaluations whose value does not match the version's formula
+ */
+
+struct reader_arg {
+	struct registry *registry;
+	int stop;
+	uint64_t calls;
+	uint64_t wrong;
+};
+
+/**
+ * Evaluates slot 0, whose version k computes sigmoid(x * k), in a loop, one
+ * read section per call, keeping every 64th version pinned across the next
+ * 64 sections.
+ */
+
+static void *
+reader_thread(void *arg)
+{
+	const struct registry_module *module, *pin;
+	struct registry_reader *reader;
+	struct reader_arg *a;
+	double x;
+
+	a = (struct reader_arg *)arg;
+	if (!(reader = registry_join(a->registry))) {
+		a->wrong = 1;
+		return NULL;
+	}
+	x = 0.001;
+	pin = NULL;
+	while (!__atomic_load_n(&a->stop, __ATOMIC_ACQUIRE)) {
+		registry_enter(reader);
+		module = registry_lookup(a->registry, 0);
+		if (!same(module->evaluate(&x),
+			  sigmoid(x * (double)module->version))) {
+			++a->wrong;
+		}
+		if (!(a->calls % 64)) {
+			registry_unpin(pin);
+			pin = registry_pin(a->registry, 0);
+		}
+		registry_exit(reader);
+		if (pin && !same(pin->evaluate(&x),
+				 sigmoid(x * (double)pin->version))) {
+			++a->wrong;
+		}
+		++a->calls;
+	}
+	registry_unpin(pin);
+	registry_leave(reader);
+	return NULL;
+}
+
+/**
+ * Compares jitc_lookup(), a dlsym() per call, with a registry read section
+ * and lookup, then hot-swaps slot 0 to a new native module n times while t
+ * readers evaluate it, reporting how many swaps and evaluations ran and
+ * the most retired modules ever waiting to be unloaded. No evaluation may
+ * run a module after it was unloaded or see another version's formula.
+ */
+
+static int
+bench_registry(int argc, char *argv[])
+{
+	const uint64_t R = 1000000;
+	struct reader_arg a[16];
+	pthread_t thread[16];
+	const struct registry_module *module;
+	struct registry_reader *reader;
+	struct registry *registry;
+	struct parser *parser;
+	uint64_t i, n, t0, t1, t2;
+	struct jitc *jitc;
+	size_t retired, most;
+	int k, t, err;
+	char buf[64];
+	double x;
+
+	n = (0 < argc) ? (uint64_t)atol(argv[0]) : 20000;
+	t = (1 < argc) ? atoi(argv[1]) : 2;
+	t = (0 < t) ? ((16 < t) ? 16 : t) : 1;
+	jitc_cache(NULL, 0);
+	registry = registry_open(1);
+	parser = parser_open("x * 1");
+	jitc = parser ? jitc_build(parser_dag(parser)) : NULL;
+	parser_close(parser);
+	if (!registry || !jitc) {
+		jitc_close(jitc);
+		registry_close(registry);
+		TRACE("bench setup");
+		return -1;
+	}
+
+	/* lookup cost */
+
+	x = 0.001;
+	t0 = ref_time();
+	for (i=0; i<R; ++i) {
+		sink = ((evaluate_t)jitc_lookup(jitc, "evaluate"))(&x);
+	}
+	t0 = ref_time() - t0;
+	if (registry_publish(registry, 0, jitc) ||
+	    !(reader = registry_join(registry))) {
+		registry_close(registry);
+		TRACE(0);
+		return -1;
+	}
+	t1 = ref_time();
+	for (i=0; i<R; ++i) {
+		registry_enter(reader);
+		module = registry_lookup(registry, 0);
+		sink = module->evaluate(&x);
+		registry_exit(reader);
+	}
+	t1 = ref_time() - t1;
+	registry_leave(reader);
+	printf("%-16s %10.1f\n", "dlsym_call_ns", (double)t0 / R);
+	printf("%-16s %10.1f\n", "registry_call_ns", (double)t1 / R);
+
+	/* hot swap */
+
+	memset(a, 0, sizeof (a));
+	err = 0;
+	for (k=0; k<t; ++k) {
+		a[k].registry = registry;
+		if (pthread_create(&thread[k], NULL, reader_thread, &a[k])) {
+			TRACE("pthread_create()");
+			err = -1;
+			break;
+		}
+	}
+	t = k;
+	most = 0;
+	t2 = ref_time();
+	for (i=2; !err && (i<=(n + 1)); ++i) {
+		safe_sprintf(buf, sizeof (buf), "x * %lu", (unsigned long)i);
+		if (!(parser = parser_open(buf)) ||
+		    !(jitc = jitc_native(parser_dag(parser))) ||
+		    registry_publish(registry, 0, jitc)) {
+			err = -1;
+		}
+		parser_close(parser);
+		retired = registry_reclaim(registry);
+		most = (retired > most) ? retired : most;
+		if (!(i % 64)) {
+			sched_yield(); /* lets readers run on one processor */
+		}
+	}
+	t2 = ref_time() - t2;
+	for (k=0; k<t; ++k) {
+		__atomic_store_n(&a[k].stop, 1, __ATOMIC_RELEASE);
+		pthread_join(thread[k], NULL);
+		err = err || a[k].wrong;
+		a[0].calls += k ? a[k].calls : 0;
+	}
+	retired = registry_reclaim(registry);
+	printf("%-16s %10lu\n", "readers", (unsigned long)t);
+	i -= 2;
+	printf("%-16s %10lu\n", "swaps", (unsigned long)i);
+	printf("%-16s %10.1f\n",
+	       "swap_us",
+	       1e-3 * (double)t2 / (double)(i + !i));
+	printf("%-16s %10lu\n", "evaluations", (unsigned long)a[0].calls);
+	printf("%-16s %10lu\n", "most_retired", (unsigned long)most);
+	printf("%-16s %10lu\n", "left_retired", (unsigned long)retired);
+	registry_close(registry);
+	if (err || retired) {
+		TRACE("hot swap");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Parses a sum of m million distinct products, about three nodes per term,
+ * and compares the struct-of-arrays dag with the pointer-linked layout it
+ * replaced: bytes per node, and the best of five full traversals that value
+ * every node.
+ */
+
+static int
+bench_soa(int argc, char *argv[])
+{
+	const double X[] = { 0.5, -1.25, 3.0, 0.0, 2.0, -0.5, 1.5, 0.25 };
+	uint64_t parse, t, soa, ptr;
+	struct link_frame *frames;
+	const struct parser_dag *dag;
+	struct link **link;
+	struct parser *parser;
+	size_t bytes, nval;
+	struct text text;
+	double a, b, *v;
+	char buf[64];
+	uint32_t i;
+	long j, m;
+	char *done;
+	int r;
+
+	m = (0 < argc) ? atol(argv[0]) : 10;
+	memset(&text, 0, sizeof (text));
+	for (j=0; j<(m * 1000000 / 3); ++j) {
+		safe_sprintf(buf,
+			     sizeof (buf),
+			     "%sx%d * %ld.5",
+			     j ? " + " : "",
+			     (int)(j % (long)ARRAY_SIZE(X)),
+			     j);
+		if (text_append(&text, buf)) {
+			FREE(text.buf);
+			TRACE(0);
+			return -1;
+		}
+	}
+	parse = ref_time();
+	parser = text.buf ? parser_open(text.buf) : NULL;
+	parse = ref_time() - parse;
+	FREE(text.buf);
+	if (!parser) {
+		TRACE(0);
+		return -1;
+	}
+	dag = parser_dag(parser);
+	v = malloc(((size_t)dag->n + 1) * sizeof (v[0]));
+	link = malloc(((size_t)dag->n + 1) * sizeof (link[0]));
+	done = malloc((size_t)dag->n + 1);
+	frames = malloc((3 * (size_t)dag->n + 1) * sizeof (frames[0]));
+	if (!v || !link || !done || !frames) {
+		FREE(v);
+		FREE(link);
+		FREE(done);
+		FREE(frames);
+		parser_close(parser);
+		TRACE("out of memory");
+		return -1;
+	}
+	memset(link, 0, ((size_t)dag->n + 1) * sizeof (link[0]));
+	nval = 0;
+	for (i=1; i<=dag->n; ++i) {
+		if (!(link[i] = malloc(sizeof (struct link)))) {
+			break;
+		}
+		link[i]->op = dag->op[i];
+		link[i]->id = i;
+		link[i]->val = 0.0;
+		link[i]->left = NULL;
+		link[i]->right = NULL;
+		link[i]->addend = NULL;
+		if (PARSER_DAG_VAL == dag->op[i]) {
+			link[i]->val = dag->pool[dag->left[i]];
+			++nval;
+		}
+		else if (PARSER_DAG_VAR == dag->op[i]) {
+			link[i]->val = (double)dag->left[i];
+		}
+		else {
+			link[i]->left = link[dag->left[i]];
+			link[i]->right = link[dag->right[i]];
+			link[i]->addend = link[dag->addend[i]];
+		}
+	}
+	soa = ptr = 0;
+	a = b = 0.0;
+	if (i > dag->n) {
+		for (r=0; r<5; ++r) {
+			t = ref_time();
+			a = soa_eval(dag, X, v);
+			t = ref_time() - t;
+			soa = (!soa || (t < soa)) ? t : soa;
+			memset(done, 0, (size_t)dag->n + 1);
+			t = ref_time();
+			b = link_eval(link[dag->n], X, v, done, frames);
+			t = ref_time() - t;
+			ptr = (!ptr || (t < ptr)) ? t : ptr;
+		}
+		sink = a + b;
+		bytes = sizeof (dag->op[0]) +
+			sizeof (dag->left[0]) +
+			sizeof (dag->right[0]) +
+			sizeof (dag->addend[0]);
+		printf("%-16s %14lu\n", "nodes", (unsigned long)dag->n);
+		printf("%-16s %14lu\n", "constants", (unsigned long)nval);
+		printf("%-16s %14.2f\n", "parse_ms", 1e-6 * (double)parse);
+		printf("%-16s %14.1f\n",
+		       "soa_bytes/node",
+		       (double)(bytes * dag->n + sizeof (double) * nval) /
+		       (double)dag->n);
+		printf("%-16s %14lu\n",
+		       "ptr_bytes/node",
+		       (unsigned long)sizeof (struct link));
+		printf("%-16s %14.2f\n", "soa_walk_ms", 1e-6 * (double)soa);
+		printf("%-16s %14.2f\n", "ptr_walk_ms", 1e-6 * (double)ptr);
+		printf("%-16s %14.1f\n", "speedup", (double)ptr / (double)soa);
+	}
+	for (i=1; i<=dag->n; ++i) {
+		FREE(link[i]);
+	}
+	FREE(v);
+	FREE(link);
+	FREE(done);
+	FREE(frames);
+	parser_close(parser);
+	if (!soa || !same(a, b)) {
+		TRACE("linked and struct-of-arrays values differ");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Streams n lines drawn from d distinct random expressions of the given
+ * depth through stream_run(), nine lines in ten from the hottest tenth of
+ * them, with increasing compile thresholds, 0 interpreting only, under
+ * every division mode, and reports the throughput of each. Within a mode,
+ * every run must print the same output and count the same divisions by
+ * zero, whether the interpreter or gcc's code answered a line.
+ */
+
+static int
+bench_stream(int argc, char *argv[])
+{
+	char *DEFAULTS[] = { "x0=0.5", "x1=-1.25", "x2=3", "x3=0.75" };
+	const uint64_t THRESHOLD[] = { 0, 64, 1024 };
+	const unsigned OPTIMIZE[] = {
+		0,                      /* CODEGEN_DIVISION_BLEND */
+		PARSER_OPTIMIZE_IEEE,   /* CODEGEN_DIVISION_IEEE */
+		PARSER_OPTIMIZE_CHECKED /* CODEGEN_DIVISION_CHECKED */
+	};
+	char *buf[ARRAY_SIZE(THRESHOLD)], line[64];
+	size_t size[ARRAY_SIZE(THRESHOLD)], k;
+	struct stream_stats stats;
+	struct text text, *expr;
+	enum codegen_division m;
+	uint64_t i, j, n, d, faults;
+	FILE *in, *out;
+	int depth, err;
+
+	n = (0 < argc) ? (uint64_t)atol(argv[0]) : 1000000;
+	d = (1 < argc) ? (uint64_t)atol(argv[1]) : 2000;
+	depth = (2 < argc) ? atoi(argv[2]) : 6;
+	if (!n ||
+	    (10 > d) ||
+	    (0 >= depth) ||
+	    !(expr = malloc(d * sizeof (expr[0])))) {
+		TRACE("bench setup");
+		return -1;
+	}
+	memset(expr, 0, d * sizeof (expr[0]));
+	memset(&text, 0, sizeof (text));
+	srand(238);
+	err = 0;
+	for (j=0; !err && (j<d); ++j) {
+		err = mkexpr(&expr[j], depth, ARRAY_SIZE(DEFAULTS));
+	}
+	for (i=0; !err && (i<n); ++i) {
+		j = (uint64_t)rand() % ((rand() % 10) ? (d / 10) : d);
+		line[0] = '\0';
+		if (rand() % 2) {
+			safe_sprintf(line,
+				     sizeof (line),
+				     " ; x0=%d x2=%d.5",
+				     rand() % 100,
+				     rand() % 100);
+		}
+		err = text_append(&text, expr[j].buf) ||
+			text_append(&text, line) ||
+			text_append(&text, "\n");
+	}
+	for (j=0; j<d; ++j) {
+		FREE(expr[j].buf);
+	}
+	FREE(expr);
+	if (err) {
+		FREE(text.buf);
+		TRACE(0);
+		return -1;
+	}
+	jitc_cache(NULL, 0);
+	printf("%-8s %10s %10s %10s %10s %8s %8s %12s\n",
+	       "division",
+	       "threshold",
+	       "lines",
+	       "distinct",
+	       "compiled",
+	       "errors",
+	       "faults",
+	       "exprs/s");
+	memset(buf, 0, sizeof (buf));
+	memset(size, 0, sizeof (size));
+	for (m=0; !err && (m<CODEGEN_DIVISION_END); ++m) {
+		codegen_set_division(m);
+		faults = 0;
+		for (k=0; !err && (k<ARRAY_SIZE(THRESHOLD)); ++k) {
+			FREE(buf[k]);
+			size[k] = 0;
+			in = fmemopen(text.buf, text.size, "r");
+			out = open_memstream(&buf[k], &size[k]);
+			err = !in ||
+				!out ||
+				stream_run(in,
+					   out,
+					   ARRAY_SIZE(DEFAULTS),
+					   DEFAULTS,
+					   THRESHOLD[k],
+					   OPTIMIZE[m],
+					   &stats);
+			if (in) {
+				fclose(in);
+			}
+			if (out) {
+				fclose(out);
+			}
+			if (!err && ((size[k] != size[0]) ||
+				     memcmp(buf[k], buf[0], size[0]))) {
+				TRACE("interpreted and compiled output differ");
+				err = -1;
+			}
+			if (!err && k && (stats.faults != faults)) {
+				TRACE("interpreted and compiled faults differ");
+				err = -1;
+			}
+			faults = stats.faults;
+			if (!err) {
+				printf("%-8s %10lu %10lu %10lu %10lu %8lu %8lu"
+				       " %12.0f\n",
+				       codegen_division_name(m),
+				       (unsigned long)THRESHOLD[k],
+				       (unsigned long)stats.lines,
+				       (unsigned long)stats.distinct,
+				       (unsigned long)stats.compiled,
+				       (unsigned long)stats.errors,
+				       (unsigned long)stats.faults,
+				       1e9 * (double)stats.lines /
+				       (double)stats.ns);
+				fflush(stdout);
+			}
+		}
+	}
+	codegen_set_division(CODEGEN_DIVISION_BLEND);
+	for (k=0; k<ARRAY_SIZE(THRESHOLD); ++k) {
+		FREE(buf[k]);
+	}
+	FREE(text.buf);
+	if (err) {
+		TRACE(0);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Evaluates one expression through the tiered handle until the background
+ * compile lands, reporting the first-call latency, the interpreted and the
+ * compiled per-call cost and how long the promotion took.
+ */
+
+static int
+bench_tier(int argc, char *argv[])
+{
+	const uint64_t R = 100000;
+	uint64_t threshold, calls, t, t0, first, vm, jit;
+	struct tier *tier;
+	struct text text;
+	uint64_t i, n;
+	double v;
+
+	threshold = (0 < argc) ? (uint64_t)atol(argv[0]) : 1000;
+	srand(238);
+	memset(&text, 0, sizeof (text));
+	if (mkexpr(&text, 8, 0)) {
+		FREE(text.buf);
+		TRACE(0);
+		return -1;
+	}
+	t0 = ref_time();
+	if (!(tier = tier_open(text.buf, threshold))) {
+		FREE(text.buf);
+		TRACE(0);
+		return -1;
+	}
+	FREE(text.buf);
+	v = tier_evaluate(tier, NULL);
+	first = ref_time() - t0;
+
+	/* stay below the threshold so no compile competes for the CPU */
+
+	n = (2 < threshold) ? (threshold - 2) : 1;
+	t = ref_time();
+	for (i=0; i<n; ++i) {
+		sink = tier_evaluate(tier, NULL);
+	}
+	vm = (ref_time() - t) / n;
+	calls = n + 1;
+	while (!tier_compiled(tier)) {
+		if (!threshold || ((ref_time() - t0) > 10000000000ULL)) {
+			break;
+		}
+		sink = tier_evaluate(tier, NULL);
+		++calls;
+	}
+	printf("%-24s %12lu\n", "threshold", (unsigned long)threshold);
+	printf("%-24s %12.1f\n", "first_call_us", 1e-3 * (double)first);
+	printf("%-24s %12lu\n", "interpreted_call_ns", (unsigned long)vm);
+	if (tier_compiled(tier)) {
+		printf("%-24s %12lu\n", "calls_until_swap", (unsigned long)calls);
+		printf("%-24s %12.1f\n",
+		       "swap_after_ms",
+		       1e-6 * (double)(ref_time() - t0));
+		t = ref_time();
+		for (i=0; i<R; ++i) {
+			sink = tier_evaluate(tier, NULL);
+		}
+		jit = (ref_time() - t) / R;
+		printf("%-24s %12lu\n", "compiled_call_ns", (unsigned long)jit);
+		if (!same(v, tier_evaluate(tier, NULL))) {
+			tier_close(tier);
+			TRACE("interpreter and gcc disagree");
+			return -1;
+		}
+	}
+	tier_close(tier);
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const struct {
+		const char *name;
+		int (*fnc)(int argc, char *argv[]);
+	} BENCH[] = {
+		{ "batch", bench_batch },
+		{ "cache", bench_cache },
+		{ "cse", bench_cse },
+		{ "division", bench_division },
+		{ "fold", bench_fold },
+		{ "grad", bench_grad },
+		{ "load", bench_load },
+		{ "many", bench_many },
+		{ "math", bench_math },
+		{ "memfd", bench_memfd },
+		{ "native", bench_native },
+		{ "parallel", bench_parallel },
+		{ "phases", bench_phases },
+		{ "pool", bench_pool },
+		{ "registry", bench_registry },
+		{ "scale", bench_scale },
+		{ "sigmoid", bench_sigmoid },
+		{ "soa", bench_soa },
+		{ "stream", bench_stream },
+		{ "tier", bench_tier },
+		{ "tune", bench_tune }
+	};
+	size_t i;
+
+	if (2 <= argc) {
+		for (i=0; i<ARRAY_SIZE(BENCH); ++i) {
+			if (!strcmp(argv[1], BENCH[i].name)) {
+				return BENCH[i].fnc(argc - 2, argv + 2);
+			}
+		}
+	}
+	printf("usage: %s benchmark [args...]\n", argv[0]);
+	for (i=0; i<ARRAY_SIZE(BENCH); ++i) {
+		printf("  %s\n", BENCH[i].name);
+	}
+	return -1;
+}
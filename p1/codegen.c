@@ -0,0 +1,753 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * codegen.c
+ */
+
+#include <math.h>
+#include "mathfn.h"
+#include "codegen.h"
+
+static enum codegen_sigmoid sigmoid_ = CODEGEN_SIGMOID_POLY; /* see setter */
+static enum codegen_division division_ = CODEGEN_DIVISION_BLEND; /* ditto */
+
+/**
+ * Coefficients of the degree 13 Taylor polynomial of e^r, highest first.
+ */
+
+static const char * const TAYLOR[] = {
+	"1.6059043836821613e-10",
+	"2.0876756987868100e-09",
+	"2.5052108385441720e-08",
+	"2.7557319223985890e-07",
+	"2.7557319223985893e-06",
+	"2.4801587301587302e-05",
+	"1.9841269841269841e-04",
+	"1.3888888888888889e-03",
+	"8.3333333333333332e-03",
+	"4.1666666666666664e-02",
+	"1.6666666666666666e-01",
+	"0.5",
+	"1.0",
+	"1.0"
+};
+
+/**
+ * The logistic functions gcc can vectorize share a reduction of e^-x to
+ * r = -x - k ln2 with |r| <= ln2/2, and a scale by 2^k assembled directly in
+ * the exponent bits. Rounding k uses the 1.5 * 2^52 shift, which leaves k in
+ * the low mantissa bits, unless gcc may reassociate and would fold the
+ * shift away; then k is rounded by a slower conversion to int.
+ *
+ * -x is first clamped to [-708, 709], NaN passing through, on its integer
+ * bits: lo and hi are 1 if its magnitude m exceeds that of the bound on
+ * its side and it is not NaN, each test the sign bit of a difference. Like
+ * divide(), this has no floating-point comparison that could trap, so gcc
+ * vectorizes evaluate_batch() whether or not -fno-trapping-math is given.
+ */
+
+static const char * const REDUCE =
+	"const double SHIFT = 6755399441055744.0;\n"
+	"unsigned long long u, m, lo, hi;\n"
+	"double y, k, r, s;\n"
+	"y = -x;\n"
+	"__builtin_memcpy(&u, &y, sizeof (u));\n"
+	"m = u << 1 >> 1;\n"
+	"hi = (m - 0x7ff0000000000001ULL) >> 63;\n"
+	"lo = hi & (u >> 63) & ((0x4086200000000000ULL - m) >> 63);\n"
+	"hi = hi & ((u >> 63) ^ 1) & ((0x4086280000000000ULL - m) >> 63);\n"
+	"u = (u & (lo + hi - 1)) |\n"
+	"    (0xc086200000000000ULL & (0 - lo)) |\n"
+	"    (0x4086280000000000ULL & (0 - hi));\n"
+	"__builtin_memcpy(&y, &u, sizeof (y));\n"
+	"#ifdef __ASSOCIATIVE_MATH__\n"
+	"k = y * 1.4426950408889634;\n"
+	"k = (double)(int)(k + __builtin_copysign(0.5, k));\n"
+	"u = (unsigned long long)(long long)k;\n"
+	"#else\n"
+	"k = y * 1.4426950408889634 + SHIFT;\n"
+	"__builtin_memcpy(&u, &k, sizeof (u));\n"
+	"k -= SHIFT;\n"
+	"#endif\n"
+	"r = y - k * 6.93147180369123816490e-01;\n"
+	"r = r - k * 1.90821492927058770002e-10;\n"
+	"u = (u + 1023) << 52;\n"
+	"__builtin_memcpy(&s, &u, sizeof (s));\n";
+
+/**
+ * The [5/5] Pade approximant of e^r is (E + O) / (E - O), E and O its even
+ * and odd parts, so that the logistic function needs a single division.
+ */
+
+static const char * const RATIONAL =
+	"double z, e, o;\n"
+	"z = r * r;\n"
+	"e = 1.0 + z * (1.1111111111111111e-01 + z * 9.9206349206349206e-04);\n"
+	"o = 1.3888888888888888e-02 + z * 3.3068783068783069e-05;\n"
+	"o = r * (0.5 + z * o);\n"
+	"return (e - o) / ((e - o) + (e + o) * s);\n";
+
+/**
+ * CODEGEN_SIGMOID_POLY four rows at a time: the same operations in the same
+ * order, so the results agree bit for bit. k is rounded to nearest even by
+ * the processor, as the shift does.
+ */
+
+static const char * const AVX2_HEAD =
+	"#include <immintrin.h>\n"
+	"__attribute__((target(\"avx2\")))\n"
+	"static void sigmoid_avx2(double *out, size_t n) {\n"
+	"const __m256d ONE = _mm256_set1_pd(1.0);\n"
+	"__m256d y, k, r, p;\n"
+	"__m256i u;\n"
+	"size_t i;\n"
+	"for (i = 0; i + 4 <= n; i += 4) {\n"
+	"y = _mm256_xor_pd(_mm256_loadu_pd(out + i), _mm256_set1_pd(-0.0));\n"
+	"y = _mm256_max_pd(_mm256_set1_pd(-708.0), y);\n"
+	"y = _mm256_min_pd(_mm256_set1_pd(709.0), y);\n"
+	"k = _mm256_mul_pd(y, _mm256_set1_pd(1.4426950408889634));\n"
+	"k = _mm256_round_pd(k, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);\n"
+	"u = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(k));\n"
+	"r = _mm256_mul_pd(k, _mm256_set1_pd(6.93147180369123816490e-01));\n"
+	"r = _mm256_sub_pd(y, r);\n"
+	"p = _mm256_mul_pd(k, _mm256_set1_pd(1.90821492927058770002e-10));\n"
+	"r = _mm256_sub_pd(r, p);\n";
+
+static const char * const AVX2_TAIL =
+	"u = _mm256_add_epi64(u, _mm256_set1_epi64x(1023));\n"
+	"p = _mm256_mul_pd(p, _mm256_castsi256_pd(_mm256_slli_epi64(u, 52)));\n"
+	"_mm256_storeu_pd(out + i, _mm256_div_pd(ONE, _mm256_add_pd(ONE, p)));\n"
+	"}\n"
+	"for (; i < n; ++i) {\n"
+	"out[i] = sigmoid_v(out[i]);\n"
+	"}\n"
+	"}\n";
+
+/**
+ * The guarded division without a branch, like the native backend's: the
+ * quotient is always computed and its bits masked off if b is +0 or -0,
+ * giving +0. nonzero() works on the integer bits of b, so the comparison
+ * cannot raise a floating-point exception and gcc vectorizes the loop of
+ * evaluate_batch() even without SSE4.1 blends or -fno-trapping-math.
+ */
+
+static const char * const DIVIDE =
+	"static inline unsigned long long nonzero(double b) {\n"
+	"unsigned long long u;\n"
+	"__builtin_memcpy(&u, &b, sizeof (u));\n"
+	"u <<= 1;\n"
+	"return (u | (0 - u)) >> 63;\n"
+	"}\n"
+	"static inline double divide(double a, double b) {\n"
+	"unsigned long long u;\n"
+	"double q;\n"
+	"q = a / b;\n"
+	"__builtin_memcpy(&u, &q, sizeof (u));\n"
+	"u &= 0 - nonzero(b);\n"
+	"__builtin_memcpy(&q, &u, sizeof (q));\n"
+	"return q;\n"
+	"}\n";
+
+/**
+ * Writes sigmoid_v(), the logistic function of evaluate_batch(), and for
+ * CODEGEN_SIGMOID_AVX2 also sigmoid_avx2(), which applies it to out[0 .. n)
+ * in place.
+ */
+
+static void
+sigmoid_kernel(FILE *file)
+{
+	size_t i;
+
+	fprintf(file, "static inline double sigmoid_v(double x) {\n");
+	if (CODEGEN_SIGMOID_EXACT == sigmoid_) {
+		fprintf(file, "return sigmoid(x);\n");
+		fprintf(file, "}\n");
+		return;
+	}
+	fprintf(file, "%s", REDUCE);
+	if (CODEGEN_SIGMOID_RATIONAL == sigmoid_) {
+		fprintf(file, "%s", RATIONAL);
+		fprintf(file, "}\n");
+		return;
+	}
+	fprintf(file, "double p = %s;\n", TAYLOR[0]);
+	for (i=1; i<ARRAY_SIZE(TAYLOR); ++i) {
+		fprintf(file, "p = p * r + %s;\n", TAYLOR[i]);
+	}
+	fprintf(file, "return 1.0 / (1.0 + p * s);\n");
+	fprintf(file, "}\n");
+	if (CODEGEN_SIGMOID_AVX2 == sigmoid_) {
+		fprintf(file, "%s", AVX2_HEAD);
+		fprintf(file, "p = _mm256_set1_pd(%s);\n", TAYLOR[0]);
+		for (i=1; i<ARRAY_SIZE(TAYLOR); ++i) {
+			fprintf(file,
+				"p = _mm256_add_pd(_mm256_mul_pd(p, r),"
+				" _mm256_set1_pd(%s));\n",
+				TAYLOR[i]);
+		}
+		fprintf(file, "%s", AVX2_TAIL);
+	}
+}
+
+static void
+literal(FILE *file, double v)
+{
+	if (isnan(v)) {
+		fprintf(file, "(0.0 / 0.0)");
+	}
+	else if (isinf(v)) {
+		fprintf(file, "(%s1.0 / 0.0)", (0.0 > v) ? "-" : "");
+	}
+	else if (!v && signbit(v)) {
+		fprintf(file, "-0.0"); /* %g writes -0, the int 0 to C */
+	}
+	else {
+		fprintf(file, "%.17g", v);
+	}
+}
+
+/**
+ * Writes the statement computing node i of dag into temporary t<i>, whose
+ * children's temporaries precede it. var tells how variable %d is read,
+ * e.g., "x[%d]".
+ */
+
+static void
+reflect(const struct parser_dag *dag, uint32_t i, const char *var, FILE *file)
+{
+	uint32_t l, r;
+
+	l = dag->left[i];
+	r = dag->right[i];
+	if (PARSER_DAG_VAL == dag->op[i]) {
+		fprintf(file, "double t%u = ", i);
+		literal(file, dag->pool[l]);
+		fprintf(file, ";\n");
+	}
+	else if (PARSER_DAG_VAR == dag->op[i]) {
+		fprintf(file, "double t%u = ", i);
+		fprintf(file, var, (int)l);
+		fprintf(file, ";\n");
+	}
+	else if (PARSER_DAG_NEG == dag->op[i]) {
+		fprintf(file, "double t%u = - t%u;\n", i, r);
+	}
+	else if (PARSER_DAG_MUL == dag->op[i]) {
+		fprintf(file, "double t%u = t%u * t%u;\n", i, l, r);
+	}
+	else if (PARSER_DAG_DIV == dag->op[i]) {
+		fprintf(file,
+			(CODEGEN_DIVISION_IEEE == division_) ?
+			"double t%u = t%u / t%u;\n" :
+			"double t%u = divide(t%u, t%u);\n",
+			i,
+			l,
+			r);
+		if (CODEGEN_DIVISION_CHECKED == division_) {
+			fprintf(file, "faults += 1 - nonzero(t%u);\n", r);
+		}
+	}
+	else if (PARSER_DAG_ADD == dag->op[i]) {
+		fprintf(file, "double t%u = t%u + t%u;\n", i, l, r);
+	}
+	else if (PARSER_DAG_SUB == dag->op[i]) {
+		fprintf(file, "double t%u = t%u - t%u;\n", i, l, r);
+	}
+	else if ((PARSER_DAG_EXP == dag->op[i]) ||
+		 (PARSER_DAG_LOG == dag->op[i]) ||
+		 (PARSER_DAG_SQRT == dag->op[i]) ||
+		 (PARSER_DAG_ABS == dag->op[i])) {
+		fprintf(file,
+			"double t%u = %s(t%u);\n",
+			i,
+			(PARSER_DAG_EXP == dag->op[i]) ? "mathfn_exp" :
+			(PARSER_DAG_LOG == dag->op[i]) ? "mathfn_log" :
+			(PARSER_DAG_SQRT == dag->op[i]) ? "__builtin_sqrt" :
+			"__builtin_fabs",
+			r);
+	}
+	else if (PARSER_DAG_POW == dag->op[i]) {
+		fprintf(file, "double t%u = mathfn_pow(t%u, t%u);\n", i, l, r);
+	}
+	else if ((PARSER_DAG_MIN == dag->op[i]) ||
+		 (PARSER_DAG_MAX == dag->op[i])) {
+		fprintf(file,
+			"double t%u = (t%u %c t%u) ? t%u : t%u;\n",
+			i,
+			l,
+			(PARSER_DAG_MIN == dag->op[i]) ? '<' : '>',
+			r,
+			l,
+			r);
+	}
+	else if (PARSER_DAG_FMA == dag->op[i]) {
+		fprintf(file,
+			"double t%u = __builtin_fma(t%u, t%u, t%u);\n",
+			i,
+			l,
+			r,
+			dag->addend[i]);
+	}
+	else {
+		EXIT("software");
+	}
+}
+
+/**
+ * Returns the set of ops dag uses, op k as bit k.
+ */
+
+static unsigned
+uses(const struct parser_dag *dag)
+{
+	unsigned mask;
+	uint32_t i;
+
+	mask = 0;
+	for (i=1; i<=dag->n; ++i) {
+		mask |= 1u << dag->op[i];
+	}
+	return mask;
+}
+
+/**
+ * Writes the math kernels the expressions flagged in mask call, see uses().
+ * They are static so that gcc inlines and vectorizes them.
+ */
+
+static void
+kernels(unsigned mask, FILE *file)
+{
+	if (mask & ((1u << PARSER_DAG_EXP) | (1u << PARSER_DAG_POW))) {
+		fprintf(file, "static inline %s\n", MATHFN_TEXT(MATHFN_EXP));
+	}
+	if (mask & ((1u << PARSER_DAG_LOG) | (1u << PARSER_DAG_POW))) {
+		fprintf(file, "static inline %s\n", MATHFN_TEXT(MATHFN_LOG));
+	}
+	if (mask & (1u << PARSER_DAG_POW)) {
+		fprintf(file, "static inline %s\n", MATHFN_TEXT(MATHFN_POW));
+	}
+	if ((mask & (1u << PARSER_DAG_DIV)) &&
+	    (CODEGEN_DIVISION_IEEE != division_)) {
+		fprintf(file, "%s", DIVIDE);
+	}
+}
+
+/**
+ * Writes the definitions every program carries: the name of its division
+ * policy and the count of its divisions by zero, see codegen().
+ */
+
+static void
+policy(FILE *file)
+{
+	fprintf(file,
+		"const char division[] = \"%s\";\n",
+		codegen_division_name(division_));
+	fprintf(file, "unsigned long long division_faults;\n");
+}
+
+/**
+ * In CODEGEN_DIVISION_CHECKED, a function counts its divisions by zero in
+ * a local, which gcc can vectorize, and publishes it once on the way out.
+ */
+
+static void
+faults_open(FILE *file)
+{
+	if (CODEGEN_DIVISION_CHECKED == division_) {
+		fprintf(file, "unsigned long long faults = 0;\n");
+	}
+}
+
+static void
+faults_close(FILE *file)
+{
+	if (CODEGEN_DIVISION_CHECKED == division_) {
+		fprintf(file,
+			"if (faults) __atomic_fetch_add(&division_faults,"
+			" faults,"
+			" __ATOMIC_RELAXED);\n");
+	}
+}
+
+static void
+scalar(const struct parser_dag *dag, const char *name, FILE *file)
+{
+	uint32_t i;
+
+	fprintf(file, "double %s(const double *x) {\n", name);
+	fprintf(file, "(void)x;\n");
+	faults_open(file);
+	for (i=1; i<=dag->n; ++i) {
+		reflect(dag, i, "x[%d]", file);
+	}
+	faults_close(file);
+	fprintf(file, "return sigmoid(t%u);\n", dag->n);
+	fprintf(file, "}\n");
+}
+
+/**
+ * Returns, by id, whether a node depends on a variable, i.e., has a
+ * gradient; entry 0, the absent child, does not.
+ */
+
+static char *
+liveness(const struct parser_dag *dag)
+{
+	char *live;
+	uint32_t i;
+
+	if (!(live = malloc((size_t)dag->n + 1))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	live[0] = 0;
+	for (i=1; i<=dag->n; ++i) {
+		if (PARSER_DAG_VAL == dag->op[i]) {
+			live[i] = 0;
+		}
+		else if (PARSER_DAG_VAR == dag->op[i]) {
+			live[i] = 1;
+		}
+		else {
+			live[i] = live[dag->left[i]] ||
+				live[dag->right[i]] ||
+				live[dag->addend[i]];
+		}
+	}
+	return live;
+}
+
+/**
+ * Writes the statements of the backward pass that propagate a<i>, the
+ * adjoint of live node i, to the adjoints of its live children, reading
+ * the temporaries of the forward pass. Derivatives follow the forward
+ * statements of reflect(): a guarded division by zero, the branch min()
+ * and max() did not take and the exponent of a non-positive base of pow()
+ * all contribute 0, as does abs() at 0. Under CODEGEN_DIVISION_IEEE, the
+ * division is not guarded either way.
+ */
+
+static void
+adjoint(const struct parser_dag *dag,
+	uint32_t i,
+	const char *live,
+	FILE *file)
+{
+	uint32_t l, r, c;
+
+	l = dag->left[i];
+	r = dag->right[i];
+	c = dag->addend[i];
+	if (PARSER_DAG_VAR == dag->op[i]) {
+		fprintf(file, "grad[%u] = a%u;\n", l, i);
+	}
+	else if (PARSER_DAG_NEG == dag->op[i]) {
+		fprintf(file, "a%u -= a%u;\n", r, i);
+	}
+	else if ((PARSER_DAG_ADD == dag->op[i]) ||
+		 (PARSER_DAG_SUB == dag->op[i])) {
+		if (live[l]) {
+			fprintf(file, "a%u += a%u;\n", l, i);
+		}
+		if (live[r]) {
+			fprintf(file,
+				"a%u %c= a%u;\n",
+				r,
+				(PARSER_DAG_ADD == dag->op[i]) ? '+' : '-',
+				i);
+		}
+	}
+	else if ((PARSER_DAG_MUL == dag->op[i]) ||
+		 (PARSER_DAG_FMA == dag->op[i])) {
+		if (live[l]) {
+			fprintf(file, "a%u += a%u * t%u;\n", l, i, r);
+		}
+		if (live[r]) {
+			fprintf(file, "a%u += a%u * t%u;\n", r, i, l);
+		}
+		if (c && live[c]) {
+			fprintf(file, "a%u += a%u;\n", c, i);
+		}
+	}
+	else if (PARSER_DAG_DIV == dag->op[i]) {
+		if (CODEGEN_DIVISION_IEEE != division_) {
+			fprintf(file, "if (t%u) {\n", r);
+		}
+		if (live[l]) {
+			fprintf(file, "a%u += a%u / t%u;\n", l, i, r);
+		}
+		if (live[r]) {
+			fprintf(file, "a%u -= a%u * t%u / t%u;\n", r, i, i, r);
+		}
+		if (CODEGEN_DIVISION_IEEE != division_) {
+			fprintf(file, "}\n");
+		}
+	}
+	else if (PARSER_DAG_EXP == dag->op[i]) {
+		fprintf(file, "a%u += a%u * t%u;\n", r, i, i);
+	}
+	else if (PARSER_DAG_LOG == dag->op[i]) {
+		fprintf(file, "a%u += a%u / t%u;\n", r, i, r);
+	}
+	else if (PARSER_DAG_SQRT == dag->op[i]) {
+		fprintf(file, "a%u += 0.5 * a%u / t%u;\n", r, i, i);
+	}
+	else if (PARSER_DAG_ABS == dag->op[i]) {
+		fprintf(file,
+			"a%u += (t%u > 0.0) ? a%u :"
+			" (t%u < 0.0) ? -a%u : 0.0;\n",
+			r,
+			r,
+			i,
+			r,
+			i);
+	}
+	else if (PARSER_DAG_POW == dag->op[i]) {
+		if (live[l]) {
+			fprintf(file,
+				"a%u += a%u * t%u *"
+				" mathfn_pow(t%u, t%u - 1.0);\n",
+				l,
+				i,
+				r,
+				l,
+				r);
+		}
+		if (live[r]) {
+			fprintf(file,
+				"a%u += (t%u > 0.0) ?"
+				" a%u * t%u * mathfn_log(t%u) : 0.0;\n",
+				r,
+				l,
+				i,
+				i,
+				l);
+		}
+	}
+	else if ((PARSER_DAG_MIN == dag->op[i]) ||
+		 (PARSER_DAG_MAX == dag->op[i])) {
+		fprintf(file,
+			"if (t%u %c t%u) {\n",
+			l,
+			(PARSER_DAG_MIN == dag->op[i]) ? '<' : '>',
+			r);
+		if (live[l]) {
+			fprintf(file, "a%u += a%u;\n", l, i);
+		}
+		fprintf(file, "}\n");
+		fprintf(file, "else {\n");
+		if (live[r]) {
+			fprintf(file, "a%u += a%u;\n", r, i);
+		}
+		fprintf(file, "}\n");
+	}
+	else {
+		EXIT("software");
+	}
+}
+
+/**
+ * Writes evaluate_grad(): the forward pass of evaluate(), whose
+ * temporaries the backward pass then reads, in reverse id order, so that
+ * a shared node has collected the adjoints of all its parents before it
+ * propagates its own. A variable no node reads, e.g., one simplified away,
+ * has a zero gradient.
+ */
+
+static int
+gradient(const struct parser_dag *dag, FILE *file)
+{
+	char *live, *read;
+	uint32_t i;
+
+	if (!(live = liveness(dag))) {
+		TRACE(0);
+		return -1;
+	}
+	if (!(read = malloc((size_t)dag->nvars + 1))) {
+		FREE(live);
+		TRACE("out of memory");
+		return -1;
+	}
+	memset(read, 0, (size_t)dag->nvars + 1);
+	for (i=1; i<=dag->n; ++i) {
+		if ((PARSER_DAG_VAR == dag->op[i]) &&
+		    (dag->left[i] < dag->nvars)) {
+			read[dag->left[i]] = 1;
+		}
+	}
+	fprintf(file,
+		"double evaluate_grad(const double *x, double *grad) {\n");
+	fprintf(file, "(void)x;\n");
+	fprintf(file, "(void)grad;\n");
+	for (i=0; i<dag->nvars; ++i) {
+		if (!read[i]) {
+			fprintf(file, "grad[%u] = 0.0;\n", i);
+		}
+	}
+	FREE(read);
+	faults_open(file);
+	for (i=1; i<=dag->n; ++i) {
+		reflect(dag, i, "x[%d]", file);
+	}
+	faults_close(file);
+	fprintf(file, "double s = sigmoid(t%u);\n", dag->n);
+	for (i=1; i<=dag->n; ++i) {
+		if (live[i]) {
+			fprintf(file, "double a%u = 0.0;\n", i);
+		}
+	}
+	if (live[dag->n]) {
+		fprintf(file, "a%u = s * (1.0 - s);\n", dag->n);
+	}
+	for (i=dag->n; 0<i; --i) {
+		if (live[i]) {
+			adjoint(dag, i, live, file);
+		}
+	}
+	fprintf(file, "return s;\n");
+	fprintf(file, "}\n");
+	FREE(live);
+	return 0;
+}
+
+int
+codegen_set_sigmoid(enum codegen_sigmoid sigmoid)
+{
+	if (CODEGEN_SIGMOID_END <= (unsigned)sigmoid) {
+		TRACE("invalid sigmoid");
+		return -1;
+	}
+	if ((CODEGEN_SIGMOID_AVX2 == sigmoid) &&
+	    !__builtin_cpu_supports("avx2")) {
+		TRACE("the processor lacks AVX2");
+		return -1;
+	}
+	sigmoid_ = sigmoid;
+	return 0;
+}
+
+const char *
+codegen_sigmoid_name(enum codegen_sigmoid sigmoid)
+{
+	const char * const NAME[] = { "exact", "poly", "rational", "avx2" };
+
+	if (CODEGEN_SIGMOID_END <= (unsigned)sigmoid) {
+		return NULL;
+	}
+	return NAME[sigmoid];
+}
+
+int
+codegen_set_division(enum codegen_division division)
+{
+	if (CODEGEN_DIVISION_END <= (unsigned)division) {
+		TRACE("invalid division");
+		return -1;
+	}
+	division_ = division;
+	return 0;
+}
+
+enum codegen_division
+codegen_get_division(void)
+{
+	return division_;
+}
+
+const char *
+codegen_division_name(enum codegen_division division)
+{
+	const char * const NAME[] = { "blend", "ieee", "checked" };
+
+	if (CODEGEN_DIVISION_END <= (unsigned)division) {
+		return NULL;
+	}
+	return NAME[division];
+}
+
+int
+codegen(const struct parser_dag *dag, FILE *file)
+{
+	uint32_t i;
+
+	assert( dag && file );
+
+	fprintf(file, "#include <stddef.h>\n");
+	fprintf(file, "double sigmoid(double x);\n");
+	policy(file);
+	sigmoid_kernel(file);
+	kernels(uses(dag), file);
+
+	/* scalar */
+
+	scalar(dag, "evaluate", file);
+
+	/* batched, struct-of-arrays */
+
+	fprintf(file,
+		"void evaluate_batch(const double * restrict in,"
+		" double * restrict out,"
+		" size_t n) {\n");
+	fprintf(file, "size_t i;\n");
+	fprintf(file, "(void)in;\n");
+	faults_open(file);
+	fprintf(file, "for (i = 0; i < n; ++i) {\n");
+	for (i=1; i<=dag->n; ++i) {
+		reflect(dag, i, "in[(size_t)%d * n + i]", file);
+	}
+	if (CODEGEN_SIGMOID_AVX2 == sigmoid_) {
+		fprintf(file, "out[i] = t%u;\n", dag->n);
+		fprintf(file, "}\n");
+		fprintf(file, "sigmoid_avx2(out, n);\n");
+	}
+	else {
+		fprintf(file, "out[i] = sigmoid_v(t%u);\n", dag->n);
+		fprintf(file, "}\n");
+	}
+	faults_close(file);
+	fprintf(file, "}\n");
+
+	/* gradient, reverse mode */
+
+	if (gradient(dag, file)) {
+		TRACE(0);
+		return -1;
+	}
+	return 0;
+}
+
+int
+codegen_many(const struct parser_dag * const *dags,
+	     size_t n,
+	     size_t base,
+	     FILE *file)
+{
+	unsigned mask;
+	char name[32];
+	size_t i;
+
+	assert( dags && file );
+
+	mask = 0;
+	for (i=0; i<n; ++i) {
+		mask |= uses(dags[i]);
+	}
+	fprintf(file, "double sigmoid(double x);\n");
+	policy(file);
+	kernels(mask, file);
+	for (i=0; i<n; ++i) {
+		safe_sprintf(name,
+			     sizeof (name),
+			     "evaluate_%lu",
+			     (unsigned long)(base + i));
+		scalar(dags[i], name, file);
+	}
+	return 0;
+}
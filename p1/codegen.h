@@ -0,0 +1,168 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * codegen.h
+ */
+
+#ifndef _CODEGEN_H_
+#define _CODEGEN_H_
+
+#include "system.h"
+#include "parser.h"
+
+/**
+ * The signature of the evaluate() entry point of every compiled expression,
+ * whichever backend produced it. Variable i is read from x[i]; x may be NULL
+ * if the expression has no variables.
+ */
+
+typedef double (*evaluate_t)(const double *x);
+
+/**
+ * The signature of the evaluate_batch() entry point: evaluates n rows whose
+ * inputs are laid out as struct-of-arrays, variable i of row j being
+ * in[i * n + j], and writes row j's result to out[j].
+ */
+
+typedef void (*evaluate_batch_t)(const double *in, double *out, size_t n);
+
+/**
+ * The signature of the evaluate_grad() entry point: returns what evaluate()
+ * returns and writes its partial derivative by variable i to grad[i].
+ */
+
+typedef double (*evaluate_grad_t)(const double *x, double *grad);
+
+/**
+ * The logistic functions evaluate_batch() may end in, trading accuracy for
+ * speed. The errors are the largest seen by "bench sigmoid" against
+ * sigmoid(), over -708 <= x, where sigmoid(x) is a normal number; below,
+ * the approximations return tiny normals where sigmoid() returns 0 or a
+ * subnormal.
+ */
+
+enum codegen_sigmoid {
+	CODEGEN_SIGMOID_EXACT,    /* sigmoid() itself, libm's exp(): 0 ulps */
+	CODEGEN_SIGMOID_POLY,     /* degree 13 polynomial, the default: 4 ulps */
+	CODEGEN_SIGMOID_RATIONAL, /* [5/5] Pade approximant: 8 ulps */
+	CODEGEN_SIGMOID_AVX2,     /* CODEGEN_SIGMOID_POLY, 4 rows at a time */
+	CODEGEN_SIGMOID_END       /* the number of logistic functions */
+};
+
+/**
+ * Selects the logistic function of the evaluate_batch() of subsequently
+ * generated programs. CODEGEN_SIGMOID_AVX2 is hand-vectorized with AVX2
+ * intrinsics, whatever the compile profile, and is refused unless the
+ * processor has AVX2; it agrees with CODEGEN_SIGMOID_POLY bit for bit.
+ *
+ * sigmoid: the logistic function
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int codegen_set_sigmoid(enum codegen_sigmoid sigmoid);
+
+/**
+ * sigmoid: a logistic function
+ *
+ * return: the short name of sigmoid, e.g., "poly", or NULL if invalid
+ */
+
+const char *codegen_sigmoid_name(enum codegen_sigmoid sigmoid);
+
+/**
+ * What division by zero yields in generated programs, and in bytecode
+ * programs of vm_open(). The dag and the native backend always follow
+ * CODEGEN_DIVISION_BLEND; parser_optimize() follows the mode its flags
+ * name, see PARSER_OPTIMIZE_IEEE and PARSER_OPTIMIZE_CHECKED. No mode
+ * branches on the divisor.
+ */
+
+enum codegen_division {
+	CODEGEN_DIVISION_BLEND,   /* 0 if the divisor is 0, the default */
+	CODEGEN_DIVISION_IEEE,    /* plain a / b: infinite or NaN */
+	CODEGEN_DIVISION_CHECKED, /* CODEGEN_DIVISION_BLEND, counting faults */
+	CODEGEN_DIVISION_END      /* the number of modes */
+};
+
+/**
+ * Selects the division of subsequently generated programs.
+ *
+ * division: the mode
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int codegen_set_division(enum codegen_division division);
+
+/**
+ * return: the mode last selected by codegen_set_division()
+ */
+
+enum codegen_division codegen_get_division(void);
+
+/**
+ * division: a mode
+ *
+ * return: the short name of division, e.g., "ieee", or NULL if invalid
+ */
+
+const char *codegen_division_name(enum codegen_division division);
+
+/**
+ * Writes a C translation unit defining
+ *
+ *   double evaluate(const double *x);
+ *   void evaluate_batch(const double *in, double *out, size_t n);
+ *   double evaluate_grad(const double *x, double *grad);
+ *   const char division[];
+ *   unsigned long long division_faults;
+ *
+ * which return the sigmoid of the expression described by dag (see
+ * evaluate_t, evaluate_batch_t and evaluate_grad_t). Shared nodes are
+ * computed once, into one temporary. evaluate() calls sigmoid(), like every
+ * other backend does. The body of evaluate_batch() is a plain loop gcc can
+ * vectorize, ending in the logistic function selected by
+ * codegen_set_sigmoid(). evaluate_grad() differentiates in reverse mode:
+ * one forward pass, then one backward pass over the same temporaries,
+ * whatever the number of variables. exp, log and pow are module-local
+ * copies of the kernels of mathfn.h, so all entry points compute them
+ * exactly like the interpreter and the native backend do.
+ *
+ * division names the mode selected by codegen_set_division(). Under
+ * CODEGEN_DIVISION_CHECKED, every call adds the number of divisions by
+ * zero it performed to division_faults, atomically; it stays 0 otherwise.
+ *
+ * dag : the parsed expression
+ * file: the output stream
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int codegen(const struct parser_dag *dag, FILE *file);
+
+/**
+ * Writes a C translation unit defining, for 0 <= i < n,
+ *
+ *   double evaluate_<base + i>(const double *x);
+ *
+ * which behaves like evaluate() of codegen(dags[i], ...), and division and
+ * division_faults, shared by the n functions.
+ *
+ * dags: the parsed expressions
+ * n   : the number of expressions
+ * base: the number of the first function
+ * file: the output stream
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int codegen_many(const struct parser_dag * const *dags,
+		 size_t n,
+		 size_t base,
+		 FILE *file);
+
+#endif /* _CODEGEN_H_ */
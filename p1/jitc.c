@@ -7,35 +7,495 @@
  * jitc.c
  */
 
+#define _GNU_SOURCE
+
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/time.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include <dlfcn.h>
+#include <limits.h>
+#include <sched.h>
+#include <pthread.h>
+#include <math.h>
+#include <cpuid.h>
 #include "system.h"
+#include "codegen.h"
+#include "native.h"
 #include "jitc.h"
 
 /**
  * Needs:
  *   fork()
  *   execv()
+ *   execve()
+ *   dup2()
+ *   socketpair()
+ *   send()
+ *   sendmsg()
+ *   recvmsg()
+ *   pipe2()
+ *   memfd_create()
  *   waitpid()
  *   WIFEXITED()
  *   WEXITSTATUS()
  *   dlopen()
  *   dlclose()
  *   dlsym()
+ *   link()
+ *   rename()
+ *   utimes()
+ *   flock()
+ *   opendir()
+ *   readdir()
  */
 
 /* research the above Needed API and design accordingly */
 
+#define CACHE_DIRNAME  ".jitc"
+#define CACHE_CAPACITY (64 * 1024 * 1024)
+#define CACHE_LOCK     "lock"
+#define CACHE_SLACK    16 /* scan after storing capacity / CACHE_SLACK bytes */
+
+/*
+ * argv slots filled in by gcc(); the input is "-" when the program arrives
+ * on standard input, and the flags of the compile profile are inserted
+ * before ARG_PROFILE. Modules never inspect the floating-point status flags
+ * or errno, so -fno-trapping-math lets gcc turn the guarded divisions of
+ * evaluate_batch() into vector selects and -fno-math-errno lets it use
+ * vector square roots. -ffp-contract=off, which only JITC_PROFILE_FAST
+ * overrides, keeps modules computing exactly what the interpreter does.
+ * Modules link nothing of the host: sigmoid() is left undefined and bound
+ * to the host's at dlopen(), which the host's -rdynamic makes possible
+ */
+
+#define ARG_INPUT   3
+#define ARG_PROFILE 5
+#define ARG_OUTPUT  10
+
+static const char * const ARGV[] = {
+	"gcc",
+	"-x", "c", "",
+	"-ffp-contract=off",
+	"-fno-math-errno", "-fno-trapping-math", "-fPIC", "-shared",
+	"-o", "",
+	"-lm",
+	NULL
+};
+
+/*
+ * The flags of every enum jitc_profile. JITC_PROFILE_FAST spells out the
+ * parts of -ffast-math, since -ffast-math itself links in startup code that
+ * would flush denormals to zero in the whole host process once the module
+ * is loaded
+ */
+
+#define PROFILE_MAX 8
+
+static const struct
+{
+	const char *name;
+	const char *flag[PROFILE_MAX + 1];
+} PROFILE[] = {
+	{ "o1", { "-O1", NULL } },
+	{ "o2", { "-O2", NULL } },
+	{ "o3", { "-O3", NULL } },
+	{ "native", { "-O3", "-march=native", NULL } },
+	{ "fast", { "-O3",
+		    "-march=native",
+		    "-fno-math-errno",
+		    "-fno-signed-zeros",
+		    "-fassociative-math",
+		    "-freciprocal-math",
+		    "-ffinite-math-only",
+		    "-ffp-contract=fast",
+		    NULL } }
+};
+
+static enum jitc_profile profile_ = JITC_PROFILE_O3; /* jitc_set_profile() */
+
 struct jitc
 {
 	void *handle;
+	void *code; /* native backend */
+	size_t size;
+	int memfd; /* module built in memory, or -1 */
+	size_t nparts;
+	struct jitc **part; /* jitc_build_many(): one module per job */
 };
 
-int jitc_compile(const char *input, const char *output)
+struct entry
 {
-	int status;
+	char name[32];
+	off_t size;
+	time_t mtime;
+};
+
+static struct
+{
+	int enabled;
+	char dirname[256];
+	uint64_t capacity;
+	uint64_t stored; /* bytes since the last cache_evict() scan */
+} cache = { 1, CACHE_DIRNAME, CACHE_CAPACITY, CACHE_CAPACITY };
+
+static uint64_t serial; /* tells apart concurrent compiles of one process */
+
+static uint64_t fnv1a(uint64_t h, const void *buf, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+	{
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/**
+ * The compiler's identity is the output of gcc -dumpfullversion and of gcc
+ * -dumpmachine, its version and target, so that modules built before a gcc
+ * upgrade are not reused. gcc prints one of them per run. The processor's
+ * identity, which -march=native resolves to, is its cpuid vendor, model and
+ * feature bits. Computed once; the child only makes async-signal-safe
+ * calls.
+ */
+
+static pthread_once_t host_once = PTHREAD_ONCE_INIT;
+static uint64_t host_gcc;
+static uint64_t host_cpu;
+
+static void host_dump(const char *option)
+{
+	char *cmd[] = { "gcc", (char *)option, NULL };
+	char buf[256];
+	ssize_t n;
+	pid_t pid;
+	int fd[2];
+
+	if (pipe2(fd, O_CLOEXEC))
+	{
+		TRACE("pipe2()");
+		return;
+	}
+	if (0 == (pid = fork()))
+	{
+		if (0 > dup2(fd[1], STDOUT_FILENO))
+		{
+			_exit(1);
+		}
+		execv("/usr/bin/gcc", cmd);
+		_exit(1);
+	}
+	close(fd[1]);
+	if (0 > pid)
+	{
+		TRACE("fork()");
+	}
+	for (;;)
+	{
+		if (0 < (n = read(fd[0], buf, sizeof (buf))))
+		{
+			host_gcc = fnv1a(host_gcc, buf, (size_t)n);
+		}
+		else if (!n || (EINTR != errno))
+		{
+			break;
+		}
+	}
+	close(fd[0]);
+	while ((0 < pid) && (-1 == waitpid(pid, NULL, 0)) && (EINTR == errno))
+	{
+	}
+}
+
+static void host_init(void)
+{
+	unsigned int r[4];
+
+	host_gcc = 0xcbf29ce484222325ULL;
+	host_dump("-dumpfullversion");
+	host_dump("-dumpmachine");
+	host_cpu = 0xcbf29ce484222325ULL;
+	if (__get_cpuid(0, &r[0], &r[1], &r[2], &r[3]))
+	{
+		host_cpu = fnv1a(host_cpu, r, sizeof (r));
+	}
+	if (__get_cpuid(1, &r[0], &r[1], &r[2], &r[3]))
+	{
+		r[1] = 0; /* the APIC id, which differs between cores */
+		host_cpu = fnv1a(host_cpu, r, sizeof (r));
+	}
+	if (__get_cpuid_count(7, 0, &r[0], &r[1], &r[2], &r[3]))
+	{
+		host_cpu = fnv1a(host_cpu, r, sizeof (r));
+	}
+}
+
+/**
+ * The key covers the program text, the compiler command line and the
+ * compiler's identity, and the processor's for profiles built with
+ * -march=native, which may use instructions other hosts sharing the cache
+ * lack. A negative profile leaves out the profile flags.
+ */
+
+static uint64_t cache_key_argv(int profile)
+{
+	uint64_t h;
+	size_t i;
+
+	pthread_once(&host_once, host_init);
+	h = fnv1a(0xcbf29ce484222325ULL, &host_gcc, sizeof (host_gcc));
+	for (i = 0; ARGV[i]; ++i)
+	{
+		if ((ARG_INPUT == i) || (ARG_OUTPUT == i))
+		{
+			continue;
+		}
+		h = fnv1a(h, ARGV[i], safe_strlen(ARGV[i]) + 1);
+	}
+	for (i = 0; (0 <= profile) && PROFILE[profile].flag[i]; ++i)
+	{
+		h = fnv1a(h,
+			  PROFILE[profile].flag[i],
+			  safe_strlen(PROFILE[profile].flag[i]) + 1);
+		if (!strcmp(PROFILE[profile].flag[i], "-march=native"))
+		{
+			h = fnv1a(h, &host_cpu, sizeof (host_cpu));
+		}
+	}
+	return h;
+}
+
+static int cache_key(const char *input, uint64_t *key)
+{
+	char buf[4096];
+	uint64_t h;
+	FILE *file;
+	size_t n;
+
+	h = cache_key_argv(profile_);
+	if (!(file = fopen(input, "r")))
+	{
+		TRACE("fopen()");
+		return -1;
+	}
+	while ((n = fread(buf, 1, sizeof (buf), file)))
+	{
+		h = fnv1a(h, buf, n);
+	}
+	if (ferror(file))
+	{
+		fclose(file);
+		TRACE("fread()");
+		return -1;
+	}
+	fclose(file);
+	*key = h;
+	return 0;
+}
+
+static int copy_file(const char *src, const char *dst)
+{
+	char buf[4096];
+	FILE *in, *out;
+	size_t n;
+	int err;
+
+	if (!(in = fopen(src, "r")))
+	{
+		return -1;
+	}
+	if (!(out = fopen(dst, "w")))
+	{
+		fclose(in);
+		return -1;
+	}
+	err = 0;
+	while ((n = fread(buf, 1, sizeof (buf), in)))
+	{
+		if (n != fwrite(buf, 1, n, out))
+		{
+			err = -1;
+			break;
+		}
+	}
+	if (ferror(in))
+	{
+		err = -1;
+	}
+	fclose(in);
+	if (fclose(out))
+	{
+		err = -1;
+	}
+	if (err)
+	{
+		file_delete(dst);
+	}
+	return err;
+}
+
+/**
+ * Makes output refer to the cached module. A hard link keeps the module alive
+ * even if another process evicts it from the cache while we are loading it.
+ */
+
+static int cache_fetch(const char *pathname, const char *output)
+{
+	file_delete(output);
+	if (link(pathname, output))
+	{
+		if ((EXDEV != errno) && (EPERM != errno))
+		{
+			return -1;
+		}
+		if (copy_file(pathname, output))
+		{
+			return -1;
+		}
+	}
+	if (utimes(pathname, NULL))
+	{
+		/* ignore, only affects eviction order */
+	}
+	return 0;
+}
+
+static int entry_cmp(const void *a_, const void *b_)
+{
+	const struct entry *a = (const struct entry *)a_;
+	const struct entry *b = (const struct entry *)b_;
+
+	if (a->mtime != b->mtime)
+	{
+		return (a->mtime < b->mtime) ? -1 : 1;
+	}
+	return strcmp(a->name, b->name);
+}
+
+/**
+ * Accounts for size bytes just stored and, once a CACHE_SLACK-th of the
+ * capacity has been stored since the last scan, evicts least recently used
+ * modules until the cache fits its capacity. Scanning the directory costs a
+ * stat() per cached file, so it is amortized over many stores at the price
+ * of overshooting by that slack per process. The counter starts out full so
+ * that a process scans on its first store. Scans run under an exclusive lock
+ * so that concurrent evictions do not overshoot.
+ */
+
+static void cache_evict(uint64_t size)
+{
+	struct entry *entries, *tmp;
+	char pathname[512];
+	struct dirent *dirent;
+	uint64_t total;
+	struct stat st;
+	size_t i, n, len;
+	DIR *dir;
+	int fd;
+
+	if ((__atomic_add_fetch(&cache.stored, size, __ATOMIC_RELAXED) <
+	     cache.capacity / CACHE_SLACK) ||
+	    (__atomic_exchange_n(&cache.stored, 0, __ATOMIC_RELAXED) <
+	     cache.capacity / CACHE_SLACK))
+	{
+		return; /* not yet, or another thread scans */
+	}
+	safe_sprintf(pathname,
+		     sizeof (pathname),
+		     "%s/%s",
+		     cache.dirname,
+		     CACHE_LOCK);
+	if (0 > (fd = open(pathname, O_RDWR | O_CREAT | O_CLOEXEC, 0644)))
+	{
+		TRACE("open()");
+		return;
+	}
+	if (flock(fd, LOCK_EX))
+	{
+		close(fd);
+		TRACE("flock()");
+		return;
+	}
+	if (!(dir = opendir(cache.dirname)))
+	{
+		close(fd);
+		TRACE("opendir()");
+		return;
+	}
+	entries = NULL;
+	total = 0;
+	n = 0;
+	while ((dirent = readdir(dir)))
+	{
+		len = safe_strlen(dirent->d_name);
+		if ((len >= sizeof (entries[0].name)) ||
+		    (((3 > len) || strcmp(dirent->d_name + len - 3, ".so")) &&
+		     ((5 > len) || strcmp(dirent->d_name + len - 5, ".tune"))))
+		{
+			continue;
+		}
+		safe_sprintf(pathname,
+			     sizeof (pathname),
+			     "%s/%s",
+			     cache.dirname,
+			     dirent->d_name);
+		if (stat(pathname, &st))
+		{
+			continue;
+		}
+		if (!(tmp = realloc(entries, (n + 1) * sizeof (entries[0]))))
+		{
+			TRACE("out of memory");
+			break;
+		}
+		entries = tmp;
+		memcpy(entries[n].name, dirent->d_name, len + 1);
+		entries[n].size = st.st_size;
+		entries[n].mtime = st.st_mtime;
+		total += (uint64_t)st.st_size;
+		++n;
+	}
+	closedir(dir);
+	if (total > cache.capacity)
+	{
+		qsort(entries, n, sizeof (entries[0]), entry_cmp);
+		for (i = 0; (i < n) && (total > cache.capacity); ++i)
+		{
+			safe_sprintf(pathname,
+				     sizeof (pathname),
+				     "%s/%s",
+				     cache.dirname,
+				     entries[i].name);
+			file_delete(pathname);
+			total -= (uint64_t)entries[i].size;
+		}
+	}
+	FREE(entries);
+	close(fd);
+}
+
+/**
+ * Starts gcc on input, or on its standard input read from fd if fd is not
+ * negative, writing the module to output.
+ */
+
+static pid_t gcc_spawn(const char *input,
+		       const char *output,
+		       int fd,
+		       enum jitc_profile profile)
+{
+	char *cmd[ARRAY_SIZE(ARGV) + PROFILE_MAX];
+	size_t i, j, k;
 
 	pid_t pid = fork();
 
@@ -48,71 +508,1676 @@ int jitc_compile(const char *input, const char *output)
 	if (pid == 0)
 	{
 		/* Child process */
-		char* cmd[] = {"gcc", "lexer.o","jitc.o","parser.o","system.o","main.o","", "-o3", "-fPIC", "-shared", "-o", "","-lm", NULL};
-		cmd[6] = (char*) input;
-		cmd[11] = (char*) output;
+		if ((0 <= fd) && (0 > dup2(fd, STDIN_FILENO)))
+		{
+			_exit(1);
+		}
+		for (i = 0, j = 0; i < ARRAY_SIZE(ARGV); ++i)
+		{
+			if (ARG_PROFILE == i)
+			{
+				for (k = 0; PROFILE[profile].flag[k]; ++k)
+				{
+					cmd[j++] = (char *)PROFILE[profile].flag[k];
+				}
+			}
+			cmd[j++] = (char *)ARGV[i];
+			if (ARG_INPUT == i)
+			{
+				cmd[j - 1] = (char *)((0 <= fd) ? "-" : input);
+			}
+			if (ARG_OUTPUT == i)
+			{
+				cmd[j - 1] = (char *)output;
+			}
+		}
 
 		execv("/usr/bin/gcc", cmd);
 
 		/* Handle the error for execv */
 		fprintf(stderr, "Error in execv\n");
-		exit(1);
+		_exit(1);
 	}
-	else
+	return pid;
+}
+
+static int gcc_wait(pid_t pid)
+{
+	int status;
+
+	/*  Parent process */
+	while (waitpid(pid, &status, 0) == -1)
 	{
-		/*  Parent process */
-		if (waitpid(pid, &status, 0) == -1)
+		if (EINTR != errno)
 		{
 			fprintf(stderr, "Error in waitpid\n");
 			return -1;
 		}
+	}
+
+	if (WIFEXITED(status))
+	{
+		return WEXITSTATUS(status);
+	}
+
+	return -1;
+}
+
+static int gcc(const char *input, const char *output)
+{
+	pid_t pid;
+
+	if (0 > (pid = gcc_spawn(input, output, -1, profile_)))
+	{
+		return -1;
+	}
+	return gcc_wait(pid);
+}
+
+/**
+ * Starts compiling the program in text without touching the file system.
+ * gcc reads the program from standard input, a socket rather than a pipe so
+ * that a compiler that dies early cannot raise SIGPIPE in the caller, and
+ * writes the module into a memory file of this process through its /proc
+ * path. The program is fully handed over on return, while gcc may still be
+ * compiling; see gcc_finish().
+ *
+ * return: the memory file that will hold the module, or -1 on error
+ */
+
+static int gcc_start(const char *text,
+		     size_t len,
+		     enum jitc_profile profile,
+		     pid_t *pid)
+{
+	char output[64];
+	int sv[2], fd;
+	ssize_t n;
+	size_t i;
 
-		if (WIFEXITED(status))
+	if (0 > (fd = memfd_create("jitc", MFD_CLOEXEC)))
+	{
+		TRACE("memfd_create()");
+		return -1;
+	}
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv))
+	{
+		close(fd);
+		TRACE("socketpair()");
+		return -1;
+	}
+	safe_sprintf(output,
+		     sizeof (output),
+		     "/proc/%ld/fd/%d",
+		     (long)getpid(),
+		     fd);
+	*pid = gcc_spawn(NULL, output, sv[1], profile);
+	close(sv[1]);
+	if (0 > (*pid))
+	{
+		close(sv[0]);
+		close(fd);
+		return -1;
+	}
+	for (i = 0; i < len; i += (size_t)n)
+	{
+		if (0 > (n = send(sv[0], text + i, len - i, MSG_NOSIGNAL)))
 		{
-			return WEXITSTATUS(status);
+			if (EINTR == errno)
+			{
+				n = 0;
+				continue;
+			}
+			break; /* gcc is gone, its exit status tells why */
 		}
+	}
+	close(sv[0]);
+	return fd;
+}
 
+static int gcc_finish(int fd, pid_t pid)
+{
+	if (gcc_wait(pid))
+	{
+		close(fd);
+		TRACE("gcc");
 		return -1;
 	}
+	return fd;
 }
 
-struct jitc *jitc_open(const char *pathname)
+/**
+ * Publishes the module held by fd to the cache under key, best effort.
+ */
+
+static void cache_store(int fd, uint64_t key)
 {
-	struct jitc *jitc = malloc(sizeof(struct jitc));
-	
-	if (jitc)
-	{
-		printf("pathname %s\n",pathname);
-		jitc->handle = dlopen(pathname, RTLD_LAZY);
+	char pathname[512], tmpname[512], buf[65536];
+	ssize_t n;
+	off_t off;
+	FILE *file;
 
-		if (!jitc->handle)
-		{	
-			printf("jitc handle not found\n");		
-			free(jitc);
+	if (mkdir(cache.dirname, 0755) && (EEXIST != errno))
+	{
+		return;
+	}
+	safe_sprintf(pathname,
+		     sizeof (pathname),
+		     "%s/%016lx.so",
+		     cache.dirname,
+		     (unsigned long)key);
+	safe_sprintf(tmpname,
+		     sizeof (tmpname),
+		     "%s/%016lx.%ld.%lu.tmp",
+		     cache.dirname,
+		     (unsigned long)key,
+		     (long)getpid(),
+		     (unsigned long)__atomic_fetch_add(&serial,
+						       1,
+						       __ATOMIC_RELAXED));
+	if (!(file = fopen(tmpname, "w")))
+	{
+		return;
+	}
+	off = 0;
+	while (0 < (n = pread(fd, buf, sizeof (buf), off)))
+	{
+		if ((size_t)n != fwrite(buf, 1, (size_t)n, file))
+		{
+			break;
 		}
+		off += n;
 	}
-	printf("open complete\n");
-	fflush(stdout);
-	return jitc;
+	if (fclose(file) || n || rename(tmpname, pathname))
+	{
+		file_delete(tmpname);
+		return;
+	}
+	cache_evict((uint64_t)off);
 }
 
-void jitc_close(struct jitc *jitc)
+/**
+ * One program on its way to a loaded module: either found in the cache, or
+ * handed to a gcc that is still running.
+ */
+
+struct job
 {
-	if (jitc)
+	uint64_t key;
+	pid_t pid;
+	int fd;
+	struct jitc *jitc;
+};
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+	size_t i;
+
+	for (i = 0; i < len; i += (size_t)n)
 	{
-		dlclose(jitc->handle);
-		free(jitc);
+		if (0 > (n = write(fd, buf + i, len - i)))
+		{
+			if (EINTR != errno)
+			{
+				TRACE("write()");
+				return -1;
+			}
+			n = 0;
+		}
 	}
+	return 0;
 }
 
-long jitc_lookup(struct jitc *jitc, const char *symbol)
+/**
+ * Loads the cached module of key, quietly returning NULL if there is none.
+ */
+
+static struct jitc *cache_open(uint64_t key)
 {
-	if (jitc)
-	{	
-		printf("in lookup\n");
-		printf("jitc->handle %p\n",jitc->handle);
-		fflush(stdout);
-		return (long)dlsym(jitc->handle, symbol);
+	char pathname[512];
+	struct jitc *jitc;
+
+	safe_sprintf(pathname,
+		     sizeof (pathname),
+		     "%s/%016lx.so",
+		     cache.dirname,
+		     (unsigned long)key);
+	if (access(pathname, R_OK) || !(jitc = jitc_open(pathname)))
+	{
+		return NULL;
 	}
-	return 0;
+	if (utimes(pathname, NULL))
+	{
+		/* ignore, only affects eviction order */
+	}
+	return jitc;
+}
+
+/**
+ * Autotuning records the fastest profile of a program next to the cached
+ * modules, in a file named after the program and the host, i.e., gcc's and
+ * the processor's identities, but not the profile, holding the profile
+ * name.
+ */
+
+static void tune_pathname(char *pathname,
+			  size_t size,
+			  const char *text,
+			  size_t len)
+{
+	uint64_t key;
+
+	key = fnv1a(cache_key_argv(-1), "tune", 4);
+	key = fnv1a(key, &host_cpu, sizeof (host_cpu));
+	key = fnv1a(key, text, len);
+	safe_sprintf(pathname,
+		     size,
+		     "%s/%016lx.tune",
+		     cache.dirname,
+		     (unsigned long)key);
+}
+
+/**
+ * Returns the profile autotuned for the program in text, or the current
+ * profile if it has not been tuned.
+ */
+
+static enum jitc_profile tuned(const char *text, size_t len)
+{
+	char pathname[512], name[16];
+	FILE *file;
+	size_t i;
+
+	if (!cache.enabled)
+	{
+		return profile_;
+	}
+	tune_pathname(pathname, sizeof (pathname), text, len);
+	if (!(file = fopen(pathname, "r")))
+	{
+		return profile_;
+	}
+	memset(name, 0, sizeof (name));
+	if (fgets(name, sizeof (name), file))
+	{
+		name[strcspn(name, "\n")] = 0;
+	}
+	fclose(file);
+	for (i = 0; i < ARRAY_SIZE(PROFILE); ++i)
+	{
+		if (!strcmp(name, PROFILE[i].name))
+		{
+			if (utimes(pathname, NULL))
+			{
+				/* ignore, only affects eviction order */
+			}
+			return (enum jitc_profile)i;
+		}
+	}
+	return profile_;
+}
+
+static struct jitc *memfd_open(int fd)
+{
+	char pathname[64];
+	struct jitc *jitc;
+
+	safe_sprintf(pathname, sizeof (pathname), "/proc/self/fd/%d", fd);
+	if (!(jitc = jitc_open(pathname)))
+	{
+		close(fd);
+		TRACE(0);
+		return NULL;
+	}
+	jitc->memfd = fd;
+	return jitc;
+}
+
+static int job_start(struct job *job,
+		     const char *text,
+		     size_t len,
+		     enum jitc_profile profile)
+{
+	memset(job, 0, sizeof (struct job));
+	job->fd = -1;
+	if (cache.enabled)
+	{
+		job->key = fnv1a(cache_key_argv(profile), text, len);
+		if ((job->jitc = cache_open(job->key)))
+		{
+			return 0;
+		}
+	}
+	if (0 > (job->fd = gcc_start(text, len, profile, &job->pid)))
+	{
+		TRACE(0);
+		return -1;
+	}
+	return 0;
+}
+
+static struct jitc *job_finish(struct job *job)
+{
+	if (job->jitc)
+	{
+		return job->jitc;
+	}
+	if (0 > gcc_finish(job->fd, job->pid))
+	{
+		TRACE(0);
+		return NULL;
+	}
+	if (cache.enabled)
+	{
+		cache_store(job->fd, job->key);
+	}
+	return memfd_open(job->fd);
+}
+
+/**
+ * The compile pool: worker processes started up front that all receive on
+ * one end of a SOCK_SEQPACKET socket, so every request reaches exactly one
+ * idle worker. A request is a message of one byte, the compile profile,
+ * whose SCM_RIGHTS payload carries three descriptors: a memory file holding
+ * the program, a memory file to receive the module and the write end of a
+ * pipe. The worker runs gcc on them and writes gcc's exit status into the
+ * pipe; its read end is the caller's completion fd. Workers exit once the
+ * pool socket is closed.
+ *
+ * The host may be running threads when the pool starts, and the child of a
+ * fork() from a threaded process may only make async-signal-safe calls: a
+ * lock held by another thread at the fork, in malloc() or stdio, stays held
+ * forever in the child. So a worker is the host program re-executed from
+ * /proc/self/exe, its socket named in POOL_ENV, and worker_main() takes
+ * over from there before main() ever runs.
+ */
+
+#define POOL_ENV "JITC_WORKER"
+#define POOL_MAX 64
+
+static struct
+{
+	pthread_mutex_t mutex;
+	int fd; /* the host's end of the pool socket, or -1 */
+	int n;
+	pid_t pid[POOL_MAX];
+} pool = { PTHREAD_MUTEX_INITIALIZER, -1, 0, { 0 } };
+
+struct jitc_async
+{
+	int done; /* completion fd */
+	int out; /* memory file receiving the module */
+	uint64_t key;
+	struct jitc *jitc; /* cache hit */
+};
+
+static void worker(int fd)
+{
+	char buf[CMSG_SPACE(3 * sizeof (int))], output[64];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	uint8_t status;
+	int fds[3];
+	ssize_t n;
+	pid_t pid;
+	char c;
+
+	for (;;)
+	{
+		memset(&msg, 0, sizeof (msg));
+		iov.iov_base = &c;
+		iov.iov_len = 1;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = buf;
+		msg.msg_controllen = sizeof (buf);
+		if (0 > (n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)))
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+		}
+		if (0 >= n)
+		{
+			_exit(0); /* the pool is closed */
+		}
+		if (!(cmsg = CMSG_FIRSTHDR(&msg)) ||
+		    (SOL_SOCKET != cmsg->cmsg_level) ||
+		    (SCM_RIGHTS != cmsg->cmsg_type) ||
+		    (CMSG_LEN(sizeof (fds)) != cmsg->cmsg_len))
+		{
+			continue;
+		}
+		memcpy(fds, CMSG_DATA(cmsg), sizeof (fds));
+		safe_sprintf(output,
+			     sizeof (output),
+			     "/proc/%ld/fd/%d",
+			     (long)getpid(),
+			     fds[1]);
+		status = 1;
+		if (((size_t)c < ARRAY_SIZE(PROFILE)) &&
+		    (0 == lseek(fds[0], 0, SEEK_SET)) &&
+		    (0 < (pid = gcc_spawn(NULL,
+					  output,
+					  fds[0],
+					  (enum jitc_profile)c))))
+		{
+			status = (uint8_t)gcc_wait(pid);
+		}
+		if (1 != write(fds[2], &status, 1))
+		{
+			/* ignore, the caller sees the pipe close */
+		}
+		close(fds[0]);
+		close(fds[1]);
+		close(fds[2]);
+	}
+}
+
+static int pool_default(void)
+{
+	long n;
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	n = (0 < n) ? n : 1;
+	return (int)((POOL_MAX < n) ? POOL_MAX : n);
+}
+
+static void pool_stop(void)
+{
+	int i;
+
+	if (0 <= pool.fd)
+	{
+		close(pool.fd);
+		pool.fd = -1;
+	}
+	for (i = 0; i < pool.n; ++i)
+	{
+		while ((-1 == waitpid(pool.pid[i], NULL, 0)) && (EINTR == errno))
+		{
+		}
+	}
+	pool.n = 0;
+}
+
+static int pool_start(int n)
+{
+	char env[32], *argv[2], **envp;
+	size_t k;
+	int sv[2];
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv))
+	{
+		TRACE("socketpair()");
+		return -1;
+	}
+
+	/* everything execve() needs is built before forking */
+
+	for (k = 0; environ[k]; ++k)
+	{
+	}
+	if (!(envp = malloc((k + 2) * sizeof (envp[0]))))
+	{
+		close(sv[0]);
+		close(sv[1]);
+		TRACE("out of memory");
+		return -1;
+	}
+	safe_sprintf(env, sizeof (env), "%s=%d", POOL_ENV, sv[1]);
+	envp[0] = env;
+	memcpy(envp + 1, environ, k * sizeof (envp[0]));
+	envp[k + 1] = NULL;
+	argv[0] = (char *)"jitc-worker";
+	argv[1] = NULL;
+	pool.fd = sv[0];
+	while (pool.n < n)
+	{
+		if (0 > (pid = fork()))
+		{
+			FREE(envp);
+			close(sv[1]);
+			pool_stop();
+			TRACE("fork()");
+			return -1;
+		}
+		if (!pid)
+		{
+			if (!fcntl(sv[1], F_SETFD, 0))
+			{
+				execve("/proc/self/exe", argv, envp);
+			}
+			_exit(127);
+		}
+		pool.pid[pool.n++] = pid;
+	}
+	FREE(envp);
+	close(sv[1]);
+	return 0;
+}
+
+/**
+ * Runs before main() in every process of the host program and turns those
+ * started by pool_start() into workers. POOL_ENV may also be inherited or
+ * set by anyone, so the process only becomes a worker if it names an open
+ * SOCK_SEQPACKET socket; otherwise main() runs as usual.
+ */
+
+__attribute__((constructor)) static void worker_main(void)
+{
+	struct stat st;
+	socklen_t len;
+	int fd, type;
+	const char *s;
+	char *end;
+	long l;
+
+	if (!(s = getenv(POOL_ENV)))
+	{
+		return;
+	}
+	l = strtol(s, &end, 10);
+	fd = ((s != end) && !*end && (0 <= l) && (INT_MAX >= l)) ? (int)l : -1;
+	unsetenv(POOL_ENV);
+	len = sizeof (type);
+	if ((0 <= fd) &&
+	    !fstat(fd, &st) &&
+	    S_ISSOCK(st.st_mode) &&
+	    !getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) &&
+	    (SOCK_SEQPACKET == type))
+	{
+		worker(fd);
+	}
+}
+
+static int pool_send(int src, int out, int done, enum jitc_profile profile)
+{
+	char buf[CMSG_SPACE(3 * sizeof (int))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	int fds[3];
+	char c;
+
+	fds[0] = src;
+	fds[1] = out;
+	fds[2] = done;
+	c = (char)profile;
+	memset(&msg, 0, sizeof (msg));
+	memset(buf, 0, sizeof (buf));
+	iov.iov_base = &c;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = buf;
+	msg.msg_controllen = sizeof (buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof (fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof (fds));
+	while (0 > sendmsg(pool.fd, &msg, MSG_NOSIGNAL))
+	{
+		if (EINTR != errno)
+		{
+			TRACE("sendmsg()");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int jitc_cache(const char *dirname, uint64_t capacity)
+{
+	if (!safe_strlen(dirname))
+	{
+		cache.enabled = 0;
+		return 0;
+	}
+	if (safe_strlen(dirname) >= sizeof (cache.dirname))
+	{
+		TRACE("cache dirname too long");
+		return -1;
+	}
+	safe_sprintf(cache.dirname, sizeof (cache.dirname), "%s", dirname);
+	cache.capacity = capacity;
+	cache.stored = capacity;
+	cache.enabled = 1;
+	return 0;
+}
+
+int jitc_set_profile(enum jitc_profile profile)
+{
+	if ((unsigned)profile >= ARRAY_SIZE(PROFILE))
+	{
+		TRACE("invalid profile");
+		return -1;
+	}
+	profile_ = profile;
+	return 0;
+}
+
+const char *jitc_profile_name(enum jitc_profile profile)
+{
+	if ((unsigned)profile >= ARRAY_SIZE(PROFILE))
+	{
+		return NULL;
+	}
+	return PROFILE[profile].name;
+}
+
+int jitc_compile(const char *input, const char *output)
+{
+	char pathname[512], tmpname[512];
+	struct stat st;
+	uint64_t key;
+	int err;
+
+	if (!cache.enabled)
+	{
+		return gcc(input, output);
+	}
+	if (cache_key(input, &key))
+	{
+		TRACE(0);
+		return -1;
+	}
+	if (mkdir(cache.dirname, 0755) && (EEXIST != errno))
+	{
+		TRACE("mkdir()");
+		return gcc(input, output);
+	}
+	safe_sprintf(pathname,
+		     sizeof (pathname),
+		     "%s/%016lx.so",
+		     cache.dirname,
+		     (unsigned long)key);
+
+	/* hit */
+
+	if (!cache_fetch(pathname, output))
+	{
+		return 0;
+	}
+
+	/* miss: compile privately, then publish atomically */
+
+	safe_sprintf(tmpname,
+		     sizeof (tmpname),
+		     "%s/%016lx.%ld.%lu.tmp",
+		     cache.dirname,
+		     (unsigned long)key,
+		     (long)getpid(),
+		     (unsigned long)__atomic_fetch_add(&serial,
+						       1,
+						       __ATOMIC_RELAXED));
+	if ((err = gcc(input, tmpname)))
+	{
+		file_delete(tmpname);
+		return err;
+	}
+	if (rename(tmpname, pathname))
+	{
+		file_delete(tmpname);
+		TRACE("rename()");
+		return -1;
+	}
+	cache_evict(stat(pathname, &st) ? 0 : (uint64_t)st.st_size);
+	if (cache_fetch(pathname, output))
+	{
+		/* evicted by a concurrent process, compile uncached */
+		return gcc(input, output);
+	}
+	return 0;
+}
+
+struct jitc *jitc_open(const char *pathname)
+{
+	struct jitc *jitc = malloc(sizeof(struct jitc));
+
+	if (jitc)
+	{
+		memset(jitc, 0, sizeof(struct jitc));
+		jitc->memfd = -1;
+		jitc->handle = dlopen(pathname, RTLD_LAZY);
+
+		if (!jitc->handle)
+		{
+			TRACE(dlerror());
+			FREE(jitc);
+		}
+	}
+	return jitc;
+}
+
+/**
+ * dlopen() matches a pathname against the modules already loaded before it
+ * looks at the file, so the memory file stays open as long as its module is
+ * loaded; otherwise a later module could reuse the descriptor number, hence
+ * the /proc path, and be mistaken for this one.
+ */
+
+struct jitc *jitc_build(const struct parser_dag *dag)
+{
+	struct jitc *jitc;
+	struct job job;
+	FILE *file;
+	size_t len;
+	char *text;
+
+	text = NULL;
+	len = 0;
+	if (!(file = open_memstream(&text, &len)))
+	{
+		TRACE("open_memstream()");
+		return NULL;
+	}
+	if (codegen(dag, file) || fclose(file))
+	{
+		FREE(text);
+		TRACE(0);
+		return NULL;
+	}
+	if (job_start(&job, text, len, tuned(text, len)))
+	{
+		FREE(text);
+		TRACE(0);
+		return NULL;
+	}
+	FREE(text);
+	if (!(jitc = job_finish(&job)))
+	{
+		TRACE(0);
+		return NULL;
+	}
+	return jitc;
+}
+
+/**
+ * The expressions are dealt into one translation unit per job, at least
+ * MANY_MIN expressions each and at most one job per processor; all jobs are
+ * started before the first is waited for. The returned handle owns one
+ * module per job.
+ */
+
+#define MANY_MIN 256
+
+struct jitc *jitc_build_many(const struct parser_dag * const *dags,
+			     size_t n,
+			     evaluate_t *table)
+{
+	size_t i, k, m, njobs, base;
+	struct jitc *jitc;
+	struct job *jobs;
+	char name[32];
+	FILE *file;
+	size_t len;
+	char *text;
+	long ncpu;
+	int err;
+
+	assert( dags && n && table );
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	njobs = (n + MANY_MIN - 1) / MANY_MIN;
+	njobs = ((0 < ncpu) && ((size_t)ncpu < njobs)) ? (size_t)ncpu : njobs;
+	if (!(jitc = malloc(sizeof (struct jitc))) ||
+	    !(jobs = malloc(njobs * sizeof (jobs[0]))))
+	{
+		FREE(jitc);
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(jitc, 0, sizeof (struct jitc));
+	jitc->memfd = -1;
+	if (!(jitc->part = malloc(njobs * sizeof (jitc->part[0]))))
+	{
+		FREE(jobs);
+		FREE(jitc);
+		TRACE("out of memory");
+		return NULL;
+	}
+
+	/* start */
+
+	err = 0;
+	for (k = 0; k < njobs; ++k)
+	{
+		base = n * k / njobs;
+		m = n * (k + 1) / njobs - base;
+		text = NULL;
+		len = 0;
+		if (!(file = open_memstream(&text, &len)))
+		{
+			TRACE("open_memstream()");
+			err = -1;
+			break;
+		}
+		if (codegen_many(dags + base, m, base, file) ||
+		    fclose(file) ||
+		    job_start(&jobs[k], text, len, profile_))
+		{
+			FREE(text);
+			TRACE(0);
+			err = -1;
+			break;
+		}
+		FREE(text);
+	}
+
+	/* finish, reaping every started compiler even after an error */
+
+	njobs = k;
+	for (k = 0; k < njobs; ++k)
+	{
+		if ((jitc->part[jitc->nparts] = job_finish(&jobs[k])))
+		{
+			++jitc->nparts;
+		}
+		else
+		{
+			err = -1;
+		}
+	}
+	FREE(jobs);
+	if (err)
+	{
+		jitc_close(jitc);
+		TRACE(0);
+		return NULL;
+	}
+	for (k = 0; k < jitc->nparts; ++k)
+	{
+		base = n * k / njobs;
+		m = n * (k + 1) / njobs - base;
+		for (i = base; i < (base + m); ++i)
+		{
+			safe_sprintf(name,
+				     sizeof (name),
+				     "evaluate_%lu",
+				     (unsigned long)i);
+			if (!(table[i] = (evaluate_t)dlsym(jitc->part[k]->handle,
+							   name)))
+			{
+				jitc_close(jitc);
+				TRACE("dlsym()");
+				return NULL;
+			}
+		}
+	}
+	return jitc;
+}
+
+int jitc_pool(int workers)
+{
+	int n, err;
+
+	n = (0 > workers) ? pool_default() : workers;
+	n = (POOL_MAX < n) ? POOL_MAX : n;
+	pthread_mutex_lock(&pool.mutex);
+	pool_stop();
+	err = n ? pool_start(n) : 0;
+	pthread_mutex_unlock(&pool.mutex);
+	return err;
+}
+
+struct jitc_async *jitc_compile_async(const struct parser_dag *dag)
+{
+	enum jitc_profile profile;
+	struct jitc_async *async;
+	int src, pipefd[2], err;
+	uint8_t status;
+	FILE *file;
+	size_t len;
+	char *text;
+
+	if (!(async = malloc(sizeof (struct jitc_async))))
+	{
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(async, 0, sizeof (struct jitc_async));
+	async->out = -1;
+	text = NULL;
+	len = 0;
+	if (!(file = open_memstream(&text, &len)))
+	{
+		FREE(async);
+		TRACE("open_memstream()");
+		return NULL;
+	}
+	if (codegen(dag, file) || fclose(file))
+	{
+		FREE(text);
+		FREE(async);
+		TRACE(0);
+		return NULL;
+	}
+	if (pipe2(pipefd, O_CLOEXEC))
+	{
+		FREE(text);
+		FREE(async);
+		TRACE("pipe2()");
+		return NULL;
+	}
+	async->done = pipefd[0];
+
+	/* a cache hit completes on the spot */
+
+	profile = tuned(text, len);
+	if (cache.enabled)
+	{
+		async->key = fnv1a(cache_key_argv(profile), text, len);
+		async->jitc = cache_open(async->key);
+	}
+	if (async->jitc)
+	{
+		FREE(text);
+		status = 0;
+		if (1 != write(pipefd[1], &status, 1))
+		{
+			/* cannot fail, the pipe is empty */
+		}
+		close(pipefd[1]);
+		return async;
+	}
+
+	/* hand the program to the pool */
+
+	err = -1;
+	if (0 <= (src = memfd_create("jitc-src", MFD_CLOEXEC)))
+	{
+		if (!write_all(src, text, len) &&
+		    (0 <= (async->out = memfd_create("jitc", MFD_CLOEXEC))))
+		{
+			pthread_mutex_lock(&pool.mutex);
+			if ((0 <= pool.fd) || !pool_start(pool_default()))
+			{
+				err = pool_send(src,
+						async->out,
+						pipefd[1],
+						profile);
+			}
+			pthread_mutex_unlock(&pool.mutex);
+		}
+		close(src);
+	}
+	FREE(text);
+	close(pipefd[1]);
+	if (err)
+	{
+		close(async->done);
+		if (0 <= async->out)
+		{
+			close(async->out);
+		}
+		FREE(async);
+		TRACE(0);
+		return NULL;
+	}
+	return async;
+}
+
+int jitc_async_fd(const struct jitc_async *async)
+{
+	assert( async );
+
+	return async->done;
+}
+
+struct jitc *jitc_async_wait(struct jitc_async *async)
+{
+	struct jitc *jitc;
+	uint8_t status;
+	ssize_t n;
+
+	assert( async );
+
+	while ((0 > (n = read(async->done, &status, 1))) && (EINTR == errno))
+	{
+	}
+	jitc = async->jitc;
+	if (!jitc && (1 == n) && !status)
+	{
+		if (cache.enabled)
+		{
+			cache_store(async->out, async->key);
+		}
+		jitc = memfd_open(async->out); /* owns out from here on */
+		async->out = -1;
+	}
+	close(async->done);
+	if (0 <= async->out)
+	{
+		close(async->out);
+	}
+	FREE(async);
+	if (!jitc)
+	{
+		TRACE("gcc");
+	}
+	return jitc;
+}
+
+/**
+ * Every profile runs evaluate_batch() on the same TUNE_ROWS random rows,
+ * best of TUNE_TRIALS runs. A profile whose results stray from those of the
+ * first profile by more than TUNE_TOLERANCE, e.g., -ffast-math mishandling
+ * an infinity, is never chosen.
+ */
+
+#define TUNE_ROWS      4096
+#define TUNE_TRIALS    16
+#define TUNE_TOLERANCE 1e-9
+
+static uint64_t tune_vars(const struct parser_dag *dag)
+{
+	uint64_t n;
+	uint32_t i;
+
+	n = 0;
+	for (i = 1; i <= dag->n; ++i)
+	{
+		if ((PARSER_DAG_VAR == dag->op[i]) && (dag->left[i] >= n))
+		{
+			n = (uint64_t)dag->left[i] + 1;
+		}
+	}
+	return n;
+}
+
+static void tune_store(const char *text, size_t len, enum jitc_profile profile)
+{
+	char pathname[512], tmpname[560];
+	FILE *file;
+
+	if (mkdir(cache.dirname, 0755) && (EEXIST != errno))
+	{
+		return;
+	}
+	tune_pathname(pathname, sizeof (pathname), text, len);
+	safe_sprintf(tmpname,
+		     sizeof (tmpname),
+		     "%s.%ld.%lu.tmp",
+		     pathname,
+		     (long)getpid(),
+		     (unsigned long)__atomic_fetch_add(&serial,
+						       1,
+						       __ATOMIC_RELAXED));
+	if (!(file = fopen(tmpname, "w")))
+	{
+		return;
+	}
+	fprintf(file, "%s\n", PROFILE[profile].name);
+	if (fclose(file) || rename(tmpname, pathname))
+	{
+		file_delete(tmpname);
+		return;
+	}
+	cache_evict(strlen(PROFILE[profile].name) + 1);
+}
+
+static int tune_agree(const double *a, const double *b, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+	{
+		if ((a[i] != a[i]) != (b[i] != b[i]))
+		{
+			return 0;
+		}
+		if ((a[i] == a[i]) && (TUNE_TOLERANCE < fabs(a[i] - b[i])))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int jitc_autotune(const struct parser_dag *dag,
+		  enum jitc_profile *best,
+		  double *ns)
+{
+	double *in, *out, *ref;
+	uint64_t nvars, r, t, tmin, tbest;
+	evaluate_batch_t batch;
+	struct jitc *jitc;
+	struct job job;
+	size_t i, p, k;
+	int have_ref;
+	FILE *file;
+	size_t len;
+	char *text;
+
+	text = NULL;
+	len = 0;
+	nvars = tune_vars(dag);
+	if (!(file = open_memstream(&text, &len)))
+	{
+		TRACE(0);
+		return -1;
+	}
+	if (codegen(dag, file) || fclose(file))
+	{
+		FREE(text);
+		TRACE(0);
+		return -1;
+	}
+	in = malloc((nvars ? nvars : 1) * TUNE_ROWS * sizeof (double));
+	out = malloc(TUNE_ROWS * sizeof (double));
+	ref = malloc(TUNE_ROWS * sizeof (double));
+	if (!in || !out || !ref)
+	{
+		FREE(text);
+		FREE(in);
+		FREE(out);
+		FREE(ref);
+		TRACE("out of memory");
+		return -1;
+	}
+	r = 0x2545f4914f6cdd1dULL;
+	for (i = 0; i < nvars * TUNE_ROWS; ++i)
+	{
+		r ^= r << 13;
+		r ^= r >> 7;
+		r ^= r << 17;
+		in[i] = -4.0 + 8.0 * (double)(r >> 11) / 9007199254740992.0;
+	}
+	have_ref = 0;
+	tbest = 0;
+	for (p = 0; p < ARRAY_SIZE(PROFILE); ++p)
+	{
+		if (ns)
+		{
+			ns[p] = 0.0;
+		}
+		if (job_start(&job, text, len, (enum jitc_profile)p) ||
+		    !(jitc = job_finish(&job)))
+		{
+			continue; /* e.g., -march=native on an odd host */
+		}
+		if (!(batch = (evaluate_batch_t)jitc_lookup(jitc,
+							     "evaluate_batch")))
+		{
+			jitc_close(jitc);
+			continue;
+		}
+		tmin = 0;
+		for (k = 0; k < TUNE_TRIALS; ++k)
+		{
+			t = ref_time();
+			batch(in, out, TUNE_ROWS);
+			t = ref_time() - t;
+			tmin = (!k || (t < tmin)) ? t : tmin;
+		}
+		jitc_close(jitc);
+		if (!have_ref)
+		{
+			memcpy(ref, out, TUNE_ROWS * sizeof (double));
+			have_ref = 1;
+		}
+		else if (!tune_agree(ref, out, TUNE_ROWS))
+		{
+			continue;
+		}
+		if (ns)
+		{
+			ns[p] = (double)tmin / TUNE_ROWS;
+		}
+		if (!tbest || (tmin < tbest))
+		{
+			tbest = tmin ? tmin : 1;
+			(*best) = (enum jitc_profile)p;
+		}
+	}
+	FREE(in);
+	FREE(out);
+	FREE(ref);
+	if (!tbest)
+	{
+		FREE(text);
+		TRACE("no profile compiled");
+		return -1;
+	}
+	if (cache.enabled)
+	{
+		tune_store(text, len, *best);
+	}
+	FREE(text);
+	return 0;
+}
+
+/**
+ * jitc_parallel_eval() runs on a team of threads, started once and pinned
+ * one per processor, while the caller waits. Thread t of T owns the rows
+ * [t n / T, (t + 1) n / T) of every job and evaluates them in chunks whose
+ * inputs and outputs fit in half the L2 cache. With more than one variable,
+ * a chunk's inputs are gathered into a scratch buffer the thread allocated
+ * itself, so its pages are local to the thread's NUMA node; the arrays of
+ * jitc_parallel_alloc() are first touched row by row by their owners, for
+ * the same reason.
+ */
+
+#define TEAM_MAX 256
+
+struct member
+{
+	pthread_t thread;
+	uint64_t job; /* the last job seen */
+	double *scratch;
+	size_t capacity; /* doubles in scratch */
+	int err;
+};
+
+struct share
+{
+	evaluate_batch_t batch; /* NULL: only touch out */
+	size_t nvars;
+	const double *in;
+	double *out;
+	size_t n;
+};
+
+static struct
+{
+	pthread_mutex_t lock; /* serializes jobs and resizing */
+	pthread_mutex_t mutex;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	int n;
+	int stop;
+	int pending;
+	uint64_t job;
+	struct share share;
+	struct member member[TEAM_MAX];
+} team = {
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+	0, 0, 0, 0,
+	{ NULL, 0, NULL, NULL, 0 },
+	{ { 0, 0, NULL, 0, 0 } }
+};
+
+static size_t team_chunk(size_t nvars)
+{
+	long l2;
+	size_t n;
+
+	l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	l2 = (0 < l2) ? l2 : (256 * 1024);
+	n = (size_t)l2 / 2 / ((nvars + 1) * sizeof (double));
+	return (64 < n) ? (n & ~(size_t)63) : 64;
+}
+
+static void team_share(struct member *member, int t)
+{
+	const struct share *share = &team.share;
+	size_t a, b, m, i, chunk;
+	double *p;
+
+	a = share->n * (size_t)t / (size_t)team.n;
+	b = share->n * (size_t)(t + 1) / (size_t)team.n;
+	if (!share->batch)
+	{
+		for (i = 0; i < share->nvars; ++i)
+		{
+			memset(share->out + i * share->n + a,
+			       0,
+			       (b - a) * sizeof (double));
+		}
+		return;
+	}
+	chunk = team_chunk(share->nvars);
+	if ((1 < share->nvars) && (member->capacity < (share->nvars * chunk)))
+	{
+		FREE(member->scratch);
+		member->capacity = 0;
+		if (!(p = malloc(share->nvars * chunk * sizeof (p[0]))))
+		{
+			member->err = 1;
+			return;
+		}
+		member->scratch = p;
+		member->capacity = share->nvars * chunk;
+	}
+	for (; a < b; a += m)
+	{
+		m = ((b - a) < chunk) ? (b - a) : chunk;
+		if (1 < share->nvars)
+		{
+			for (i = 0; i < share->nvars; ++i)
+			{
+				memcpy(member->scratch + i * m,
+				       share->in + i * share->n + a,
+				       m * sizeof (double));
+			}
+			share->batch(member->scratch, share->out + a, m);
+		}
+		else
+		{
+			share->batch(share->nvars ? (share->in + a) : share->in,
+				     share->out + a,
+				     m);
+		}
+	}
+}
+
+static void *team_main(void *arg)
+{
+	struct member *member = (struct member *)arg;
+
+	pthread_mutex_lock(&team.mutex);
+	for (;;)
+	{
+		while (!team.stop && (member->job == team.job))
+		{
+			pthread_cond_wait(&team.start, &team.mutex);
+		}
+		if (team.stop)
+		{
+			break;
+		}
+		member->job = team.job;
+		pthread_mutex_unlock(&team.mutex);
+		team_share(member, (int)(member - team.member));
+		pthread_mutex_lock(&team.mutex);
+		if (!--team.pending)
+		{
+			pthread_cond_signal(&team.done);
+		}
+	}
+	pthread_mutex_unlock(&team.mutex);
+	FREE(member->scratch);
+	return NULL;
+}
+
+static int team_default(void)
+{
+	cpu_set_t set;
+	int n;
+
+	n = pool_default();
+	if (!sched_getaffinity(0, sizeof (set), &set))
+	{
+		n = CPU_COUNT(&set);
+	}
+	n = (0 < n) ? n : 1;
+	return (TEAM_MAX < n) ? TEAM_MAX : n;
+}
+
+static void team_stop(void)
+{
+	int i;
+
+	pthread_mutex_lock(&team.mutex);
+	team.stop = 1;
+	pthread_cond_broadcast(&team.start);
+	pthread_mutex_unlock(&team.mutex);
+	for (i = 0; i < team.n; ++i)
+	{
+		pthread_join(team.member[i].thread, NULL);
+	}
+	team.stop = 0;
+	team.n = 0;
+}
+
+/**
+ * Pins member t to the t-th processor the process may run on, round robin.
+ */
+
+static void team_pin(int t)
+{
+	cpu_set_t set, one;
+	int cpu, k;
+
+	if (sched_getaffinity(0, sizeof (set), &set) || !CPU_COUNT(&set))
+	{
+		return;
+	}
+	k = t % CPU_COUNT(&set);
+	for (cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+	{
+		if (CPU_ISSET(cpu, &set) && !k--)
+		{
+			CPU_ZERO(&one);
+			CPU_SET(cpu, &one);
+			pthread_setaffinity_np(team.member[t].thread,
+					       sizeof (one),
+					       &one);
+			return;
+		}
+	}
+}
+
+static int team_start(int n)
+{
+	struct member *member;
+
+	while (team.n < n)
+	{
+		member = &team.member[team.n];
+		memset(member, 0, sizeof (struct member));
+		member->job = team.job;
+		if (pthread_create(&member->thread, NULL, team_main, member))
+		{
+			team_stop();
+			TRACE("pthread_create()");
+			return -1;
+		}
+		team_pin(team.n++);
+	}
+	return 0;
+}
+
+static int team_run(const struct share *share)
+{
+	int i, err;
+
+	pthread_mutex_lock(&team.lock);
+	if (!team.n && team_start(team_default()))
+	{
+		pthread_mutex_unlock(&team.lock);
+		TRACE(0);
+		return -1;
+	}
+	pthread_mutex_lock(&team.mutex);
+	team.share = *share;
+	team.pending = team.n;
+	++team.job;
+	pthread_cond_broadcast(&team.start);
+	while (team.pending)
+	{
+		pthread_cond_wait(&team.done, &team.mutex);
+	}
+	pthread_mutex_unlock(&team.mutex);
+	err = 0;
+	for (i = 0; i < team.n; ++i)
+	{
+		err |= team.member[i].err;
+		team.member[i].err = 0;
+	}
+	pthread_mutex_unlock(&team.lock);
+	if (err)
+	{
+		TRACE("out of memory");
+		return -1;
+	}
+	return 0;
+}
+
+int jitc_parallel(int threads)
+{
+	int n, err;
+
+	n = (0 > threads) ? team_default() : threads;
+	n = (TEAM_MAX < n) ? TEAM_MAX : n;
+	pthread_mutex_lock(&team.lock);
+	team_stop();
+	err = n ? team_start(n) : 0;
+	pthread_mutex_unlock(&team.lock);
+	return err;
+}
+
+double *jitc_parallel_alloc(size_t nvars, size_t n)
+{
+	struct share share;
+	size_t size;
+	void *p;
+
+	nvars = nvars ? nvars : 1;
+	size = nvars * n * sizeof (double);
+	if (!n || (MAP_FAILED == (p = mmap(NULL,
+					   size,
+					   PROT_READ | PROT_WRITE,
+					   MAP_PRIVATE | MAP_ANONYMOUS,
+					   -1,
+					   0))))
+	{
+		TRACE("mmap()");
+		return NULL;
+	}
+	memset(&share, 0, sizeof (share));
+	share.nvars = nvars;
+	share.out = (double *)p;
+	share.n = n;
+	if (team_run(&share))
+	{
+		munmap(p, size);
+		TRACE(0);
+		return NULL;
+	}
+	return (double *)p;
+}
+
+void jitc_parallel_free(double *p, size_t nvars, size_t n)
+{
+	if (p)
+	{
+		munmap(p, (nvars ? nvars : 1) * n * sizeof (double));
+	}
+}
+
+int jitc_parallel_eval(evaluate_batch_t batch,
+		       size_t nvars,
+		       const double *in,
+		       double *out,
+		       size_t n)
+{
+	struct share share;
+
+	assert( batch && out );
+
+	if (n <= team_chunk(nvars))
+	{
+		batch(in, out, n);
+		return 0;
+	}
+	share.batch = batch;
+	share.nvars = nvars;
+	share.in = in;
+	share.out = out;
+	share.n = n;
+	if (team_run(&share))
+	{
+		TRACE(0);
+		return -1;
+	}
+	return 0;
+}
+
+struct jitc *jitc_native(const struct parser_dag *dag)
+{
+	struct jitc *jitc = malloc(sizeof(struct jitc));
+
+	if (jitc)
+	{
+		memset(jitc, 0, sizeof(struct jitc));
+		jitc->memfd = -1;
+		if (!(jitc->code = native_compile(dag, &jitc->size)))
+		{
+			TRACE(0);
+			FREE(jitc);
+		}
+	}
+	return jitc;
+}
+
+void jitc_close(struct jitc *jitc)
+{
+	if (jitc)
+	{
+		while (jitc->nparts)
+		{
+			jitc_close(jitc->part[--jitc->nparts]);
+		}
+		FREE(jitc->part);
+		if (jitc->code)
+		{
+			native_free(jitc->code, jitc->size);
+		}
+		else if (jitc->handle)
+		{
+			dlclose(jitc->handle);
+		}
+		if (0 <= jitc->memfd)
+		{
+			close(jitc->memfd);
+		}
+		free(jitc);
+	}
+}
+
+long jitc_lookup(struct jitc *jitc, const char *symbol)
+{
+	size_t i;
+	long p;
+
+	if (jitc)
+	{
+		for (i = 0; i < jitc->nparts; ++i)
+		{
+			if ((p = jitc_lookup(jitc->part[i], symbol)))
+			{
+				return p;
+			}
+		}
+		if (jitc->code)
+		{
+			return strcmp(symbol, "evaluate") ? 0 : (long)jitc->code;
+		}
+		if (jitc->handle)
+		{
+			return (long)dlsym(jitc->handle, symbol);
+		}
+	}
+	return 0;
+}
+
+unsigned long long jitc_division_faults(struct jitc *jitc)
+{
+	const unsigned long long *faults;
+	unsigned long long n = 0;
+	size_t i;
+
+	if (jitc)
+	{
+		for (i = 0; i < jitc->nparts; ++i)
+		{
+			n += jitc_division_faults(jitc->part[i]);
+		}
+		if (jitc->handle &&
+		    (faults = dlsym(jitc->handle, "division_faults")))
+		{
+			n += __atomic_load_n(faults, __ATOMIC_RELAXED);
+		}
+	}
+	return n;
 }
@@ -10,10 +10,98 @@
 #ifndef _JITC_H_
 #define _JITC_H_
 
+#include "system.h"
+#include "parser.h"
+#include "codegen.h"
+
 struct jitc;
+struct jitc_async;
+
+/**
+ * The gcc optimization flags modules are compiled with. JITC_PROFILE_NATIVE
+ * and JITC_PROFILE_FAST tune for the host processor, and JITC_PROFILE_FAST
+ * lets gcc reassociate and contract into fused multiply-adds, so its
+ * results may differ in the last bits and around infinities and NaNs.
+ */
+
+enum jitc_profile {
+	JITC_PROFILE_O1,     /* -O1 */
+	JITC_PROFILE_O2,     /* -O2 */
+	JITC_PROFILE_O3,     /* -O3, the default */
+	JITC_PROFILE_NATIVE, /* -O3 -march=native */
+	JITC_PROFILE_FAST,   /* -O3 -march=native, -ffast-math in effect */
+	JITC_PROFILE_END     /* the number of profiles */
+};
+
+/**
+ * Configures the persistent compile cache consulted by jitc_compile(). A
+ * compiled module is keyed by a hash of the C program, of the compiler
+ * command line and of gcc's version and target, so compiling an unchanged
+ * program again links the cached module into place without running the
+ * compiler, and a module of another gcc is never reused, nor one built
+ * with -march=native on another processor model. Once the cache grows
+ * past capacity bytes, the least recently used modules are evicted. The
+ * directory is only scanned for eviction after every sixteenth of capacity
+ * stored, so each process may overshoot by that much. The cache directory
+ * may be shared by any number of concurrent processes.
+ *
+ * By default the cache lives in ".jitc" with a capacity of 64 MiB.
+ *
+ * dirname : the cache directory (created if missing), or NULL to disable
+ * capacity: the maximum total size of the cached modules in bytes
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int jitc_cache(const char *dirname, uint64_t capacity);
+
+/**
+ * Selects the compile profile of subsequent compilations, except for
+ * programs autotuned by jitc_autotune().
+ *
+ * profile: the compile profile
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int jitc_set_profile(enum jitc_profile profile);
+
+/**
+ * profile: a compile profile
+ *
+ * return: the short name of profile, e.g., "o3", or NULL if invalid
+ */
+
+const char *jitc_profile_name(enum jitc_profile profile);
+
+/**
+ * Compiles an expression under every profile and measures the throughput of
+ * its evaluate_batch() entry point on random inputs, choosing the fastest
+ * profile whose results agree with the others. With the compile cache
+ * enabled, the choice is recorded in the cache, so that jitc_build() and
+ * jitc_compile_async() compile the same expression with it from then on;
+ * otherwise pass it to jitc_set_profile(). The record holds for the gcc
+ * and the processor that tuned it, so hosts sharing the cache each tune
+ * for themselves.
+ *
+ * dag : the parsed expression
+ * best: receives the fastest profile
+ * ns  : NULL, or an array of JITC_PROFILE_END receiving, for every
+ *       profile, nanoseconds per row, 0.0 if the profile failed or was
+ *       rejected
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int jitc_autotune(const struct parser_dag *dag,
+		  enum jitc_profile *best,
+		  double *ns);
 
 /**
- * Compiles a C program into a dynamically loadable module.
+ * Compiles a C program into a dynamically loadable module. If the compile
+ * cache holds a module for the same program, that module is reused.
+ * Modules leave sigmoid() undefined, to be bound to the host's when loaded,
+ * so the host must be linked with -rdynamic.
  *
  * input : the file pathname of the C program
  * output: the file pathname of the dynamically loadable module
@@ -34,10 +122,162 @@ int jitc_compile(const char *input, const char *output);
 
 struct jitc *jitc_open(const char *pathname);
 
+/**
+ * Compiles an expression with the C compiler and loads it, entirely in
+ * memory: the program generated by codegen() is piped into the compiler and
+ * the module is written to an anonymous memory file, so concurrent calls
+ * never collide on file names. With the compile cache enabled, a cached
+ * module is loaded instead of compiling, and a new one is added to it.
+ *
+ * dag: the parsed expression
+ *
+ * return: an opaque handle or NULL on error
+ */
+
+struct jitc *jitc_build(const struct parser_dag *dag);
+
+/**
+ * Compiles many expressions at once, in memory like jitc_build(), into
+ * modules defining evaluate_<k>() for expression k (see codegen_many()).
+ * Large batches are split into translation units compiled by parallel gcc
+ * processes, one per processor; each unit is cached on its own.
+ *
+ * dags : the parsed expressions
+ * n    : the number of expressions, at least one
+ * table: receives the entry point of expression k in table[k]
+ *
+ * return: an opaque handle owning every entry point in table, or NULL on
+ *         error
+ */
+
+struct jitc *jitc_build_many(const struct parser_dag * const *dags,
+			     size_t n,
+			     evaluate_t *table);
+
+/**
+ * Resizes the compile pool used by jitc_compile_async(): worker processes,
+ * started once, that each run one gcc at a time. The pool is started on
+ * first use with one worker per processor. Each worker is a fresh execution
+ * of the calling program, /proc/self/exe, that never reaches its main(), so
+ * the pool may be started from any thread. Descriptors not opened with
+ * close-on-exec are inherited by the workers.
+ *
+ * workers: the number of workers, negative for one per processor, or 0 to
+ *          stop the pool once the queued compilations are done
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int jitc_pool(int workers);
+
+/**
+ * Submits an expression to the compile pool and returns without waiting for
+ * the compiler. The compilation is done once jitc_async_fd() is readable,
+ * so a caller can poll() it alongside its other descriptors; a cache hit is
+ * done on return.
+ *
+ * dag: the parsed expression
+ *
+ * return: an opaque pending compilation or NULL on error
+ */
+
+struct jitc_async *jitc_compile_async(const struct parser_dag *dag);
+
+/**
+ * async: a pending compilation obtained from jitc_compile_async()
+ *
+ * return: a descriptor that becomes readable once the compilation is done
+ */
+
+int jitc_async_fd(const struct jitc_async *async);
+
+/**
+ * Waits for a pending compilation, blocking if it is not done yet, and loads
+ * the module like jitc_build() would. async is released either way.
+ *
+ * async: a pending compilation obtained from jitc_compile_async()
+ *
+ * return: an opaque handle or NULL on error
+ */
+
+struct jitc *jitc_async_wait(struct jitc_async *async);
+
+/**
+ * Resizes the thread team used by jitc_parallel_eval() and
+ * jitc_parallel_alloc(). The team is started on first use with one thread
+ * per processor; thread t is pinned to the t-th processor the process may
+ * run on.
+ *
+ * threads: the number of threads, negative for one per processor, or 0 to
+ *          stop the team
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int jitc_parallel(int threads);
+
+/**
+ * Allocates zeroed memory for nvars * n doubles, laid out like the inputs of
+ * evaluate_batch_t, every row first touched by the team thread that
+ * jitc_parallel_eval() will have evaluate it, so that on NUMA machines the
+ * pages live on that thread's node. Pass nvars 1 for an output array.
+ *
+ * nvars: the number of variables
+ * n    : the number of rows
+ *
+ * return: the memory, or NULL on error
+ */
+
+double *jitc_parallel_alloc(size_t nvars, size_t n);
+
+/**
+ * Releases memory obtained from jitc_parallel_alloc(nvars, n).
+ *
+ * Note: p may be NULL
+ */
+
+void jitc_parallel_free(double *p, size_t nvars, size_t n);
+
+/**
+ * Evaluates n rows with an evaluate_batch() entry point on the thread team,
+ * each thread evaluating a contiguous share of the rows in cache-sized
+ * chunks, and waits for them. The results are the same as those of
+ * batch(in, out, n). Concurrent calls run one after the other.
+ *
+ * batch: the evaluate_batch() entry point of a loaded module
+ * nvars: the number of variables of the expression, see parser_vars()
+ * in   : the inputs, variable i of row j in in[i * n + j]
+ * out  : receives the result of row j in out[j]
+ * n    : the number of rows
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int jitc_parallel_eval(evaluate_batch_t batch,
+		       size_t nvars,
+		       const double *in,
+		       double *out,
+		       size_t n);
+
+/**
+ * Compiles an expression straight to machine code with the native backend,
+ * bypassing the C compiler. The returned handle behaves like one obtained
+ * from jitc_open() on the module codegen() would have produced, i.e., it
+ * exports the symbol "evaluate".
+ *
+ * dag: the parsed expression
+ *
+ * return: an opaque handle or NULL on error
+ */
+
+struct jitc *jitc_native(const struct parser_dag *dag);
+
 /**
  * Unloads a previously loaded dynamically loadable module.
  *
- * jitc: an opaque handle previously obtained by calling jitc_open()
+ * jitc: an opaque handle previously obtained by calling jitc_open(),
+ *       jitc_build(), jitc_build_many(), jitc_async_wait() or
+ *       jitc_native()
  *
  * Note: jitc may be NULL
  */
@@ -47,11 +287,28 @@ void jitc_close(struct jitc *jitc);
 /**
  * Searches for a symbol in the dynamically loaded module associated with jitc.
  *
- * jitc: an opaque handle previously obtained by calling jitc_open()
+ * jitc: an opaque handle previously obtained by calling jitc_open(),
+ *       jitc_build(), jitc_build_many(), jitc_async_wait() or
+ *       jitc_native()
  *
  * return: the memory address of the start of the symbol, or 0 on error
  */
 
 long jitc_lookup(struct jitc *jitc, const char *symbol);
 
+/**
+ * Sums division_faults (see codegen()) over the module associated with jitc
+ * and, for jitc_build_many(), over every module of the batch, which
+ * jitc_lookup() would only return the first of.
+ *
+ * jitc: an opaque handle previously obtained by calling jitc_open(),
+ *       jitc_build(), jitc_build_many(), jitc_async_wait() or
+ *       jitc_native()
+ *
+ * return: the number of divisions by zero counted, 0 if none or not
+ *         CODEGEN_DIVISION_CHECKED
+ */
+
+unsigned long long jitc_division_faults(struct jitc *jitc);
+
 #endif /* _JITC_H_ */
@@ -7,29 +7,33 @@
  * lexer.c
  */
 
+#include "arena.h"
 #include "lexer.h"
 
+/**
+ * The token array is the only allocation of the lexer's arena, so it grows
+ * in place and moves only when it outgrows a chunk, into one twice as big.
+ */
+
 struct lexer {
 	uint64_t size;
 	struct lexer_token *tokens;
+	struct arena *arena;
 };
 
 static struct lexer_token *
 mktoken(struct lexer *lexer, enum lexer_token_op op)
 {
 	struct lexer_token *token, *tokens;
-	size_t n;
 
-	if (0 == (lexer->size % 100)) {
-		n = (lexer->size + 100) * sizeof (tokens[0]);
-		if (!(tokens = realloc(lexer->tokens, n))) {
-			TRACE("out of memory");
-			return NULL;
-		}
-		lexer->tokens = tokens;
+	if (!(tokens = arena_grow(lexer->arena,
+				  lexer->tokens,
+				  (lexer->size + 1) * sizeof (tokens[0])))) {
+		TRACE(0);
+		return NULL;
 	}
+	lexer->tokens = tokens;
 	token = &lexer->tokens[lexer->size++];
-	memset(token, 0, sizeof (struct lexer_token));
 	token->op = op;
 	return token;
 }
@@ -37,7 +41,7 @@ mktoken(struct lexer *lexer, enum lexer_token_op op)
 static int
 tokenize(struct lexer *lexer, const char *s)
 {
-	const char * const OPERATORS = "+-*/()";
+	const char * const OPERATORS = "+-*/(),";
 	struct lexer_token *token;
 	size_t i;
 	char *e;
@@ -59,6 +63,17 @@ tokenize(struct lexer *lexer, const char *s)
 		else if (isspace(*s)) {
 			++s;
 		}
+		else if (isalpha(*s) || ('_' == (*s))) {
+			if (!(token = mktoken(lexer, LEXER_OP_VAR))) {
+				TRACE(0);
+				return -1;
+			}
+			token->name = s;
+			while (isalnum(*s) || ('_' == (*s))) {
+				++s;
+			}
+			token->len = (size_t)(s - token->name);
+		}
 		else {
 			if (!(token = mktoken(lexer, LEXER_OP_VAL))) {
 				TRACE(0);
@@ -87,7 +102,7 @@ lexer_open(const char *s)
 		return NULL;
 	}
 	memset(lexer, 0, sizeof (struct lexer));
-	if (tokenize(lexer, s)) {
+	if (!(lexer->arena = arena_open()) || tokenize(lexer, s)) {
 		lexer_close(lexer);
 		TRACE(0);
 		return NULL;
@@ -99,7 +114,7 @@ void
 lexer_close(struct lexer *lexer)
 {
 	if (lexer) {
-		FREE(lexer->tokens);
+		arena_close(lexer->arena);
 		memset(lexer, 0, sizeof (struct lexer));
 	}
 	FREE(lexer);
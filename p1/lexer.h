@@ -16,18 +16,24 @@ struct lexer_token {
 	enum lexer_token_op {
 		LEXER_OP_,
 		LEXER_OP_VAL,
-		LEXER_OP_ADD,  /* '+' */
-		LEXER_OP_SUB,  /* '-' */
-		LEXER_OP_MUL,  /* '*' */
-		LEXER_OP_DIV,  /* '/' */
-		LEXER_OP_OPEN, /* '(' */
-		LEXER_OP_CLOSE /* ')' */
+		LEXER_OP_VAR,   /* [A-Za-z_][A-Za-z0-9_]* */
+		LEXER_OP_ADD,   /* '+' */
+		LEXER_OP_SUB,   /* '-' */
+		LEXER_OP_MUL,   /* '*' */
+		LEXER_OP_DIV,   /* '/' */
+		LEXER_OP_OPEN,  /* '(' */
+		LEXER_OP_CLOSE, /* ')' */
+		LEXER_OP_COMMA  /* ',' */
 	} op;
 	double val;
+	const char *name; /* LEXER_OP_VAR: points into the lexed string */
+	size_t len;
 };
 
 struct lexer;
 
+/* tokens may point into s, which must outlive the lexer */
+
 struct lexer *lexer_open(const char *s);
 
 void lexer_close(struct lexer *lexer);
@@ -9,143 +9,319 @@
 
 #include "jitc.h"
 #include "parser.h"
+#include "codegen.h"
+#include "sigmoid.h"
+#include "stream.h"
 #include "system.h"
-#include <math.h>
 
-/* export LD_LIBRARY_PATH=. */
+#define HOT 1024 /* -s: evaluations of an expression before compiling it */
 
-static void
-reflect(const struct parser_dag *dag, FILE *file)
+/**
+ * Evaluates the expressions on stdin, see stream_run(), simplified with the
+ * parser_optimize() flags optimize, reporting the throughput on stderr.
+ */
+
+static int
+streaming(int argc, char *argv[], unsigned optimize)
 {
-	if (dag) {
-		reflect(dag->left, file);
-		reflect(dag->right, file);
-		if (PARSER_DAG_VAL == dag->op) {
-			fprintf(file,
-				"double t%d = %f;\n",
-				dag->id,
-				dag->val);
-		}
-		else if (PARSER_DAG_NEG == dag->op) {
-			fprintf(file,
-				"double t%d = - t%d;\n",
-				dag->id,
-				dag->right->id);
-		}
-		else if (PARSER_DAG_MUL == dag->op) {
-			fprintf(file,
-				"double t%d = t%d * t%d;\n",
-				dag->id,
-				dag->left->id,
-				dag->right->id);
-		}
-		else if (PARSER_DAG_DIV == dag->op) {
-			fprintf(file,
-				"double t%d = t%d ? (t%d / t%d) : 0.0;\n",
-				dag->id,
-				dag->right->id,
-				dag->left->id,
-				dag->right->id);
-		}
-		else if (PARSER_DAG_ADD == dag->op) {
-			fprintf(file,
-				"double t%d = t%d + t%d;\n",
-				dag->id,
-				dag->left->id,
-				dag->right->id);
+	static char buf[1 << 20];
+	struct stream_stats stats;
+	double rate;
+
+	setvbuf(stdout, buf, _IOFBF, sizeof (buf));
+	if (stream_run(stdin, stdout, argc, argv, HOT, optimize, &stats)) {
+		TRACE(0);
+		return -1;
+	}
+	rate = stats.ns ? (1e9 * (double)stats.lines / (double)stats.ns) : 0.0;
+	fprintf(stderr,
+		"%lu expressions, %lu distinct, %lu compiled, %lu errors,"
+		" %.0f exprs/s\n",
+		(unsigned long)stats.lines,
+		(unsigned long)stats.distinct,
+		(unsigned long)stats.compiled,
+		(unsigned long)stats.errors,
+		rate);
+	if (stats.faults) {
+		fprintf(stderr,
+			"%lu division(s) by zero\n",
+			(unsigned long)stats.faults);
+	}
+	return 0;
+}
+
+/**
+ * Binds every variable of the expression to a name=value argument.
+ */
+
+static double *
+bind(const struct parser *parser, int argc, char *argv[])
+{
+	const char *name;
+	uint64_t i;
+	double *x;
+	size_t n;
+	char *e;
+	int j;
+
+	if (!(x = malloc((parser_vars(parser) + 1) * sizeof (x[0])))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	for (i=0; i<parser_vars(parser); ++i) {
+		name = parser_var(parser, i);
+		n = safe_strlen(name);
+		for (j=0; j<argc; ++j) {
+			if (!strncmp(argv[j], name, n) && ('=' == argv[j][n])) {
+				break;
+			}
 		}
-		else if (PARSER_DAG_SUB == dag->op) {
-			fprintf(file,
-				"double t%d = t%d - t%d;\n",
-				dag->id,
-				dag->left->id,
-				dag->right->id);
+		if (j == argc) {
+			fprintf(stderr, "unbound variable '%s'\n", name);
+			FREE(x);
+			return NULL;
 		}
-		else {
-			EXIT("software");
+		x[i] = strtod(argv[j] + n + 1, &e);
+		if ((argv[j] + n + 1) == e) {
+			fprintf(stderr, "invalid value for '%s'\n", name);
+			FREE(x);
+			return NULL;
 		}
 	}
+	return x;
 }
 
-static void
-generate(const struct parser_dag *dag, FILE *file)
-{	
-	fprintf(file, "double sigmoid(double x);\n");
-	fprintf(file, "double evaluate(void) {\n");
-	reflect(dag, file);
-	fprintf(file, "return sigmoid(t");
-	fprintf(file, "%d", dag->id);
-	fprintf(file,");\n}");
-	
+static int
+native(const struct parser *parser, const double *x)
+{
+	struct jitc *jitc;
+	evaluate_t fnc;
+
+	if (!(jitc = jitc_native(parser_dag(parser))) ||
+	    !(fnc = (evaluate_t)jitc_lookup(jitc, "evaluate"))) {
+		jitc_close(jitc);
+		TRACE(0);
+		return -1;
+	}
+	printf("%f\n", fnc(x));
+	jitc_close(jitc);
+	return 0;
 }
 
-typedef double (*evaluate_t)(void);
-typedef double (*sigmoid)(double);
+/**
+ * An expression parser_optimize() reduced to a constant needs no code.
+ */
+
+static int /* BOOL */
+folded(const struct parser *parser)
+{
+	const struct parser_dag *dag;
+
+	dag = parser_dag(parser);
+	if ((1 != dag->n) || (PARSER_DAG_VAL != dag->op[1])) {
+		return 0;
+	}
+	printf("%f\n", sigmoid(dag->pool[dag->left[1]]));
+	return 1;
+}
+
+static int
+compiled(const struct parser *parser, const double *x, int tune)
+{
+	const unsigned long long *faults;
+	enum jitc_profile best;
+	struct jitc *jitc;
+	evaluate_t fnc;
 
-double sigmoid(double x) {
-    return 1.0 / (1.0 + exp(-x));
+	if (tune && jitc_autotune(parser_dag(parser), &best, NULL)) {
+		TRACE(0);
+		return -1;
+	}
+	if (!(jitc = jitc_build(parser_dag(parser))) ||
+	    !(fnc = (evaluate_t)jitc_lookup(jitc, "evaluate"))) {
+		jitc_close(jitc);
+		TRACE(0);
+		return -1;
+	}
+	printf("%f\n", fnc(x));
+	faults = (const unsigned long long *)jitc_lookup(jitc,
+							  "division_faults");
+	if (faults && (*faults)) {
+		fprintf(stderr, "%llu division(s) by zero\n", *faults);
+	}
+	jitc_close(jitc);
+	return 0;
 }
 
 int
 main(int argc, char *argv[])
 {
-	const char *SOFILE = "/home/mandar/projects/p1/out.so";
-	const char *CFILE = "/home/mandar/projects/p1/out.c";
 	struct parser *parser;
-	struct jitc *jitc;
-	evaluate_t fnc;
-	FILE *file;
+	int use_native, tune, stream, fast, err;
+	enum codegen_division d, division;
+	unsigned optimize;
+	enum jitc_profile p;
+	const char *s, *l, *w, *name;
+	size_t size;
+	double *x;
+	int i;
 
 	/* usage */
 
-	if (2 != argc) {
-		printf("usage: %s expression\n", argv[0]);
-		return -1;
+	use_native = 0;
+	tune = 0;
+	stream = 0;
+	fast = 0;
+	division = CODEGEN_DIVISION_BLEND;
+	s = NULL;
+	l = NULL;
+	w = NULL;
+	size = 0;
+	for (i=1; i < argc; ++i) {
+		if (!strcmp(argv[i], "-n")) {
+			use_native = 1;
+		}
+		else if (!strcmp(argv[i], "-t")) {
+			tune = 1;
+		}
+		else if (!strcmp(argv[i], "-p") && ((i + 1) < argc)) {
+			++i;
+			for (p=0; p<JITC_PROFILE_END; ++p) {
+				if (!strcmp(argv[i], jitc_profile_name(p))) {
+					break;
+				}
+			}
+			if ((JITC_PROFILE_END == p) || jitc_set_profile(p)) {
+				fprintf(stderr, "unknown profile '%s'\n", argv[i]);
+				file_unmap(s, size);
+				return -1;
+			}
+			fast = (JITC_PROFILE_FAST == p);
+		}
+		else if (!strcmp(argv[i], "-d") && ((i + 1) < argc)) {
+			++i;
+			for (d=0; d<CODEGEN_DIVISION_END; ++d) {
+				name = codegen_division_name(d);
+				if (!strcmp(argv[i], name)) {
+					break;
+				}
+			}
+			if (codegen_set_division(d)) {
+				fprintf(stderr,
+					"unknown division '%s'\n",
+					argv[i]);
+				file_unmap(s, size);
+				return -1;
+			}
+			division = d;
+		}
+		else if (!strcmp(argv[i], "-s") && !s && !l) {
+			stream = 1;
+		}
+		else if (!strcmp(argv[i], "-w") && ((i + 1) < argc)) {
+			w = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-l") &&
+			 !l &&
+			 !s &&
+			 !stream &&
+			 ((i + 1) < argc)) {
+			l = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-f") &&
+			 !s &&
+			 !l &&
+			 !stream &&
+			 ((i + 1) < argc)) {
+			if (!(s = file_map(argv[++i], &size))) {
+				TRACE(0);
+				return -1;
+			}
+			if (!size) {
+				file_unmap(s, size);
+				fprintf(stderr, "empty file '%s'\n", argv[i]);
+				return -1;
+			}
+		}
+		else {
+			break;
+		}
 	}
 
-	/* parse */
+	/* simplify for the division of the backend, -n always blends */
 
-	if (!(parser = parser_open(argv[1]))) {
-		TRACE(0);
+	optimize = fast ? PARSER_OPTIMIZE_FAST : 0;
+	if (!use_native && (CODEGEN_DIVISION_IEEE == division)) {
+		optimize |= PARSER_OPTIMIZE_IEEE;
+	}
+	if (!use_native && (CODEGEN_DIVISION_CHECKED == division)) {
+		optimize |= PARSER_OPTIMIZE_CHECKED;
+	}
+	if (stream) {
+		return streaming(argc - i, argv + i, optimize);
+	}
+	if (!s && !l && (i >= argc)) {
+		printf("usage: %s [-n | -t | -p profile] [-d division]"
+		       " [-w file]\n"
+		       "       [-f file | -l file | expression]"
+		       " [name=value ...]\n",
+		       argv[0]);
+		printf("       %s [-p profile] [-d division] -s"
+		       " [name=value ...]\n",
+		       argv[0]);
+		printf("  -n  compile to machine code without gcc\n");
+		printf("  -t  autotune the gcc profile, remembered by the cache\n");
+		printf("  -p  gcc profile: o1, o2, o3 (default), native or"
+		       " fast, the last\n"
+		       "      also simplifying the expression like"
+		       " -ffast-math would\n");
+		printf("  -d  gcc division by zero: blend (default, 0), ieee"
+		       " or checked (0,\n"
+		       "      counted on stderr)\n");
+		printf("  -f  read the expression from a file\n");
+		printf("  -w  save the parsed expression to a file, for -l\n");
+		printf("  -l  load an expression saved by -w under the same"
+		       " -p and -d\n");
+		printf("  -s  evaluate expressions read from stdin, one per line,"
+		       " each optionally\n"
+		       "      followed by ';' and bindings overriding those"
+		       " given\n");
+		printf("functions: exp log sqrt abs pow min max fma\n");
 		return -1;
 	}
+	argc -= i;
+	argv += i;
 
-	/* generate C */
+	/* parse */
 
-	if (!(file = fopen(CFILE, "w"))) {
-		TRACE("fopen()");
+	if (!(parser = l ? parser_load(l) : parser_open(s ? s : argv[0]))) {
+		file_unmap(s, size);
+		TRACE(0);
 		return -1;
 	}
-	generate(parser_dag(parser), file);
-	parser_close(parser);
-	fclose(file);
-
-	/* JIT compile */
-
-	if (jitc_compile(CFILE, SOFILE)) {
-		// file_delete(CFILE);
+	file_unmap(s, size);
+	if (!s && !l) {
+		--argc;
+		++argv;
+	}
+	if (parser_optimize(parser, optimize) ||
+	    (w && parser_save(parser, w))) {
+		parser_close(parser);
 		TRACE(0);
 		return -1;
 	}
-	// file_delete(CFILE);
-
-	// /* dynamic load */
-	jitc = jitc_open(SOFILE);
-	printf("jitc pointer %p\n",(void *)jitc);
-	if (!(jitc) ||
-	    !(fnc = (evaluate_t)jitc_lookup(jitc, "evaluate"))) {
-		// file_delete(SOFILE);
-		jitc_close(jitc);
+	if (!(x = bind(parser, argc, argv))) {
+		parser_close(parser);
 		TRACE(0);
 		return -1;
 	}
-	printf("all done");
-	fflush(stdout);
-	printf("%f\n", fnc());
-
-	/* done */
-
-	file_delete(SOFILE);
-	jitc_close(jitc);
-	return 0;
+	err = 0;
+	if (!folded(parser)) {
+		err = use_native ?
+			native(parser, x) :
+			compiled(parser, x, tune);
+	}
+	parser_close(parser);
+	FREE(x);
+	return err;
 }
@@ -0,0 +1,16 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * mathfn.c
+ */
+
+#include "mathfn.h"
+
+MATHFN_EXP
+
+MATHFN_LOG
+
+MATHFN_POW
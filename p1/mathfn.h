@@ -0,0 +1,141 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * mathfn.h
+ */
+
+#ifndef _MATHFN_H_
+#define _MATHFN_H_
+
+#include "system.h"
+
+/**
+ * exp(), log() and pow() of the expression language, within a few ulps of
+ * libm. Each kernel is written once, below, as a macro: mathfn.c expands it
+ * into the host functions called by the interpreter and the native
+ * backend, and codegen() pastes MATHFN_TEXT() of it into every module that
+ * needs it, so all backends compute bit for bit the same values. The
+ * kernels are branch-free, and gcc vectorizes them in evaluate_batch().
+ *
+ * exp: e^x = 2^k e^r with r = x - k ln2, |r| <= ln2/2, a degree 13 Taylor
+ *      polynomial in r, and 2^k applied as two exponent-bit scales so that
+ *      results overflow to infinity and underflow gradually, like libm's.
+ *      k is rounded by conversion to int rather than by the 1.5 * 2^52
+ *      shift, which reassociating compile profiles would fold away.
+ *
+ * log: x = 2^e m with sqrt(1/2) < m <= sqrt(2) (subnormals prescaled by
+ *      2^54) and log m = 2 atanh(s), s = (m - 1) / (m + 1), summed up to
+ *      s^23. e is read from the exponent bits through the 2^52 trick.
+ *
+ * pow: exp(y log |x|), negated for a negative x and an odd integer y, NaN
+ *      for a negative x and a non-integer y, and 1 if y is 0, x is 1, or x
+ *      is -1 and y infinite.
+ *      Its error grows with |y log x|; integers y beyond 2^31 count as
+ *      even.
+ */
+
+#define MATHFN_EXP							\
+double mathfn_exp(double x) {						\
+	unsigned long long u1, u2;					\
+	double y, t, k, r, p, s1, s2;					\
+	int i, i1;							\
+	y = (x == x) ? x : 0.0;						\
+	y = (y < -746.0) ? -746.0 : y;					\
+	y = (y > 710.0) ? 710.0 : y;					\
+	t = y * 1.4426950408889634;					\
+	i = (int)(t + ((t < 0.0) ? -0.5 : 0.5));			\
+	k = (double)i;							\
+	r = y - k * 6.93147180369123816490e-01;				\
+	r = r - k * 1.90821492927058770002e-10;				\
+	p = 1.6059043836821613e-10;					\
+	p = p * r + 2.0876756987868100e-09;				\
+	p = p * r + 2.5052108385441720e-08;				\
+	p = p * r + 2.7557319223985890e-07;				\
+	p = p * r + 2.7557319223985893e-06;				\
+	p = p * r + 2.4801587301587302e-05;				\
+	p = p * r + 1.9841269841269841e-04;				\
+	p = p * r + 1.3888888888888889e-03;				\
+	p = p * r + 8.3333333333333332e-03;				\
+	p = p * r + 4.1666666666666664e-02;				\
+	p = p * r + 1.6666666666666666e-01;				\
+	p = p * r + 0.5;						\
+	p = p * r + 1.0;						\
+	p = p * r + 1.0;						\
+	i1 = i / 2;							\
+	u1 = (unsigned long long)(i1 + 1023) << 52;			\
+	u2 = (unsigned long long)(i - i1 + 1023) << 52;			\
+	__builtin_memcpy(&s1, &u1, sizeof (s1));			\
+	__builtin_memcpy(&s2, &u2, sizeof (s2));			\
+	p = p * s1 * s2;						\
+	return (x == x) ? p : x;					\
+}
+
+#define MATHFN_LOG							\
+double mathfn_log(double x) {						\
+	unsigned long long u, v;					\
+	double y, e, m, s, z, p;					\
+	int tiny;							\
+	tiny = x < 2.2250738585072014e-308;				\
+	y = tiny ? (x * 18014398509481984.0) : x;			\
+	__builtin_memcpy(&u, &y, sizeof (u));				\
+	v = (u >> 52) | 0x4330000000000000ULL;				\
+	__builtin_memcpy(&e, &v, sizeof (e));				\
+	e = e - (tiny ? 4503599627371573.0 : 4503599627371519.0);	\
+	u = (u & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL;	\
+	__builtin_memcpy(&m, &u, sizeof (m));				\
+	e = (m > 1.4142135623730951) ? (e + 1.0) : e;			\
+	m = (m > 1.4142135623730951) ? (m * 0.5) : m;			\
+	s = (m - 1.0) / (m + 1.0);					\
+	z = s * s;							\
+	p = 1.0 / 23.0;							\
+	p = p * z + 1.0 / 21.0;						\
+	p = p * z + 1.0 / 19.0;						\
+	p = p * z + 1.0 / 17.0;						\
+	p = p * z + 1.0 / 15.0;						\
+	p = p * z + 1.0 / 13.0;						\
+	p = p * z + 1.0 / 11.0;						\
+	p = p * z + 1.0 / 9.0;						\
+	p = p * z + 1.0 / 7.0;						\
+	p = p * z + 1.0 / 5.0;						\
+	p = p * z + 1.0 / 3.0;						\
+	p = p * z + 1.0;						\
+	y = e * 6.93147180369123816490e-01 +				\
+		(2.0 * s * p + e * 1.90821492927058770002e-10);		\
+	y = (x < __builtin_inf()) ? y : x;				\
+	y = (0.0 == x) ? -__builtin_inf() : y;				\
+	return (0.0 <= x) ? y : __builtin_nan("");			\
+}
+
+#define MATHFN_POW							\
+double mathfn_pow(double x, double y) {					\
+	double a, c, r;							\
+	int i, integral, odd;						\
+	a = mathfn_exp(y * mathfn_log(__builtin_fabs(x)));		\
+	c = (y == y) ? y : 0.0;						\
+	c = (c < -2147483648.0) ? -2147483648.0 : c;			\
+	c = (c > 2147483647.0) ? 2147483647.0 : c;			\
+	i = (int)c;							\
+	integral = ((double)i == y) ||					\
+		(2147483648.0 <= __builtin_fabs(y));			\
+	odd = ((double)i == y) && (i & 1);				\
+	r = odd ? -a : a;						\
+	r = integral ? r : __builtin_nan("");				\
+	r = (x < 0.0) ? r : a;						\
+	r = (__builtin_inf() == __builtin_fabs(y)) && (-1.0 == x) ?	\
+		1.0 : r;						\
+	return ((0.0 == y) || (1.0 == x)) ? 1.0 : r;			\
+}
+
+#define MATHFN_TEXT_(...) #__VA_ARGS__
+#define MATHFN_TEXT(m) MATHFN_TEXT_(m)
+
+double mathfn_exp(double x);
+
+double mathfn_log(double x);
+
+double mathfn_pow(double x, double y);
+
+#endif /* _MATHFN_H_ */
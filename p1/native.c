@@ -0,0 +1,624 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * native.c
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <math.h>
+#include "sigmoid.h"
+#include "mathfn.h"
+#include "native.h"
+
+/**
+ * Needs:
+ *   mmap()
+ *   mprotect()
+ *   munmap()
+ */
+
+/**
+ * Code shape: the expression is evaluated as a stack machine whose stack
+ * lives in xmm0..xmm12; the operand at depth d sits in xmm<d>, and depths
+ * beyond the register file spill to 8-byte slots below rbp. xmm13..xmm15
+ * are scratch. The result ends up in xmm0 and evaluate() tail calls
+ * sigmoid().
+ *
+ * A node with several parents is computed once; its value is saved to a
+ * frame slot of its own (below the spill slots) and reloaded at every
+ * later use. Constants and variables are cheaper to rematerialize and are
+ * never saved. Variables are read straight from x (rdi).
+ *
+ * sqrt, abs, min and max are single instructions, and so is fma where the
+ * processor has FMA. exp, log, pow, and fma elsewhere, call the host's
+ * mathfn.h kernels and libm's fma(): the live stack registers and rdi are
+ * saved to frame slots of their own (below the shared slots) around every
+ * call, since the callee may clobber them all.
+ */
+
+#define NREG  13
+#define XMM_T 13
+#define XMM_A 14
+#define XMM_B 15
+
+/* SSE2 scalar double opcodes (0F xx) */
+
+#define OP_MOVSD_LOAD  0x10
+#define OP_MOVSD_STORE 0x11
+#define OP_SQRTSD      0x51
+#define OP_ANDPD       0x54
+#define OP_XORPD       0x57
+#define OP_ADDSD       0x58
+#define OP_MULSD       0x59
+#define OP_SUBSD       0x5c
+#define OP_MINSD       0x5d
+#define OP_DIVSD       0x5e
+#define OP_MAXSD       0x5f
+#define OP_CMPSD       0xc2
+
+#define PREFIX_F2 0xf2
+#define PREFIX_66 0x66
+
+#define RBP 5
+#define RDI 7 /* x, the first argument of evaluate() */
+
+#define CMP_NEQ 4 /* unordered or not equal, matches C's truth of a double */
+
+#define MAX_FRAME (1024 * 1024)
+
+struct frame {
+	uint32_t i; /* node id */
+	int d; /* stack depth that receives the value of node i */
+	int expanded; /* BOOL: children pushed */
+};
+
+struct emitter {
+	const struct parser_dag *dag;
+	int err;
+	int fma; /* BOOL: the processor has FMA */
+	int calls; /* BOOL: the code calls out, see call() */
+	int depth; /* deepest stack depth */
+	int nspill; /* spill slots */
+	int nshare; /* slots of shared nodes */
+	size_t size;
+	size_t capacity;
+	uint8_t *buf;
+	uint32_t *refs; /* by id: number of parents */
+	int32_t *share; /* by id: slot of a shared node */
+	char *done; /* by id: shared node already computed */
+	struct frame *frames;
+};
+
+static void
+emit(struct emitter *e, const void *p, size_t n)
+{
+	uint8_t *buf;
+	size_t m;
+
+	if (e->err) {
+		return;
+	}
+	if ((e->size + n) > e->capacity) {
+		m = e->capacity ? (2 * e->capacity) : 256;
+		while ((e->size + n) > m) {
+			m *= 2;
+		}
+		if (!(buf = realloc(e->buf, m))) {
+			TRACE("out of memory");
+			e->err = 1;
+			return;
+		}
+		e->buf = buf;
+		e->capacity = m;
+	}
+	memcpy(e->buf + e->size, p, n);
+	e->size += n;
+}
+
+static void
+emit8(struct emitter *e, int b)
+{
+	uint8_t b_;
+
+	b_ = (uint8_t)b;
+	emit(e, &b_, 1);
+}
+
+static void
+emit32(struct emitter *e, int32_t v)
+{
+	emit(e, &v, sizeof (v)); /* little endian */
+}
+
+static void
+emit64(struct emitter *e, uint64_t v)
+{
+	emit(e, &v, sizeof (v)); /* little endian */
+}
+
+/**
+ * prefix [REX] 0F op ModRM(reg, rm) -- register to register
+ */
+
+static void
+sse_rr(struct emitter *e, int prefix, int op, int reg, int rm)
+{
+	if (prefix) {
+		emit8(e, prefix);
+	}
+	if ((8 <= reg) || (8 <= rm)) {
+		emit8(e, 0x40 | ((8 <= reg) << 2) | (8 <= rm));
+	}
+	emit8(e, 0x0f);
+	emit8(e, op);
+	emit8(e, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/**
+ * prefix [REX] 0F op ModRM(reg, [base + disp32]), base one of rbp or rdi
+ */
+
+static void
+sse_mem(struct emitter *e, int prefix, int op, int reg, int base, int32_t disp)
+{
+	emit8(e, prefix);
+	if (8 <= reg) {
+		emit8(e, 0x44);
+	}
+	emit8(e, 0x0f);
+	emit8(e, op);
+	emit8(e, 0x80 | ((reg & 7) << 3) | base);
+	emit32(e, disp);
+}
+
+/**
+ * vfmadd213sd a, b, c -- a = a * b + c, rounded once
+ */
+
+static void
+fma213(struct emitter *e, int a, int b, int c)
+{
+	emit8(e, 0xc4); /* VEX, three bytes */
+	emit8(e, ((8 > a) << 7) | 0x40 | ((8 > c) << 5) | 0x02); /* 0F38 */
+	emit8(e, 0x80 | ((~b & 15) << 3) | 0x01); /* W1, vvvv = b, 66 */
+	emit8(e, 0xa9);
+	emit8(e, 0xc0 | ((a & 7) << 3) | (c & 7));
+}
+
+/**
+ * mov [rbp + disp32], rdi (op 0x89) or mov rdi, [rbp + disp32] (op 0x8b)
+ */
+
+static void
+rdi_mem(struct emitter *e, int op, int32_t disp)
+{
+	emit8(e, 0x48);
+	emit8(e, op);
+	emit8(e, 0x80 | (RDI << 3) | RBP);
+	emit32(e, disp);
+}
+
+/**
+ * mov rax, imm64 ; movq xmm, rax
+ */
+
+static void
+load_imm(struct emitter *e, int xmm, uint64_t bits)
+{
+	emit8(e, 0x48);
+	emit8(e, 0xb8);
+	emit64(e, bits);
+	emit8(e, PREFIX_66);
+	emit8(e, 0x48 | ((8 <= xmm) << 2));
+	emit8(e, 0x0f);
+	emit8(e, 0x6e);
+	emit8(e, 0xc0 | ((xmm & 7) << 3));
+}
+
+static int32_t
+slot(int d)
+{
+	return -8 * (d - NREG + 1);
+}
+
+static int32_t
+share_slot(const struct emitter *e, uint32_t i)
+{
+	return -8 * (e->nspill + 1 + e->share[i]);
+}
+
+/**
+ * Slots 0 .. NREG - 1 save xmm0 .. xmm12 and slot NREG saves rdi.
+ */
+
+static int32_t
+save_slot(const struct emitter *e, int i)
+{
+	return -8 * (e->nspill + e->nshare + 1 + i);
+}
+
+static int
+fetch(struct emitter *e, int d, int scratch)
+{
+	if (NREG > d) {
+		return d;
+	}
+	sse_mem(e, PREFIX_F2, OP_MOVSD_LOAD, scratch, RBP, slot(d));
+	return scratch;
+}
+
+static int
+target(int d, int scratch)
+{
+	return (NREG > d) ? d : scratch;
+}
+
+static void
+spill(struct emitter *e, int d, int xmm)
+{
+	if (NREG <= d) {
+		sse_mem(e, PREFIX_F2, OP_MOVSD_STORE, xmm, RBP, slot(d));
+	}
+}
+
+static int /* BOOL */
+leaf(const struct emitter *e, uint32_t i)
+{
+	return (PARSER_DAG_VAL == e->dag->op[i]) ||
+		(PARSER_DAG_VAR == e->dag->op[i]);
+}
+
+static void
+census(struct emitter *e)
+{
+	const struct parser_dag *dag;
+	uint32_t i;
+
+	dag = e->dag;
+	for (i=1; i<=dag->n; ++i) {
+		if (leaf(e, i)) {
+			continue;
+		}
+		++e->refs[dag->left[i]]; /* refs[0] counts absent children */
+		++e->refs[dag->right[i]];
+		++e->refs[dag->addend[i]];
+		if ((PARSER_DAG_EXP == dag->op[i]) ||
+		    (PARSER_DAG_LOG == dag->op[i]) ||
+		    (PARSER_DAG_POW == dag->op[i]) ||
+		    ((PARSER_DAG_FMA == dag->op[i]) && !e->fma)) {
+			e->calls = 1;
+		}
+	}
+}
+
+static int /* BOOL */
+shared(const struct emitter *e, uint32_t i)
+{
+	return !leaf(e, i) && (1 < e->refs[i]);
+}
+
+/**
+ * Calls visit on the nodes in the order the code computes them: children
+ * before parents and left before right, with a shared node a leaf at every
+ * use but its first. The walk keeps its own stack of frames, every node is
+ * expanded at most once and pushes at most three children, so deep
+ * expressions do not exhaust the C stack.
+ */
+
+static void
+walk(struct emitter *e, void (*visit)(struct emitter *e, uint32_t i, int d))
+{
+	const struct parser_dag *dag;
+	struct frame *frame;
+	uint32_t i;
+	size_t k;
+	int d;
+
+	dag = e->dag;
+	k = 0;
+	e->frames[k].i = dag->n;
+	e->frames[k].d = 0;
+	e->frames[k].expanded = 0;
+	++k;
+	while (k) {
+		frame = &e->frames[k - 1];
+		i = frame->i;
+		d = frame->d;
+		if (frame->expanded ||
+		    leaf(e, i) ||
+		    (shared(e, i) && e->done[i])) {
+			--k;
+			visit(e, i, d);
+			continue;
+		}
+		frame->expanded = 1;
+		if (dag->addend[i]) {
+			e->frames[k].i = dag->addend[i];
+			e->frames[k].d = d + 2;
+			e->frames[k].expanded = 0;
+			++k;
+		}
+		e->frames[k].i = dag->right[i];
+		e->frames[k].d = dag->left[i] ? (d + 1) : d; /* unary: right */
+		e->frames[k].expanded = 0;
+		++k;
+		if (dag->left[i]) {
+			e->frames[k].i = dag->left[i];
+			e->frames[k].d = d;
+			e->frames[k].expanded = 0;
+			++k;
+		}
+	}
+}
+
+static void
+depth(struct emitter *e, uint32_t i, int d)
+{
+	e->depth = (e->depth < d) ? d : e->depth;
+	if (shared(e, i) && !e->done[i]) {
+		e->done[i] = 1;
+		e->share[i] = e->nshare++;
+	}
+}
+
+/**
+ * Calls fn with the n operands at depths d .. d + n - 1 as its arguments
+ * and returns the register that receives the result, for depth d.
+ */
+
+static int
+call(struct emitter *e, int d, int n, uint64_t fn)
+{
+	int i, live, a;
+
+	live = (NREG < d) ? NREG : d;
+	for (i=0; i<live; ++i) {
+		sse_mem(e, PREFIX_F2, OP_MOVSD_STORE, i, RBP, save_slot(e, i));
+	}
+	rdi_mem(e, 0x89, save_slot(e, NREG));
+	for (i=0; i<n; ++i) {
+		if (NREG <= (d + i)) {
+			sse_mem(e, PREFIX_F2, OP_MOVSD_LOAD, i, RBP, slot(d + i));
+		}
+		else if (d) {
+			sse_rr(e, PREFIX_F2, OP_MOVSD_LOAD, i, d + i);
+		}
+	}
+
+	/* mov rax, fn ; call rax */
+
+	emit8(e, 0x48);
+	emit8(e, 0xb8);
+	emit64(e, fn);
+	emit8(e, 0xff);
+	emit8(e, 0xd0);
+	rdi_mem(e, 0x8b, save_slot(e, NREG));
+	a = target(d, XMM_A);
+	if (a) {
+		sse_rr(e, PREFIX_F2, OP_MOVSD_LOAD, a, 0);
+	}
+	for (i=0; i<live; ++i) {
+		sse_mem(e, PREFIX_F2, OP_MOVSD_LOAD, i, RBP, save_slot(e, i));
+	}
+	return a;
+}
+
+static void
+node(struct emitter *e, uint32_t i, int d)
+{
+	union { double d; uint64_t u; } imm;
+	unsigned op;
+	int a, b, c;
+
+	op = e->dag->op[i];
+
+	if (shared(e, i) && e->done[i]) {
+		a = target(d, XMM_A);
+		sse_mem(e,
+			PREFIX_F2,
+			OP_MOVSD_LOAD,
+			a,
+			RBP,
+			share_slot(e, i));
+		spill(e, d, a);
+		return;
+	}
+	if (PARSER_DAG_VAL == op) {
+		imm.d = e->dag->pool[e->dag->left[i]];
+		a = target(d, XMM_A);
+		load_imm(e, a, imm.u);
+	}
+	else if (PARSER_DAG_VAR == op) {
+		a = target(d, XMM_A);
+		sse_mem(e,
+			PREFIX_F2,
+			OP_MOVSD_LOAD,
+			a,
+			RDI,
+			(int32_t)(8 * e->dag->left[i]));
+	}
+	else if (PARSER_DAG_NEG == op) {
+		a = fetch(e, d, XMM_A);
+		load_imm(e, XMM_T, 0x8000000000000000ULL);
+		sse_rr(e, PREFIX_66, OP_XORPD, a, XMM_T);
+	}
+	else if (PARSER_DAG_ABS == op) {
+		a = fetch(e, d, XMM_A);
+		load_imm(e, XMM_T, 0x7fffffffffffffffULL);
+		sse_rr(e, PREFIX_66, OP_ANDPD, a, XMM_T);
+	}
+	else if (PARSER_DAG_SQRT == op) {
+		a = fetch(e, d, XMM_A);
+		sse_rr(e, PREFIX_F2, OP_SQRTSD, a, a);
+	}
+	else if (PARSER_DAG_EXP == op) {
+		a = call(e, d, 1, (uint64_t)(uintptr_t)mathfn_exp);
+	}
+	else if (PARSER_DAG_LOG == op) {
+		a = call(e, d, 1, (uint64_t)(uintptr_t)mathfn_log);
+	}
+	else if (PARSER_DAG_POW == op) {
+		a = call(e, d, 2, (uint64_t)(uintptr_t)mathfn_pow);
+	}
+	else if ((PARSER_DAG_FMA == op) && !e->fma) {
+		a = call(e, d, 3, (uint64_t)(uintptr_t)fma);
+	}
+	else if (PARSER_DAG_FMA == op) {
+		a = fetch(e, d, XMM_A);
+		b = fetch(e, d + 1, XMM_B);
+		c = fetch(e, d + 2, XMM_T);
+		fma213(e, a, b, c);
+	}
+	else {
+		a = fetch(e, d, XMM_A);
+		b = fetch(e, d + 1, XMM_B);
+		if (PARSER_DAG_MUL == op) {
+			sse_rr(e, PREFIX_F2, OP_MULSD, a, b);
+		}
+		else if (PARSER_DAG_DIV == op) {
+			/* a = (b != 0) ? a / b : 0.0, without a branch */
+			sse_rr(e, PREFIX_66, OP_XORPD, XMM_T, XMM_T);
+			sse_rr(e, PREFIX_F2, OP_CMPSD, XMM_T, b);
+			emit8(e, CMP_NEQ);
+			sse_rr(e, PREFIX_F2, OP_DIVSD, a, b);
+			sse_rr(e, PREFIX_66, OP_ANDPD, a, XMM_T);
+		}
+		else if (PARSER_DAG_ADD == op) {
+			sse_rr(e, PREFIX_F2, OP_ADDSD, a, b);
+		}
+		else if (PARSER_DAG_SUB == op) {
+			sse_rr(e, PREFIX_F2, OP_SUBSD, a, b);
+		}
+		else if (PARSER_DAG_MIN == op) {
+			sse_rr(e, PREFIX_F2, OP_MINSD, a, b); /* a < b ? a : b */
+		}
+		else if (PARSER_DAG_MAX == op) {
+			sse_rr(e, PREFIX_F2, OP_MAXSD, a, b); /* a > b ? a : b */
+		}
+		else {
+			EXIT("software");
+		}
+	}
+	spill(e, d, a);
+	if (shared(e, i)) {
+		e->done[i] = 1;
+		sse_mem(e,
+			PREFIX_F2,
+			OP_MOVSD_STORE,
+			a,
+			RBP,
+			share_slot(e, i));
+	}
+}
+
+static void
+emitter_free(struct emitter *e)
+{
+	FREE(e->buf);
+	FREE(e->refs);
+	FREE(e->share);
+	FREE(e->done);
+	FREE(e->frames);
+}
+
+void *
+native_compile(const struct parser_dag *dag, size_t *size)
+{
+	struct emitter e;
+	int32_t frame;
+	size_t n, m;
+	void *p;
+
+	assert( dag && size );
+
+	memset(&e, 0, sizeof (struct emitter));
+	e.dag = dag;
+	e.fma = __builtin_cpu_supports("fma");
+	n = (size_t)dag->n + 1;
+	if (!(e.refs = malloc(n * sizeof (e.refs[0]))) ||
+	    !(e.share = malloc(n * sizeof (e.share[0]))) ||
+	    !(e.done = malloc(n)) ||
+	    !(e.frames = malloc((3 * n + 1) * sizeof (e.frames[0])))) {
+		emitter_free(&e);
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(e.refs, 0, n * sizeof (e.refs[0]));
+	memset(e.done, 0, n);
+	census(&e);
+	++e.refs[dag->n];
+	walk(&e, depth);
+	e.nspill = e.depth - NREG + 1;
+	e.nspill = (0 < e.nspill) ? e.nspill : 0;
+	memset(e.done, 0, n);
+	m = (size_t)e.nspill + (size_t)e.nshare + (e.calls ? (NREG + 1) : 0);
+	if (MAX_FRAME < (8 * m)) {
+		emitter_free(&e);
+		TRACE("expression too large for the native backend");
+		return NULL;
+	}
+	frame = (int32_t)((8 * m + 15) & ~(size_t)15);
+
+	/* push rbp ; mov rbp, rsp ; sub rsp, frame */
+
+	emit8(&e, 0x55);
+	emit8(&e, 0x48);
+	emit8(&e, 0x89);
+	emit8(&e, 0xe5);
+	if (frame) {
+		emit8(&e, 0x48);
+		emit8(&e, 0x81);
+		emit8(&e, 0xec);
+		emit32(&e, frame);
+	}
+	walk(&e, node);
+
+	/* leave ; mov rax, sigmoid ; jmp rax */
+
+	emit8(&e, 0xc9);
+	emit8(&e, 0x48);
+	emit8(&e, 0xb8);
+	emit64(&e, (uint64_t)(uintptr_t)sigmoid);
+	emit8(&e, 0xff);
+	emit8(&e, 0xe0);
+	if (e.err) {
+		emitter_free(&e);
+		TRACE(0);
+		return NULL;
+	}
+
+	/* W^X: write into a private mapping, then flip it to read/execute */
+
+	n = (e.size + page_size() - 1) & ~(page_size() - 1);
+	p = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+		 -1, 0);
+	if (MAP_FAILED == p) {
+		emitter_free(&e);
+		TRACE("mmap()");
+		return NULL;
+	}
+	memcpy(p, e.buf, e.size);
+	emitter_free(&e);
+	if (mprotect(p, n, PROT_READ | PROT_EXEC)) {
+		munmap(p, n);
+		TRACE("mprotect()");
+		return NULL;
+	}
+	*size = n;
+	return p;
+}
+
+void
+native_free(void *code, size_t size)
+{
+	if (code) {
+		if (munmap(code, size)) {
+			TRACE("munmap()");
+		}
+	}
+}
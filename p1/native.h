@@ -0,0 +1,39 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * native.h
+ */
+
+#ifndef _NATIVE_H_
+#define _NATIVE_H_
+
+#include "system.h"
+#include "parser.h"
+
+/**
+ * Translates dag directly into x86-64 (SSE2 scalar double) machine code with
+ * the same semantics as the C program written by codegen(). The code is
+ * assembled in private memory and then copied into a fresh mapping that is
+ * never writable and executable at the same time.
+ *
+ * dag : the parsed expression
+ * size: receives the length of the mapping, to be passed to native_free()
+ *
+ * return: the entry point of evaluate() (see evaluate_t) or NULL on error
+ */
+
+void *native_compile(const struct parser_dag *dag, size_t *size);
+
+/**
+ * Unmaps code previously returned by native_compile().
+ *
+ * code: the entry point returned by native_compile(), may be NULL
+ * size: the length returned by native_compile()
+ */
+
+void native_free(void *code, size_t size);
+
+#endif /* _NATIVE_H_ */
@@ -7,22 +7,12 @@
  * parser.c
  */
 
+#include <math.h>
+#include "mathfn.h"
+#include "arena.h"
 #include "lexer.h"
 #include "parser.h"
 
-#define MKD(p,d,o)					\
-	do {						\
-		size_t n = sizeof (struct parser_dag);	\
-		if (!((d) = malloc(n))) {		\
-			TRACE("out of memory");		\
-			return NULL;			\
-		}					\
-		memset((d), 0, n);			\
-		(d)->op = (o);				\
-		(d)->id = ++(p)->id;			\
-	}						\
-	while (0)
-
 #define TRACE_ONCE(p,m)				\
 	do {					\
 		if (!(p)->stop) {		\
@@ -31,266 +21,664 @@
 		}				\
 	} while (0)
 
+static const struct {
+	const char *name;
+	enum parser_dag_op op;
+	uint64_t arity;
+} FUNCTION[] = {
+	{ "exp", PARSER_DAG_EXP, 1 },
+	{ "log", PARSER_DAG_LOG, 1 },
+	{ "sqrt", PARSER_DAG_SQRT, 1 },
+	{ "abs", PARSER_DAG_ABS, 1 },
+	{ "pow", PARSER_DAG_POW, 2 },
+	{ "min", PARSER_DAG_MIN, 2 },
+	{ "max", PARSER_DAG_MAX, 2 },
+	{ "fma", PARSER_DAG_FMA, 3 }
+};
+
+/**
+ * Nodes are hash-consed: every node id lives in an open-addressing table
+ * keyed by (op, constant, left, right, addend), and a node is created only
+ * if no equal node exists. Since children are themselves unique, comparing
+ * their ids is enough, and equal subexpressions end up sharing one node.
+ * Constants compare by their bits, so -0.0 and 0.0 stay apart.
+ *
+ * The node arrays grow by doubling while parsing and are trimmed to size,
+ * and the table released, once the expression is complete. Variable names
+ * are carved out of the parser's arena, which parser_close() releases in
+ * one call.
+ */
+
 struct parser {
-	int id; /* global id */
 	int stop;
 	uint64_t i; /* current token */
 	uint64_t n; /* total tokens */
+	uint64_t capacity; /* table slots, a power of two */
+	uint64_t nvars;
+	char **vars;
+	uint32_t *table; /* node ids, 0 for an empty slot */
+	uint64_t cnodes; /* entries of the node arrays */
+	uint8_t *op;
+	uint32_t *left;
+	uint32_t *right;
+	uint32_t *addend;
+	uint64_t npool;
+	uint64_t cpool;
+	double *pool;
+	uint64_t noperands;
+	uint64_t coperands;
+	uint32_t *operands;
+	uint64_t noperators;
+	uint64_t coperators;
+	enum parser_dag_op *operators;
+	uint64_t nmarks;
+	uint64_t cmarks;
+	uint64_t *marks; /* per open call: the operand stack height at '(' */
+	struct arena *arena;
 	struct lexer *lexer;
-	struct parser_dag *dag;
+	struct parser_dag dag;
+	const char *map; /* parser_load(): the file, holding the nodes */
+	size_t mapsize;
+	unsigned optimized; /* 1 + the flags of parser_optimize(), 0 if none */
 };
 
-static void
-free_dag(struct parser_dag *dag)
+static uint64_t
+hash(enum parser_dag_op op,
+     uint64_t val,
+     uint32_t left,
+     uint32_t right,
+     uint32_t addend)
 {
-	if (dag) {
-		free_dag(dag->left);
-		free_dag(dag->right);
-	}
-	FREE(dag);
+	uint64_t h;
+
+	h = (uint64_t)op;
+	h = (h ^ val) * 0x9e3779b97f4a7c15ULL;
+	h = (h ^ (uint64_t)left) * 0x9e3779b97f4a7c15ULL;
+	h = (h ^ (uint64_t)right) * 0x9e3779b97f4a7c15ULL;
+	h = (h ^ (uint64_t)addend) * 0x9e3779b97f4a7c15ULL;
+
+	/*
+	 * The low bits of a product depend only on the low bits of its
+	 * factors, and constants such as 12.25 have all-zero low mantissa
+	 * bits; fold the high bits down before the table masks them off.
+	 */
+
+	h = (h ^ (h >> 33)) * 0xff51afd7ed558ccdULL;
+	h = (h ^ (h >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+	return h ^ (h >> 33);
 }
 
-static const struct lexer_token *
-next(const struct parser *parser)
+/**
+ * The bits of the constant of node id, 0 if it is not a constant.
+ */
+
+static uint64_t
+bits(const struct parser *parser, uint32_t id)
 {
-	static const struct lexer_token SENTINEL = { LEXER_OP_, 0.0 };
+	uint64_t v;
 
-	if (parser->i < parser->n) {
-		return lexer_lookup(parser->lexer, parser->i);
+	if (PARSER_DAG_VAL != parser->op[id]) {
+		return 0;
 	}
-	return &SENTINEL;
+	memcpy(&v, &parser->pool[parser->left[id]], sizeof (v));
+	return v;
 }
 
-static int /* BOOL */
-match(const struct parser *parser, enum lexer_token_op op)
+static uint64_t
+hash_id(const struct parser *parser, uint32_t id)
 {
-	const struct lexer_token *token;
+	return hash((enum parser_dag_op)parser->op[id],
+		    bits(parser, id),
+		    (PARSER_DAG_VAL == parser->op[id]) ? 0 : parser->left[id],
+		    parser->right[id],
+		    parser->addend[id]);
+}
 
-	if ((token = next(parser)) && (op == token->op)) {
-		return 1;
+static int /* BOOL */
+equal(const struct parser *parser,
+      uint32_t id,
+      enum parser_dag_op op,
+      uint64_t val,
+      uint32_t left,
+      uint32_t right,
+      uint32_t addend)
+{
+	if (op != parser->op[id]) {
+		return 0;
 	}
-	return 0;
+	if (PARSER_DAG_VAL == op) {
+		return val == bits(parser, id);
+	}
+	return (left == parser->left[id]) &&
+		(right == parser->right[id]) &&
+		(addend == parser->addend[id]);
 }
 
-static void
-forward(struct parser *parser)
+static int
+grow(struct parser *parser)
 {
-	if (parser->i < parser->n) {
-		++parser->i;
+	uint64_t i, j, capacity;
+	uint32_t *table, id;
+
+	capacity = parser->capacity ? (2 * parser->capacity) : 1024;
+	if (!(table = malloc(capacity * sizeof (table[0])))) {
+		TRACE("out of memory");
+		return -1;
 	}
+	memset(table, 0, capacity * sizeof (table[0]));
+	for (i=0; i<parser->capacity; ++i) {
+		if ((id = parser->table[i])) {
+			j = hash_id(parser, id);
+			while (table[j & (capacity - 1)]) {
+				++j;
+			}
+			table[j & (capacity - 1)] = id;
+		}
+	}
+	FREE(parser->table);
+	parser->table = table;
+	parser->capacity = capacity;
+	return 0;
 }
 
 /**
- * expr_primary : VAL
- *              | '(' expr ')'
+ * Resizes the node arrays to n entries, ids 0 .. n - 1.
  */
 
-static struct parser_dag *expr(struct parser *parser);
-
-static struct parser_dag *
-expr_primary(struct parser *parser)
+static int
+resize(struct parser *parser, uint64_t n)
 {
-	struct parser_dag *dag;
+	void *p;
 
-	dag = NULL;
-	if (match(parser, LEXER_OP_VAL)) {
-		MKD(parser, dag, PARSER_DAG_VAL);
-		dag->val = next(parser)->val;
-		forward(parser);
+	if (!(p = realloc(parser->op, n * sizeof (parser->op[0])))) {
+		TRACE("out of memory");
+		return -1;
 	}
-	else if (match(parser, LEXER_OP_OPEN)) {
-		forward(parser);
-		if (!(dag = expr(parser))) {
-			TRACE_ONCE(parser, "invalid sub-expression");
-			return NULL;
-		}
-		if (!match(parser, LEXER_OP_CLOSE)) {
-			TRACE_ONCE(parser, "expecting ')'");
-			return NULL;
-		}
-		forward(parser);
+	parser->op = p;
+	if (!(p = realloc(parser->left, n * sizeof (parser->left[0])))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	parser->left = p;
+	if (!(p = realloc(parser->right, n * sizeof (parser->right[0])))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	parser->right = p;
+	if (!(p = realloc(parser->addend, n * sizeof (parser->addend[0])))) {
+		TRACE("out of memory");
+		return -1;
 	}
-	return dag;
+	parser->addend = p;
+	parser->cnodes = n;
+	return 0;
 }
 
 /**
- * expr_unary : [ '+' '-' ] exr_unary
- *            | expr_primary
+ * Makes room for one more item in a stack of item bytes each.
  */
 
-static struct parser_dag *
-expr_unary(struct parser *parser)
+static int
+reserve(void **items, uint64_t *capacity, uint64_t size, size_t item)
 {
-	struct parser_dag *dag;
+	uint64_t n;
+	void *p;
 
-	dag = NULL;
-	if (match(parser, LEXER_OP_ADD)) {
-		forward(parser);
-		if (!(dag = expr_unary(parser))) {
-			TRACE_ONCE(parser, "invalid unary '+' operand");
-			return NULL;
-		}
-	}
-	else if (match(parser, LEXER_OP_SUB)) {
-		MKD(parser, dag, PARSER_DAG_NEG);
-		forward(parser);
-		if (!(dag->right = expr_unary(parser))) {
-			TRACE_ONCE(parser, "invalid unary '-' operand");
-			return NULL;
-		}
+	if (size < (*capacity)) {
+		return 0;
 	}
-	else {
-		dag = expr_primary(parser);
+	n = (*capacity) ? (2 * (*capacity)) : 64;
+	if (!(p = realloc(*items, n * item))) {
+		TRACE("out of memory");
+		return -1;
 	}
-	return dag;
+	*items = p;
+	*capacity = n;
+	return 0;
 }
 
 /**
- * expr_multiplicative_ : { [ '*' '/' ] expr_unary expr_multiplicative_ }
- *                      | ∅
- *
- * expr_multiplicative : expr_unary expr_multiplicative_
+ * Returns the id of the node (op, val, left, right, addend), made if new,
+ * or 0 on error. val is the value of a constant; variables pass their
+ * number as left.
  */
 
-static struct parser_dag *
-expr_multiplicative_(struct parser *parser, struct parser_dag *left)
+static uint32_t
+mkdag(struct parser *parser,
+      enum parser_dag_op op,
+      double val,
+      uint32_t left,
+      uint32_t right,
+      uint32_t addend)
 {
-	const char * const TBL[] = { "*", "/" };
-	struct parser_dag *dag;
-	char buf[64];
+	uint64_t i, v;
+	uint32_t id;
 
-	dag = left;
-	for (;;) {
-		if (match(parser, LEXER_OP_MUL)) {
-			MKD(parser, dag, PARSER_DAG_MUL);
-			dag->left = left;
-			forward(parser);
+	if ((2 * (uint64_t)parser->dag.n) >= parser->capacity) {
+		if (grow(parser)) {
+			TRACE(0);
+			return 0;
 		}
-		else if (match(parser, LEXER_OP_DIV)) {
-			MKD(parser, dag, PARSER_DAG_DIV);
-			dag->left = left;
-			forward(parser);
-		}
-		else {
-			break;
+	}
+	v = 0;
+	if (PARSER_DAG_VAL == op) {
+		memcpy(&v, &val, sizeof (v));
+	}
+	i = hash(op, v, left, right, addend);
+	while ((id = parser->table[i & (parser->capacity - 1)])) {
+		if (equal(parser, id, op, v, left, right, addend)) {
+			return id;
 		}
-		if (!(dag->right = expr_unary(parser))) {
-			safe_sprintf(buf,
-				     sizeof (buf),
-				     "invalid '%s' operand",
-				     TBL[dag->op - PARSER_DAG_MUL]);
-			TRACE_ONCE(parser, buf);
-			return NULL;
+		++i;
+	}
+	if (UINT32_MAX == parser->dag.n) {
+		TRACE("expression too large");
+		return 0;
+	}
+	if ((((uint64_t)parser->dag.n + 2) > parser->cnodes) &&
+	    resize(parser, parser->cnodes ? (2 * parser->cnodes) : 1024)) {
+		TRACE(0);
+		return 0;
+	}
+	if (PARSER_DAG_VAL == op) {
+		if (reserve((void **)&parser->pool,
+			    &parser->cpool,
+			    parser->npool,
+			    sizeof (parser->pool[0]))) {
+			TRACE(0);
+			return 0;
 		}
-		if (!(dag = expr_multiplicative_(parser, dag))) {
-			TRACE_ONCE(parser, 0);
-			return NULL;
+		parser->pool[parser->npool] = val;
+		left = (uint32_t)parser->npool++;
+	}
+	id = ++parser->dag.n;
+	parser->op[id] = (uint8_t)op;
+	parser->left[id] = left;
+	parser->right[id] = right;
+	parser->addend[id] = addend;
+	parser->table[i & (parser->capacity - 1)] = id;
+	return id;
+}
+
+static const struct lexer_token *
+peek(const struct parser *parser, uint64_t k)
+{
+	static const struct lexer_token SENTINEL = { LEXER_OP_, 0.0, NULL, 0 };
+
+	if ((parser->i + k) < parser->n) {
+		return lexer_lookup(parser->lexer, parser->i + k);
+	}
+	return &SENTINEL;
+}
+
+static const struct lexer_token *
+next(const struct parser *parser)
+{
+	return peek(parser, 0);
+}
+
+static void
+forward(struct parser *parser)
+{
+	if (parser->i < parser->n) {
+		++parser->i;
+	}
+}
+
+static int
+variable(struct parser *parser, const struct lexer_token *token, uint32_t *k)
+{
+	uint64_t i;
+	char **vars;
+
+	for (i=0; i<parser->nvars; ++i) {
+		if (!strncmp(parser->vars[i], token->name, token->len) &&
+		    !parser->vars[i][token->len]) {
+			*k = (uint32_t)i;
+			return 0;
 		}
 	}
-	return dag;
+	if (!(vars = realloc(parser->vars, (i + 1) * sizeof (vars[0])))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	parser->vars = vars;
+	if (!(vars[i] = arena_alloc(parser->arena, token->len + 1))) {
+		TRACE(0);
+		return -1;
+	}
+	memcpy(vars[i], token->name, token->len);
+	++parser->nvars;
+	*k = (uint32_t)i;
+	return 0;
 }
 
-static struct parser_dag *
-expr_multiplicative(struct parser *parser)
+static int
+push_operand(struct parser *parser, uint32_t id)
 {
-	struct parser_dag *dag;
+	if (reserve((void **)&parser->operands,
+		    &parser->coperands,
+		    parser->noperands,
+		    sizeof (parser->operands[0]))) {
+		TRACE(0);
+		return -1;
+	}
+	parser->operands[parser->noperands++] = id;
+	return 0;
+}
 
-	if (!(dag = expr_unary(parser))) {
-		return NULL;
+static int
+push_operator(struct parser *parser, enum parser_dag_op op)
+{
+	if (reserve((void **)&parser->operators,
+		    &parser->coperators,
+		    parser->noperators,
+		    sizeof (parser->operators[0]))) {
+		TRACE(0);
+		return -1;
+	}
+	parser->operators[parser->noperators++] = op;
+	return 0;
+}
+
+static int
+push_mark(struct parser *parser)
+{
+	if (reserve((void **)&parser->marks,
+		    &parser->cmarks,
+		    parser->nmarks,
+		    sizeof (parser->marks[0]))) {
+		TRACE(0);
+		return -1;
 	}
-	return expr_multiplicative_(parser, dag);
+	parser->marks[parser->nmarks++] = parser->noperands;
+	return 0;
 }
 
 /**
- * expr_additive_ : { [ '+' '-' ] expr_multiplicative expr_additive_ }
- *                | ∅
- *
- * expr_additive : expr_multiplicative expr_additive_
+ * Returns the number of arguments of a function, 0 for any other operator.
  */
 
-static struct parser_dag *
-expr_additive_(struct parser *parser, struct parser_dag *left)
+static uint64_t
+arity(enum parser_dag_op op)
 {
-	const char * const TBL[] = { "+", "-" };
-	struct parser_dag *dag;
-	char buf[64];
+	size_t i;
 
-	dag = left;
-	for (;;) {
-		if (match(parser, LEXER_OP_ADD)) {
-			MKD(parser, dag, PARSER_DAG_ADD);
-			dag->left = left;
-			forward(parser);
-		}
-		else if (match(parser, LEXER_OP_SUB)) {
-			MKD(parser, dag, PARSER_DAG_SUB);
-			dag->left = left;
-			forward(parser);
-		}
-		else {
-			break;
-		}
-		if (!(dag->right = expr_multiplicative(parser))) {
-			safe_sprintf(buf,
-				     sizeof (buf),
-				     "invalid '%s' operand",
-				     TBL[dag->op - PARSER_DAG_MUL]);
-			TRACE_ONCE(parser, buf);
-			return NULL;
-		}
-		if (!(dag = expr_additive_(parser, dag))) {
-			TRACE_ONCE(parser, 0);
-			return NULL;
+	for (i=0; i<ARRAY_SIZE(FUNCTION); ++i) {
+		if (op == FUNCTION[i].op) {
+			return FUNCTION[i].arity;
 		}
 	}
-	return dag;
+	return 0;
 }
 
-static struct parser_dag *
-expr_additive(struct parser *parser)
+/**
+ * An open parenthesis sits on the operator stack as PARSER_DAG_, and the
+ * open parenthesis of a call as the function's operator, both with the
+ * lowest precedence, so no binary operator reduces past them.
+ */
+
+static int
+precedence(enum parser_dag_op op)
 {
-	struct parser_dag *dag;
+	switch (op) {
+	case PARSER_DAG_NEG: return 3;
+	case PARSER_DAG_MUL:
+	case PARSER_DAG_DIV: return 2;
+	case PARSER_DAG_ADD:
+	case PARSER_DAG_SUB: return 1;
+	default:
+		break;
+	}
+	return 0;
+}
 
-	if (!(dag = expr_multiplicative(parser))) {
-		return NULL;
+/**
+ * Pops the top operator and its operands, pushes the resulting node.
+ */
+
+static int
+reduce(struct parser *parser)
+{
+	enum parser_dag_op op;
+	uint32_t id, left, right;
+
+	op = parser->operators[--parser->noperators];
+	right = parser->operands[--parser->noperands];
+	left = 0;
+	if (PARSER_DAG_NEG != op) {
+		left = parser->operands[--parser->noperands];
 	}
-	return expr_additive_(parser, dag);
+	if (!(id = mkdag(parser, op, 0.0, left, right, 0)) ||
+	    push_operand(parser, id)) {
+		TRACE_ONCE(parser, 0);
+		return -1;
+	}
+	return 0;
 }
 
 /**
- * expr : expr_additive
+ * At the ')' of a call: pops the function and its arguments, pushes the
+ * resulting node. Unary functions take their argument on the right, like
+ * negation.
  */
 
-static struct parser_dag *
-expr(struct parser *parser)
+static int
+call(struct parser *parser)
 {
-	return expr_additive(parser);
+	enum parser_dag_op op;
+	uint32_t id, arg[3];
+	uint64_t i, n;
+
+	op = parser->operators[--parser->noperators];
+	n = parser->noperands - parser->marks[--parser->nmarks];
+	if (n != arity(op)) {
+		TRACE_ONCE(parser, "wrong number of arguments");
+		return -1;
+	}
+	memset(arg, 0, sizeof (arg));
+	for (i=0; i<n; ++i) {
+		arg[i] = parser->operands[parser->noperands - n + i];
+	}
+	parser->noperands -= n;
+	id = (1 == n) ?
+		mkdag(parser, op, 0.0, 0, arg[0], 0) :
+		mkdag(parser, op, 0.0, arg[0], arg[1], arg[2]);
+	if (!id || push_operand(parser, id)) {
+		TRACE_ONCE(parser, 0);
+		return -1;
+	}
+	return 0;
 }
 
 /**
- * top : expr
+ * Pushes the function named by token, followed by '(', as an operator.
  */
 
-static struct parser_dag *
-top(struct parser *parser)
+static int
+function(struct parser *parser, const struct lexer_token *token)
 {
-	struct parser_dag *dag;
+	size_t i;
 
-	if (!(dag = expr(parser))) {
-		TRACE_ONCE(parser, "invalid expression");
-		return NULL;
+	for (i=0; i<ARRAY_SIZE(FUNCTION); ++i) {
+		if ((safe_strlen(FUNCTION[i].name) == token->len) &&
+		    !strncmp(FUNCTION[i].name, token->name, token->len)) {
+			break;
+		}
 	}
-	if (!match(parser, LEXER_OP_)) {
-		TRACE_ONCE(parser, "bogus trailing content");
-		return NULL;
+	if (ARRAY_SIZE(FUNCTION) == i) {
+		TRACE_ONCE(parser, "unknown function");
+		return -1;
+	}
+	if (push_operator(parser, FUNCTION[i].op) || push_mark(parser)) {
+		TRACE_ONCE(parser, 0);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+operand(struct parser *parser, const struct lexer_token *token)
+{
+	uint32_t id, k;
+
+	if (LEXER_OP_VAL == token->op) {
+		id = mkdag(parser, PARSER_DAG_VAL, token->val, 0, 0, 0);
+	}
+	else if (variable(parser, token, &k)) {
+		TRACE_ONCE(parser, 0);
+		return -1;
+	}
+	else {
+		id = mkdag(parser, PARSER_DAG_VAR, 0.0, k, 0, 0);
+	}
+	if (!id || push_operand(parser, id)) {
+		TRACE_ONCE(parser, 0);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * expr    : unary { [ '+' '-' '*' '/' ] unary }
+ * unary   : { [ '+' '-' ] } primary
+ * primary : VAL
+ *         | VAR
+ *         | FUNCTION '(' expr { ',' expr } ')'
+ *         | '(' expr ')'
+ *
+ * where FUNCTION is one of exp, log, sqrt, abs (one argument), pow, min,
+ * max (two) and fma (three), a name that is a variable unless a '('
+ * follows.
+ *
+ * Operator precedence parsing over explicit operand and operator stacks,
+ * so neither the length nor the nesting of an expression is bounded by the
+ * C stack. '*' and '/' bind tighter than '+' and '-', all four associate to
+ * the left, and a unary '-' binds tighter than any of them. Nodes are made
+ * in the same order as a recursive descent would make them, and the last
+ * node made is the root.
+ */
+
+static int
+top(struct parser *parser)
+{
+	const struct lexer_token *token;
+	enum parser_dag_op op;
+	int unary; /* BOOL: expecting an operand */
+
+	unary = 1;
+	for (;;) {
+		token = next(parser);
+		if (unary) {
+			if ((LEXER_OP_VAR == token->op) &&
+			    (LEXER_OP_OPEN == peek(parser, 1)->op)) {
+				if (function(parser, token)) {
+					return -1;
+				}
+				forward(parser); /* '(' */
+			}
+			else if ((LEXER_OP_VAL == token->op) ||
+				 (LEXER_OP_VAR == token->op)) {
+				if (operand(parser, token)) {
+					return -1;
+				}
+				unary = 0;
+			}
+			else if (LEXER_OP_SUB == token->op) {
+				if (push_operator(parser, PARSER_DAG_NEG)) {
+					TRACE_ONCE(parser, 0);
+					return -1;
+				}
+			}
+			else if (LEXER_OP_OPEN == token->op) {
+				if (push_operator(parser, PARSER_DAG_)) {
+					TRACE_ONCE(parser, 0);
+					return -1;
+				}
+			}
+			else if (LEXER_OP_ADD != token->op) {
+				TRACE_ONCE(parser, "expecting an operand");
+				return -1;
+			}
+		}
+		else if ((LEXER_OP_ADD == token->op) ||
+			 (LEXER_OP_SUB == token->op) ||
+			 (LEXER_OP_MUL == token->op) ||
+			 (LEXER_OP_DIV == token->op)) {
+			op = (LEXER_OP_ADD == token->op) ? PARSER_DAG_ADD :
+				(LEXER_OP_SUB == token->op) ? PARSER_DAG_SUB :
+				(LEXER_OP_MUL == token->op) ? PARSER_DAG_MUL :
+				PARSER_DAG_DIV;
+			while (parser->noperators &&
+			       (precedence(op) <=
+				precedence(parser->operators[parser->noperators - 1]))) {
+				if (reduce(parser)) {
+					return -1;
+				}
+			}
+			if (push_operator(parser, op)) {
+				TRACE_ONCE(parser, 0);
+				return -1;
+			}
+			unary = 1;
+		}
+		else if ((LEXER_OP_CLOSE == token->op) ||
+			 (LEXER_OP_COMMA == token->op)) {
+			op = PARSER_DAG_;
+			while (parser->noperators) {
+				op = parser->operators[parser->noperators - 1];
+				if ((PARSER_DAG_ == op) || arity(op)) {
+					break;
+				}
+				if (reduce(parser)) {
+					return -1;
+				}
+			}
+			if (LEXER_OP_COMMA == token->op) {
+				if (!parser->noperators || (PARSER_DAG_ == op)) {
+					TRACE_ONCE(parser, "unexpected ','");
+					return -1;
+				}
+				unary = 1;
+			}
+			else if (!parser->noperators) {
+				TRACE_ONCE(parser, "unbalanced ')'");
+				return -1;
+			}
+			else if (PARSER_DAG_ == op) {
+				--parser->noperators;
+			}
+			else if (call(parser)) {
+				return -1;
+			}
+		}
+		else if (LEXER_OP_ == token->op) {
+			while (parser->noperators) {
+				op = parser->operators[parser->noperators - 1];
+				if ((PARSER_DAG_ == op) || arity(op)) {
+					TRACE_ONCE(parser, "expecting ')'");
+					return -1;
+				}
+				if (reduce(parser)) {
+					return -1;
+				}
+			}
+			assert( parser->operands[0] == parser->dag.n );
+			return 0;
+		}
+		else {
+			TRACE_ONCE(parser, "bogus trailing content");
+			return -1;
+		}
+		forward(parser);
 	}
-	return dag;
 }
 
 struct parser *
 parser_open(const char *s)
 {
 	struct parser *parser;
+	double *p;
 
 	assert( safe_strlen(s) );
 
@@ -299,15 +687,34 @@ parser_open(const char *s)
 		return NULL;
 	}
 	memset(parser, 0, sizeof (struct parser));
-	if (!(parser->lexer = lexer_open(s)) ||
+	if (!(parser->arena = arena_open()) ||
+	    !(parser->lexer = lexer_open(s)) ||
 	    !(parser->n = lexer_size(parser->lexer)) ||
-	    !(parser->dag = top(parser))) {
+	    top(parser) ||
+	    resize(parser, (uint64_t)parser->dag.n + 1)) {
 		parser_close(parser);
 		TRACE(0);
 		return NULL;
 	}
 	lexer_close(parser->lexer);
 	parser->lexer = NULL;
+	FREE(parser->table);
+	FREE(parser->operands);
+	FREE(parser->operators);
+	FREE(parser->marks);
+	parser->op[0] = PARSER_DAG_;
+	parser->left[0] = parser->right[0] = parser->addend[0] = 0;
+	if (parser->npool &&
+	    (p = realloc(parser->pool,
+			 parser->npool * sizeof (parser->pool[0])))) {
+		parser->pool = p;
+	}
+	parser->dag.op = parser->op;
+	parser->dag.left = parser->left;
+	parser->dag.right = parser->right;
+	parser->dag.addend = parser->addend;
+	parser->dag.pool = parser->pool;
+	parser->dag.nvars = (uint32_t)parser->nvars;
 	return parser;
 }
 
@@ -315,8 +722,19 @@ void
 parser_close(struct parser *parser)
 {
 	if (parser) {
-		free_dag(parser->dag);
+		FREE(parser->table);
+		FREE(parser->vars);
+		FREE(parser->op);
+		FREE(parser->left);
+		FREE(parser->right);
+		FREE(parser->addend);
+		FREE(parser->pool);
+		FREE(parser->operands);
+		FREE(parser->operators);
+		FREE(parser->marks);
 		lexer_close(parser->lexer);
+		arena_close(parser->arena);
+		file_unmap(parser->map, parser->mapsize);
 		memset(parser, 0, sizeof (struct parser));
 	}
 	FREE(parser);
@@ -327,5 +745,693 @@ parser_dag(const struct parser *parser)
 {
 	assert( parser );
 
-	return parser->dag;
+	return &parser->dag;
+}
+
+uint64_t
+parser_vars(const struct parser *parser)
+{
+	assert( parser );
+
+	return parser->nvars;
+}
+
+const char *
+parser_var(const struct parser *parser, uint64_t i)
+{
+	assert( parser );
+	assert( i < parser->nvars );
+
+	return parser->vars[i];
+}
+
+/**
+ * Optimization rebuilds the dag bottom-up through mkdag(), rewriting each
+ * node as it is made, so that rewrites see simplified, hash-consed
+ * children, then drops the nodes no longer reachable from the root.
+ *
+ * The exact rewrites preserve every result bit of sigmoid(root) on all
+ * backends. x + 0 and fma(x, y, 0) with a positive 0 turn a -0 x into +0,
+ * which only division can observe, and only when division by zero is
+ * infinite: otherwise division by either zero yields 0, mathfn_log() and
+ * mathfn_pow() treat -0 as 0, min and max compare them equal, and
+ * sigmoid() maps both to 0.5. Those two are thus left alone under
+ * PARSER_OPTIMIZE_IEEE unless PARSER_OPTIMIZE_FAST; with a negative 0 they
+ * are always exact.
+ */
+
+static uint32_t
+mkval(struct parser *parser, double val)
+{
+	return mkdag(parser, PARSER_DAG_VAL, val, 0, 0, 0);
+}
+
+/**
+ * Sets *val to the value of node id if it is a constant.
+ */
+
+static int /* BOOL */
+constant(const struct parser *parser, uint32_t id, double *val)
+{
+	if (!id || (PARSER_DAG_VAL != parser->op[id])) {
+		return 0;
+	}
+	*val = parser->pool[parser->left[id]];
+	return 1;
+}
+
+/**
+ * Evaluates an operator over constants exactly like the backends do, with
+ * division by zero following flags.
+ */
+
+static double
+fold(enum parser_dag_op op, double l, double r, double a, unsigned flags)
+{
+	switch (op) {
+	case PARSER_DAG_NEG: return - r;
+	case PARSER_DAG_MUL: return l * r;
+	case PARSER_DAG_DIV:
+		return (r || (PARSER_OPTIMIZE_IEEE & flags)) ? (l / r) : 0.0;
+	case PARSER_DAG_ADD: return l + r;
+	case PARSER_DAG_SUB: return l - r;
+	case PARSER_DAG_EXP: return mathfn_exp(r);
+	case PARSER_DAG_LOG: return mathfn_log(r);
+	case PARSER_DAG_SQRT: return sqrt(r);
+	case PARSER_DAG_ABS: return fabs(r);
+	case PARSER_DAG_POW: return mathfn_pow(l, r);
+	case PARSER_DAG_MIN: return (l < r) ? l : r;
+	case PARSER_DAG_MAX: return (l > r) ? l : r;
+	case PARSER_DAG_FMA: return fma(l, r, a);
+	default:
+		EXIT("software");
+	}
+	return 0.0;
+}
+
+/**
+ * Whether x / val equals x * (1 / val) for every x: val is a finite power
+ * of two whose reciprocal, possibly subnormal, is exact.
+ */
+
+static int /* BOOL */
+reciprocal(double val, unsigned flags)
+{
+	int e;
+
+	if (!isfinite(val) || !val || !isfinite(1.0 / val)) {
+		return 0;
+	}
+	return (PARSER_OPTIMIZE_FAST & flags) ||
+		(0.5 == fabs(frexp(val, &e)));
+}
+
+/**
+ * Whether x + val equals x for every x, zeros included, as flags see it.
+ */
+
+static int /* BOOL */
+identity(double val, unsigned flags)
+{
+	if (0.0 != val) {
+		return 0;
+	}
+	return signbit(val) ||
+		(PARSER_OPTIMIZE_FAST & flags) ||
+		!(PARSER_OPTIMIZE_IEEE & flags);
+}
+
+/**
+ * Returns the id of the simplest node equal to (op, left, right, addend),
+ * made if new, or 0 on error, as parser_optimize() flags allow.
+ */
+
+static uint32_t
+simplify(struct parser *parser,
+	 enum parser_dag_op op,
+	 uint32_t left,
+	 uint32_t right,
+	 uint32_t addend,
+	 unsigned flags)
+{
+	uint32_t id, l, r;
+	double u, v, w;
+	int fast;
+
+	fast = PARSER_OPTIMIZE_FAST & flags;
+	u = v = w = 0.0;
+	if (constant(parser, right, &v) &&
+	    (!left || constant(parser, left, &u)) &&
+	    (!addend || constant(parser, addend, &w)) &&
+	    ((PARSER_DAG_DIV != op) || v ||
+	     !(PARSER_OPTIMIZE_CHECKED & flags))) {
+		return mkval(parser, fold(op, u, v, w, flags));
+	}
+	l = left ? parser->left[left] : 0;
+	r = left ? parser->right[left] : 0;
+	switch (op) {
+	case PARSER_DAG_NEG:
+		if (PARSER_DAG_NEG == parser->op[right]) {
+			return parser->right[right];
+		}
+		break;
+	case PARSER_DAG_SUB:
+		if (fast && (left == right)) {
+			return mkval(parser, 0.0);
+		}
+		if (constant(parser, right, &v)) {
+			if (!(id = mkval(parser, - v))) {
+				return 0;
+			}
+			return simplify(parser,
+					PARSER_DAG_ADD,
+					left,
+					id,
+					0,
+					flags);
+		}
+		break;
+	case PARSER_DAG_ADD:
+	case PARSER_DAG_MUL:
+		if (constant(parser, left, &u) &&
+		    !constant(parser, right, &v)) {
+			return simplify(parser, op, right, left, 0, flags);
+		}
+		if (constant(parser, right, &v)) {
+			if ((PARSER_DAG_ADD == op) && identity(v, flags)) {
+				return left;
+			}
+			if ((PARSER_DAG_MUL == op) && (1.0 == v)) {
+				return left;
+			}
+			if ((PARSER_DAG_MUL == op) && (-1.0 == v)) {
+				return simplify(parser,
+						PARSER_DAG_NEG,
+						0,
+						left,
+						0,
+						flags);
+			}
+			if ((PARSER_DAG_MUL == op) && fast && (0.0 == v)) {
+				return mkval(parser, 0.0);
+			}
+			if ((PARSER_DAG_MUL == op) &&
+			    (PARSER_DAG_NEG == parser->op[left])) {
+				if (!(id = mkval(parser, - v))) {
+					return 0;
+				}
+				return simplify(parser, op, r, id, 0, flags);
+			}
+			if (fast &&
+			    (op == parser->op[left]) &&
+			    constant(parser, r, &u)) {
+				/* (x + u) + v = x + (u + v) */
+				id = mkval(parser,
+					   fold(op, u, v, 0.0, flags));
+				if (!id) {
+					return 0;
+				}
+				return simplify(parser, op, l, id, 0, flags);
+			}
+		}
+		else if (fast &&
+			 (op == parser->op[left]) &&
+			 constant(parser, r, &u)) {
+			/* (x + u) + y = (x + y) + u, moving constants up */
+			if (!(id = simplify(parser, op, l, right, 0, flags))) {
+				return 0;
+			}
+			return simplify(parser, op, id, r, 0, flags);
+		}
+		break;
+	case PARSER_DAG_DIV:
+		if (constant(parser, right, &v)) {
+			if (0.0 == v) {
+				if ((PARSER_OPTIMIZE_IEEE & flags) ||
+				    (PARSER_OPTIMIZE_CHECKED & flags)) {
+					break;
+				}
+				return mkval(parser, 0.0);
+			}
+			if (1.0 == v) {
+				return left;
+			}
+			if (-1.0 == v) {
+				return simplify(parser,
+						PARSER_DAG_NEG,
+						0,
+						left,
+						0,
+						flags);
+			}
+			if (reciprocal(v, flags)) {
+				if (!(id = mkval(parser, 1.0 / v))) {
+					return 0;
+				}
+				return simplify(parser,
+						PARSER_DAG_MUL,
+						left,
+						id,
+						0,
+						flags);
+			}
+		}
+		break;
+	case PARSER_DAG_ABS:
+		if ((PARSER_DAG_ABS == parser->op[right]) ||
+		    (PARSER_DAG_NEG == parser->op[right])) {
+			return simplify(parser,
+					op,
+					0,
+					parser->right[right],
+					0,
+					flags);
+		}
+		break;
+	case PARSER_DAG_MIN:
+	case PARSER_DAG_MAX:
+		if (left == right) {
+			return left;
+		}
+		break;
+	case PARSER_DAG_FMA:
+		if (constant(parser, left, &u) && (1.0 == u)) {
+			return simplify(parser,
+					PARSER_DAG_ADD,
+					right,
+					addend,
+					0,
+					flags);
+		}
+		if (constant(parser, right, &v) && (1.0 == v)) {
+			return simplify(parser,
+					PARSER_DAG_ADD,
+					left,
+					addend,
+					0,
+					flags);
+		}
+		if (constant(parser, addend, &w) && identity(w, flags)) {
+			return simplify(parser,
+					PARSER_DAG_MUL,
+					left,
+					right,
+					0,
+					flags);
+		}
+		break;
+	default:
+		break;
+	}
+	return mkdag(parser, op, 0.0, left, right, addend);
+}
+
+/**
+ * Renumbers the nodes reachable from root, in order, to 1 .. n and packs
+ * their constants into the pool. Ids only shrink, so this runs in place.
+ */
+
+static int
+compact(struct parser *parser, uint32_t root)
+{
+	uint32_t *id, i, n;
+	uint64_t npool;
+
+	if (!(id = malloc(((size_t)root + 1) * sizeof (id[0])))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	memset(id, 0, ((size_t)root + 1) * sizeof (id[0]));
+	id[root] = 1;
+	for (i=root; i; --i) {
+		if (id[i] && (PARSER_DAG_VAL != parser->op[i])) {
+			if (PARSER_DAG_VAR != parser->op[i]) {
+				id[parser->left[i]] = 1;
+			}
+			id[parser->right[i]] = 1;
+			id[parser->addend[i]] = 1;
+		}
+	}
+	n = 0;
+	npool = 0;
+	id[0] = 0;
+	for (i=1; i<=root; ++i) {
+		if (!id[i]) {
+			continue;
+		}
+		id[i] = ++n;
+		parser->op[n] = parser->op[i];
+		parser->right[n] = id[parser->right[i]];
+		parser->addend[n] = id[parser->addend[i]];
+		if (PARSER_DAG_VAL == parser->op[i]) {
+			parser->pool[npool] = parser->pool[parser->left[i]];
+			parser->left[n] = (uint32_t)npool++;
+		}
+		else if (PARSER_DAG_VAR == parser->op[i]) {
+			parser->left[n] = parser->left[i];
+		}
+		else {
+			parser->left[n] = id[parser->left[i]];
+		}
+	}
+	FREE(id);
+	parser->dag.n = n;
+	parser->npool = npool;
+	return 0;
+}
+
+int
+parser_optimize(struct parser *parser, unsigned flags)
+{
+	struct parser old;
+	uint32_t *id, i;
+	double *p;
+
+	assert( parser );
+
+	if (parser->optimized) {
+		if ((flags + 1) != parser->optimized) {
+			TRACE("expression simplified under other flags");
+			return -1;
+		}
+		return 0;
+	}
+	old = *parser;
+	if (!(id = malloc(((size_t)old.dag.n + 1) * sizeof (id[0])))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	parser->capacity = 0;
+	parser->table = NULL;
+	parser->cnodes = 0;
+	parser->op = NULL;
+	parser->left = NULL;
+	parser->right = NULL;
+	parser->addend = NULL;
+	parser->npool = 0;
+	parser->cpool = 0;
+	parser->pool = NULL;
+	parser->dag.n = 0;
+	id[0] = 0;
+	for (i=1; i<=old.dag.n; ++i) {
+		if (PARSER_DAG_VAL == old.dag.op[i]) {
+			id[i] = mkval(parser, old.dag.pool[old.dag.left[i]]);
+		}
+		else if (PARSER_DAG_VAR == old.dag.op[i]) {
+			id[i] = mkdag(parser,
+				      PARSER_DAG_VAR,
+				      0.0,
+				      old.dag.left[i],
+				      0,
+				      0);
+		}
+		else {
+			id[i] = simplify(parser,
+					 (enum parser_dag_op)old.dag.op[i],
+					 id[old.dag.left[i]],
+					 id[old.dag.right[i]],
+					 id[old.dag.addend[i]],
+					 flags);
+		}
+		if (!id[i]) {
+			break;
+		}
+	}
+	FREE(parser->table);
+	parser->capacity = 0;
+	if ((i <= old.dag.n) ||
+	    compact(parser, id[old.dag.n]) ||
+	    resize(parser, (uint64_t)parser->dag.n + 1)) {
+		FREE(id);
+		FREE(parser->op);
+		FREE(parser->left);
+		FREE(parser->right);
+		FREE(parser->addend);
+		FREE(parser->pool);
+		*parser = old;
+		TRACE(0);
+		return -1;
+	}
+	FREE(id);
+	FREE(old.op);
+	FREE(old.left);
+	FREE(old.right);
+	FREE(old.addend);
+	FREE(old.pool);
+	parser->op[0] = PARSER_DAG_;
+	parser->left[0] = parser->right[0] = parser->addend[0] = 0;
+	if (parser->npool &&
+	    (p = realloc(parser->pool,
+			 parser->npool * sizeof (parser->pool[0])))) {
+		parser->pool = p;
+		parser->cpool = parser->npool;
+	}
+	parser->dag.op = parser->op;
+	parser->dag.left = parser->left;
+	parser->dag.right = parser->right;
+	parser->dag.addend = parser->addend;
+	parser->dag.pool = parser->pool;
+	parser->dag.nvars = (uint32_t)parser->nvars;
+	parser->optimized = flags + 1;
+	return 0;
+}
+
+/**
+ * The saved format, in the byte order of the machine that wrote it, which
+ * the magic number checks:
+ *
+ *   struct header
+ *   uint8_t  op[n + 1]
+ *   (zeros up to a multiple of 4 bytes)
+ *   uint32_t left[n + 1]
+ *   uint32_t right[n + 1]
+ *   uint32_t addend[n + 1]
+ *   (zeros up to a multiple of 8 bytes)
+ *   double   pool[consts]
+ *   char     names[]        vars NUL-terminated variable names
+ *
+ * i.e., the arrays of struct parser_dag, which parser_load() points into
+ * the mapped file. The header records whether and how the dag was
+ * simplified, since the rewrites of one set of flags may be wrong under
+ * another.
+ */
+
+#define SAVE_MAGIC   0x31474144 /* "DAG1" */
+#define SAVE_VERSION 3
+
+struct header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nodes; /* n */
+	uint32_t consts;
+	uint32_t vars;
+	uint32_t names; /* bytes of names[] */
+	uint32_t optimized; /* see struct parser */
+};
+
+struct layout {
+	size_t op, left, right, addend, pool, names, size; /* offsets */
+};
+
+static void
+layout(const struct header *header, struct layout *layout)
+{
+	size_t n;
+
+	n = (size_t)header->nodes + 1;
+	layout->op = sizeof (struct header);
+	layout->left = (layout->op + n + 3) & ~(size_t)3;
+	layout->right = layout->left + n * sizeof (uint32_t);
+	layout->addend = layout->right + n * sizeof (uint32_t);
+	layout->pool = layout->addend + n * sizeof (uint32_t);
+	layout->pool = (layout->pool + 7) & ~(size_t)7;
+	layout->names = layout->pool + header->consts * sizeof (double);
+	layout->size = layout->names + header->names;
+}
+
+static int
+save_write(FILE *file,
+	   const struct header *header,
+	   const struct parser_dag *dag)
+{
+	const char ZERO[8] = { 0 };
+	struct layout layout_;
+	size_t n, pad;
+	int err;
+
+	n = (size_t)header->nodes + 1;
+	layout(header, &layout_);
+	err = (1 != fwrite(header, sizeof (*header), 1, file));
+	err = err || (n != fwrite(dag->op, 1, n, file));
+	pad = layout_.left - layout_.op - n;
+	err = err || (pad != fwrite(ZERO, 1, pad, file));
+	err = err || (n != fwrite(dag->left, sizeof (uint32_t), n, file));
+	err = err || (n != fwrite(dag->right, sizeof (uint32_t), n, file));
+	err = err || (n != fwrite(dag->addend, sizeof (uint32_t), n, file));
+	pad = layout_.pool - layout_.addend - n * sizeof (uint32_t);
+	err = err || (pad != fwrite(ZERO, 1, pad, file));
+	err = err || (header->consts != fwrite(dag->pool,
+					       sizeof (double),
+					       header->consts,
+					       file));
+	return err ? -1 : 0;
+}
+
+int
+parser_save(const struct parser *parser, const char *pathname)
+{
+	struct header header;
+	FILE *file;
+	uint64_t i;
+	size_t n;
+	int err;
+
+	assert( parser && safe_strlen(pathname) );
+
+	memset(&header, 0, sizeof (header));
+	header.magic = SAVE_MAGIC;
+	header.version = SAVE_VERSION;
+	header.nodes = parser->dag.n;
+	header.optimized = parser->optimized;
+	for (i=1; i<=parser->dag.n; ++i) {
+		if (PARSER_DAG_VAL == parser->dag.op[i]) {
+			++header.consts;
+		}
+	}
+	header.vars = (uint32_t)parser->nvars;
+	for (i=0; i<parser->nvars; ++i) {
+		header.names += (uint32_t)safe_strlen(parser->vars[i]) + 1;
+	}
+	if (!(file = fopen(pathname, "wb"))) {
+		TRACE("fopen()");
+		return -1;
+	}
+	err = save_write(file, &header, &parser->dag);
+	for (i=0; i<parser->nvars; ++i) {
+		n = safe_strlen(parser->vars[i]) + 1;
+		if (n != fwrite(parser->vars[i], 1, n, file)) {
+			err = -1;
+		}
+	}
+	if (fclose(file) || err) {
+		file_delete(pathname);
+		TRACE("unable to save the expression");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Returns whether node id, of the given op, may have the children left,
+ * right and addend, i, j and k, all below id, or a leaf's operand i.
+ */
+
+static int /* BOOL */
+valid(const struct header *header,
+      uint8_t op,
+      uint32_t id,
+      uint32_t i,
+      uint32_t j,
+      uint32_t k)
+{
+	if (PARSER_DAG_VAL == op) {
+		return (i < header->consts) && !j && !k;
+	}
+	if (PARSER_DAG_VAR == op) {
+		return (i < header->vars) && !j && !k;
+	}
+	if ((PARSER_DAG_NEG == op) || (1 == arity((enum parser_dag_op)op))) {
+		return !i && j && (j < id) && !k;
+	}
+	if (PARSER_DAG_FMA == op) {
+		return i && (i < id) && j && (j < id) && k && (k < id);
+	}
+	return (PARSER_DAG_NEG < op) && (PARSER_DAG_FMA > op) &&
+		i && (i < id) && j && (j < id) && !k;
+}
+
+struct parser *
+parser_load(const char *pathname)
+{
+	const struct header *header;
+	struct layout layout_;
+	struct parser *parser;
+	struct parser_dag *dag;
+	const char *name;
+	uint32_t i, k;
+
+	assert( safe_strlen(pathname) );
+
+	if (!(parser = malloc(sizeof (struct parser)))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(parser, 0, sizeof (struct parser));
+	if (!(parser->map = file_map(pathname, &parser->mapsize))) {
+		parser_close(parser);
+		TRACE(0);
+		return NULL;
+	}
+	header = (const struct header *)parser->map;
+	if ((sizeof (struct header) > parser->mapsize) ||
+	    (SAVE_MAGIC != header->magic) ||
+	    (SAVE_VERSION != header->version) ||
+	    !header->nodes ||
+	    (UINT32_MAX == header->nodes) ||
+	    ((1 + (PARSER_OPTIMIZE_FAST |
+		   PARSER_OPTIMIZE_IEEE |
+		   PARSER_OPTIMIZE_CHECKED)) < header->optimized)) {
+		parser_close(parser);
+		TRACE("not a saved expression");
+		return NULL;
+	}
+	layout(header, &layout_);
+	if ((layout_.size != parser->mapsize) ||
+	    (header->names && parser->map[parser->mapsize - 1])) {
+		parser_close(parser);
+		TRACE("corrupt saved expression");
+		return NULL;
+	}
+	dag = &parser->dag;
+	dag->n = header->nodes;
+	dag->op = (const uint8_t *)(parser->map + layout_.op);
+	dag->left = (const uint32_t *)(parser->map + layout_.left);
+	dag->right = (const uint32_t *)(parser->map + layout_.right);
+	dag->addend = (const uint32_t *)(parser->map + layout_.addend);
+	dag->pool = (const double *)(parser->map + layout_.pool);
+	dag->nvars = header->vars;
+	parser->optimized = header->optimized;
+	for (i=1; i<=dag->n; ++i) {
+		if (!valid(header,
+			   dag->op[i],
+			   i,
+			   dag->left[i],
+			   dag->right[i],
+			   dag->addend[i])) {
+			parser_close(parser);
+			TRACE("corrupt saved expression");
+			return NULL;
+		}
+	}
+
+	/* variable names */
+
+	parser->nvars = header->vars;
+	if (header->vars &&
+	    !(parser->vars = malloc(header->vars * sizeof (parser->vars[0])))) {
+		parser_close(parser);
+		TRACE("out of memory");
+		return NULL;
+	}
+	name = parser->map + layout_.names;
+	for (k=0; k<header->vars; ++k) {
+		if (name >= (parser->map + parser->mapsize)) {
+			parser_close(parser);
+			TRACE("corrupt saved expression");
+			return NULL;
+		}
+		parser->vars[k] = (char *)name;
+		name += safe_strlen(name) + 1;
+	}
+	return parser;
 }
@@ -10,20 +10,49 @@
 #ifndef _PARSER_H_
 #define _PARSER_H_
 
+#include "system.h"
+
+/**
+ * A parsed expression is a dag held as parallel arrays indexed by node id,
+ * with a separate pool of constants. Equal subexpressions share a single
+ * node, hence a node may have several parents. Ids are dense, 1 .. n, and
+ * every node's id is greater than the ids of its children, so a pass that
+ * visits the ids in increasing order visits children before parents, and
+ * the root is node n. Id 0 stands for no child; entry 0 of every array is
+ * unused.
+ *
+ * exp, log and pow are those of mathfn.h, min and max compare like C's
+ * (left < right) ? left : right and (left > right) ? left : right, and fma
+ * rounds once.
+ */
+
+enum parser_dag_op {
+	PARSER_DAG_,
+	PARSER_DAG_VAL,  /* pool[left] */
+	PARSER_DAG_VAR,  /* variable number left */
+	PARSER_DAG_NEG,  /* - right */
+	PARSER_DAG_MUL,  /* left * right */
+	PARSER_DAG_DIV,  /* left / right */
+	PARSER_DAG_ADD,  /* left + right */
+	PARSER_DAG_SUB,  /* left - right */
+	PARSER_DAG_EXP,  /* exp(right) */
+	PARSER_DAG_LOG,  /* log(right) */
+	PARSER_DAG_SQRT, /* sqrt(right) */
+	PARSER_DAG_ABS,  /* abs(right) */
+	PARSER_DAG_POW,  /* pow(left, right) */
+	PARSER_DAG_MIN,  /* min(left, right) */
+	PARSER_DAG_MAX,  /* max(left, right) */
+	PARSER_DAG_FMA   /* fma(left, right, addend) */
+};
+
 struct parser_dag {
-	enum parser_dag_op {
-		PARSER_DAG_,
-		PARSER_DAG_VAL, /* val */
-		PARSER_DAG_NEG, /* - right */
-		PARSER_DAG_MUL, /* left * right */
-		PARSER_DAG_DIV, /* left / right */
-		PARSER_DAG_ADD, /* left + right */
-		PARSER_DAG_SUB  /* left - right */
-	} op;
-	int id; /* guaranteed to be unique */
-	double val;
-	struct parser_dag *left;
-	struct parser_dag *right;
+	uint32_t n; /* nodes, the root is node n */
+	uint32_t nvars; /* variables, some perhaps optimized out of the nodes */
+	const uint8_t *op; /* enum parser_dag_op */
+	const uint32_t *left;
+	const uint32_t *right;
+	const uint32_t *addend; /* PARSER_DAG_FMA only */
+	const double *pool;
 };
 
 struct parser;
@@ -34,4 +63,72 @@ void parser_close(struct parser *parser);
 
 const struct parser_dag *parser_dag(const struct parser *parser);
 
+/**
+ * Flags of parser_optimize(). The division flags tell it what division by
+ * zero yields where the expression will run, see enum codegen_division;
+ * without them, it follows the interpreter and yields 0.
+ */
+
+#define PARSER_OPTIMIZE_FAST    1 /* see parser_optimize() */
+#define PARSER_OPTIMIZE_IEEE    2 /* division by zero is infinite or NaN */
+#define PARSER_OPTIMIZE_CHECKED 4 /* divisions by zero are counted */
+
+/**
+ * Simplifies the dag in place: folds constant subexpressions, drops
+ * additions of 0 and multiplications and divisions by 1, turns division by
+ * a power of two into multiplication by its reciprocal, and the like, then
+ * renumbers the surviving nodes so that the root is still node n. The
+ * result is bit-for-bit that of the original expression; a fully constant
+ * expression becomes a single PARSER_DAG_VAL node. Division by zero is
+ * folded as PARSER_OPTIMIZE_IEEE says, and never under
+ * PARSER_OPTIMIZE_CHECKED, which must see every division by zero happen.
+ *
+ * A dag is simplified once: calling again, e.g., on a dag parser_load()
+ * read back simplified, does nothing if flags are the same, and fails
+ * otherwise, since the rewrites already made may not hold under flags.
+ *
+ * flags: PARSER_OPTIMIZE_*, or 0; PARSER_OPTIMIZE_FAST also divides by any
+ *        constant through its reciprocal, regroups chains of additions and
+ *        of multiplications to fold their constants, and takes x * 0 and
+ *        x - x to be 0, which may change rounding and the results for
+ *        infinities and NaNs
+ *
+ * return: 0 on success, otherwise error, leaving the dag unchanged
+ */
+
+int parser_optimize(struct parser *parser, unsigned flags);
+
+/**
+ * Saves the parsed expression and its variable names to a file in a compact
+ * binary format: the arrays of struct parser_dag as they are in memory,
+ * 8-bit ops and 32-bit child ids, followed by the pool of constants. The
+ * format is versioned and in the byte order of the machine, for reloading
+ * with parser_load() rather than for interchange. The flags of
+ * parser_optimize(), if it ran, are saved along.
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int parser_save(const struct parser *parser, const char *pathname);
+
+/**
+ * Loads an expression saved by parser_save(), without lexing or parsing:
+ * the file is mapped and, once every node is checked, the arrays of the
+ * struct parser_dag point into the mapping. The result behaves like one
+ * obtained from parser_open(); release it with parser_close().
+ *
+ * return: an opaque handle or NULL on error, e.g., a corrupt file
+ */
+
+struct parser *parser_load(const char *pathname);
+
+/**
+ * Variables are numbered 0, 1, ... in order of first appearance; a compiled
+ * expression reads variable i from x[i].
+ */
+
+uint64_t parser_vars(const struct parser *parser);
+
+const char *parser_var(const struct parser *parser, uint64_t i);
+
 #endif /* _PARSER_H_ */
@@ -0,0 +1,307 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * registry.c
+ */
+
+#include <pthread.h>
+#include "registry.h"
+
+/**
+ * Epoch-based reclamation. The registry epoch starts at 1 and is bumped by
+ * every retirement; a reader publishes the epoch it entered at, 0 outside
+ * read sections. A module retired at epoch r (the bumped value) may still
+ * be running only on readers whose published epoch is non-zero and below
+ * r: a reader that entered at r or later loaded the epoch after the swap
+ * and so finds the new module in the slot.
+ *
+ * The reader's store of its epoch and the writer's swap of a slot are each
+ * followed by a full fence before the other side's load (Dekker), so either
+ * the writer sees the reader inside its section or the reader sees the new
+ * module.
+ */
+
+struct module {
+	struct registry_module public; /* first, see registry_unpin() */
+	uint64_t refs; /* pins */
+	uint64_t retired; /* epoch of retirement, 0 while current */
+	struct jitc *jitc;
+	struct module *next; /* retired list */
+};
+
+struct registry_reader {
+	uint64_t epoch; /* epoch entered at, 0 outside read sections */
+	int joined;
+	struct registry *registry;
+	struct registry_reader *next;
+};
+
+struct registry {
+	size_t n;
+	struct module **slot;
+	uint64_t *version; /* by slot: the last version published */
+	uint64_t epoch;
+	pthread_mutex_t mutex; /* writers, and the reader list */
+	struct registry_reader *readers;
+	struct module *retired;
+	size_t nretired;
+};
+
+static void
+module_free(struct module *module)
+{
+	if (module) {
+		jitc_close(module->jitc);
+		memset(module, 0, sizeof (struct module));
+	}
+	FREE(module);
+}
+
+/**
+ * Returns the smallest epoch a reader is inside a read section at, or
+ * UINT64_MAX if none is. Called with the mutex held.
+ */
+
+static uint64_t
+oldest(const struct registry *registry)
+{
+	const struct registry_reader *reader;
+	uint64_t e, min;
+
+	min = UINT64_MAX;
+	for (reader=registry->readers; reader; reader=reader->next) {
+		e = __atomic_load_n(&reader->epoch, __ATOMIC_ACQUIRE);
+		if (e && (e < min)) {
+			min = e;
+		}
+	}
+	return min;
+}
+
+static size_t
+reclaim(struct registry *registry)
+{
+	struct module **p, *module;
+	uint64_t min;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	min = oldest(registry);
+	p = &registry->retired;
+	while ((module = *p)) {
+		if ((module->retired <= min) &&
+		    !__atomic_load_n(&module->refs, __ATOMIC_ACQUIRE)) {
+			*p = module->next;
+			--registry->nretired;
+			module_free(module);
+		}
+		else {
+			p = &module->next;
+		}
+	}
+	return registry->nretired;
+}
+
+struct registry *
+registry_open(size_t n)
+{
+	struct registry *registry;
+
+	assert( n );
+
+	if (!(registry = malloc(sizeof (struct registry)))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(registry, 0, sizeof (struct registry));
+	registry->n = n;
+	registry->epoch = 1;
+	if (!(registry->slot = malloc(n * sizeof (registry->slot[0]))) ||
+	    !(registry->version = malloc(n * sizeof (registry->version[0])))) {
+		FREE(registry->slot);
+		FREE(registry);
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(registry->slot, 0, n * sizeof (registry->slot[0]));
+	memset(registry->version, 0, n * sizeof (registry->version[0]));
+	pthread_mutex_init(&registry->mutex, NULL);
+	return registry;
+}
+
+void
+registry_close(struct registry *registry)
+{
+	struct registry_reader *reader;
+	struct module *module;
+	size_t i;
+
+	if (registry) {
+		for (i=0; i<registry->n; ++i) {
+			module_free(registry->slot[i]);
+		}
+		while ((module = registry->retired)) {
+			registry->retired = module->next;
+			module_free(module);
+		}
+		while ((reader = registry->readers)) {
+			registry->readers = reader->next;
+			FREE(reader);
+		}
+		pthread_mutex_destroy(&registry->mutex);
+		FREE(registry->slot);
+		FREE(registry->version);
+		memset(registry, 0, sizeof (struct registry));
+	}
+	FREE(registry);
+}
+
+struct registry_reader *
+registry_join(struct registry *registry)
+{
+	struct registry_reader *reader;
+
+	assert( registry );
+
+	pthread_mutex_lock(&registry->mutex);
+	for (reader=registry->readers; reader; reader=reader->next) {
+		if (!reader->joined) {
+			reader->joined = 1;
+			pthread_mutex_unlock(&registry->mutex);
+			return reader;
+		}
+	}
+	if (!(reader = malloc(sizeof (struct registry_reader)))) {
+		pthread_mutex_unlock(&registry->mutex);
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(reader, 0, sizeof (struct registry_reader));
+	reader->joined = 1;
+	reader->registry = registry;
+	reader->next = registry->readers;
+	registry->readers = reader;
+	pthread_mutex_unlock(&registry->mutex);
+	return reader;
+}
+
+void
+registry_leave(struct registry_reader *reader)
+{
+	if (reader) {
+		assert( !reader->epoch );
+
+		__atomic_store_n(&reader->joined, 0, __ATOMIC_RELEASE);
+	}
+}
+
+void
+registry_enter(struct registry_reader *reader)
+{
+	assert( reader && !reader->epoch );
+
+	__atomic_store_n(&reader->epoch,
+			 __atomic_load_n(&reader->registry->epoch,
+					 __ATOMIC_SEQ_CST),
+			 __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void
+registry_exit(struct registry_reader *reader)
+{
+	assert( reader && reader->epoch );
+
+	__atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+const struct registry_module *
+registry_lookup(const struct registry *registry, size_t slot)
+{
+	assert( registry && (slot < registry->n) );
+
+	return (const struct registry_module *)
+		__atomic_load_n(&registry->slot[slot], __ATOMIC_ACQUIRE);
+}
+
+const struct registry_module *
+registry_pin(struct registry *registry, size_t slot)
+{
+	struct module *module;
+
+	assert( registry && (slot < registry->n) );
+
+	module = __atomic_load_n(&registry->slot[slot], __ATOMIC_ACQUIRE);
+	if (module) {
+		__atomic_add_fetch(&module->refs, 1, __ATOMIC_RELAXED);
+	}
+	return (const struct registry_module *)module;
+}
+
+void
+registry_unpin(const struct registry_module *module)
+{
+	if (module) {
+		__atomic_sub_fetch(&((struct module *)module)->refs,
+				   1,
+				   __ATOMIC_RELEASE);
+	}
+}
+
+int
+registry_publish(struct registry *registry, size_t slot, struct jitc *jitc)
+{
+	struct module *module, *old;
+
+	assert( registry && (slot < registry->n) && jitc );
+
+	if (!(module = malloc(sizeof (struct module)))) {
+		jitc_close(jitc);
+		TRACE("out of memory");
+		return -1;
+	}
+	memset(module, 0, sizeof (struct module));
+	module->jitc = jitc;
+	module->public.evaluate =
+		(evaluate_t)jitc_lookup(jitc, "evaluate");
+	module->public.evaluate_batch =
+		(evaluate_batch_t)jitc_lookup(jitc, "evaluate_batch");
+	module->public.evaluate_grad =
+		(evaluate_grad_t)jitc_lookup(jitc, "evaluate_grad");
+	if (!module->public.evaluate) {
+		module_free(module);
+		TRACE("module lacks evaluate()");
+		return -1;
+	}
+	pthread_mutex_lock(&registry->mutex);
+	module->public.version = ++registry->version[slot];
+	old = __atomic_exchange_n(&registry->slot[slot],
+				  module,
+				  __ATOMIC_SEQ_CST);
+	if (old) {
+		old->retired = __atomic_add_fetch(&registry->epoch,
+						  1,
+						  __ATOMIC_SEQ_CST);
+		old->next = registry->retired;
+		registry->retired = old;
+		++registry->nretired;
+	}
+	reclaim(registry);
+	pthread_mutex_unlock(&registry->mutex);
+	return 0;
+}
+
+size_t
+registry_reclaim(struct registry *registry)
+{
+	size_t n;
+
+	assert( registry );
+
+	pthread_mutex_lock(&registry->mutex);
+	n = reclaim(registry);
+	pthread_mutex_unlock(&registry->mutex);
+	return n;
+}
@@ -0,0 +1,145 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * registry.h
+ */
+
+#ifndef _REGISTRY_H_
+#define _REGISTRY_H_
+
+#include "codegen.h"
+#include "jitc.h"
+
+/**
+ * A table of n slots, one per formula, each holding the current compiled
+ * version of that formula. Any number of threads evaluate while writers
+ * publish newer versions; a replaced version is retired and unloaded only
+ * once no thread can still be running it.
+ *
+ * Readers bracket their evaluations with registry_enter() and
+ * registry_exit(). Inside, registry_lookup() is a single atomic load and
+ * returns a module whose entry points were resolved once, when it was
+ * published. A module looked up inside a read section stays loaded until
+ * the section ends, or until registry_unpin() if it was pinned with
+ * registry_pin(), which lets a reader keep a version across sections.
+ *
+ * A retired module is unloaded by the next registry_publish() or
+ * registry_reclaim() that finds it unpinned and every reader either outside
+ * its read section or inside one entered after the module was retired.
+ */
+
+struct registry;
+struct registry_reader;
+
+struct registry_module {
+	evaluate_t evaluate;
+	evaluate_batch_t evaluate_batch; /* NULL if the module lacks it */
+	evaluate_grad_t evaluate_grad;   /* NULL if the module lacks it */
+	uint64_t version;                /* 1 for the first of its slot */
+};
+
+/**
+ * n: the number of slots, initially empty
+ *
+ * return: an opaque handle or NULL on error
+ */
+
+struct registry *registry_open(size_t n);
+
+/**
+ * Unloads every module and releases the registry. No reader may be inside
+ * a read section and no module may be pinned.
+ *
+ * Note: registry may be NULL
+ */
+
+void registry_close(struct registry *registry);
+
+/**
+ * Registers the calling thread as a reader. Each thread evaluating through
+ * the registry needs a reader of its own.
+ *
+ * return: an opaque reader or NULL on error
+ */
+
+struct registry_reader *registry_join(struct registry *registry);
+
+/**
+ * Unregisters a reader, which must be outside its read section. The reader
+ * is recycled by a later registry_join().
+ *
+ * Note: reader may be NULL
+ */
+
+void registry_leave(struct registry_reader *reader);
+
+/**
+ * Begins a read section: modules looked up until registry_exit() stay
+ * loaded. Sections do not nest.
+ */
+
+void registry_enter(struct registry_reader *reader);
+
+/**
+ * Ends a read section. Entry points of modules looked up in it may not be
+ * called afterwards, unless pinned.
+ */
+
+void registry_exit(struct registry_reader *reader);
+
+/**
+ * Must be called inside a read section.
+ *
+ * slot: the slot, less than n
+ *
+ * return: the current module of slot, or NULL if none was published
+ */
+
+const struct registry_module *registry_lookup(const struct registry *registry,
+					      size_t slot);
+
+/**
+ * Looks up slot, like registry_lookup(), and pins the module so that it
+ * stays loaded past the read section. Must be called inside one.
+ *
+ * return: the current module of slot, or NULL if none was published
+ */
+
+const struct registry_module *registry_pin(struct registry *registry,
+					   size_t slot);
+
+/**
+ * Releases a pin taken by registry_pin(). May be called outside a read
+ * section.
+ *
+ * Note: module may be NULL
+ */
+
+void registry_unpin(const struct registry_module *module);
+
+/**
+ * Publishes jitc as the new version of slot and retires the previous one,
+ * then reclaims what it can (see registry_reclaim()). The registry takes
+ * ownership of jitc, which must export "evaluate", and closes it even on
+ * error. Publishing is serialized; readers are never blocked.
+ *
+ * slot: the slot, less than n
+ * jitc: a loaded module, e.g., obtained from jitc_build() or jitc_native()
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int registry_publish(struct registry *registry, size_t slot, struct jitc *jitc);
+
+/**
+ * Unloads the retired modules no reader can still be running.
+ *
+ * return: the number of retired modules still loaded
+ */
+
+size_t registry_reclaim(struct registry *registry);
+
+#endif /* _REGISTRY_H_ */
@@ -0,0 +1,17 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * sigmoid.c
+ */
+
+#include <math.h>
+#include "sigmoid.h"
+
+double
+sigmoid(double x)
+{
+	return 1.0 / (1.0 + exp(-x));
+}
@@ -0,0 +1,19 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * sigmoid.h
+ */
+
+#ifndef _SIGMOID_H_
+#define _SIGMOID_H_
+
+/**
+ * The logistic function applied to the result of every compiled expression.
+ */
+
+double sigmoid(double x);
+
+#endif /* _SIGMOID_H_ */
@@ -0,0 +1,503 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * stream.c
+ */
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <pthread.h>
+#include "codegen.h"
+#include "parser.h"
+#include "jitc.h"
+#include "vm.h"
+#include "stream.h"
+
+/**
+ * Needs:
+ *   getline()
+ *   pthread_create()
+ *   pthread_join()
+ */
+
+/**
+ * One entry per distinct expression text. Entries never move, so the
+ * compiler thread may hold them while the table grows. Like tier.c, the
+ * compiled entry point is published with a release store and read with an
+ * acquire load.
+ */
+
+struct entry {
+	char *text;
+	size_t len;
+	uint64_t hash;
+	uint64_t count; /* evaluations so far */
+	evaluate_t fnc; /* compiled entry point, NULL until compiled */
+	struct parser *parser;
+	struct vm *vm;
+};
+
+struct binding {
+	const char *name;
+	size_t len;
+	double value;
+};
+
+struct bindings {
+	struct binding *binding;
+	size_t n;
+	size_t capacity;
+};
+
+/**
+ * queue: hot entries waiting for the compiler thread
+ * jitc : every module compiled so far, owning the published entry points
+ */
+
+struct compiler {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t thread;
+	int started;
+	int stop;
+	struct entry **queue;
+	size_t nqueue;
+	size_t cqueue;
+	struct jitc **jitc;
+	size_t njitc;
+	size_t cjitc;
+	uint64_t compiled;
+};
+
+struct stream {
+	struct entry **table; /* open addressing, a power of two in size */
+	size_t size;
+	size_t n;
+	struct bindings defaults;
+	struct bindings line;
+	double *x;
+	size_t nx;
+	struct compiler compiler;
+	unsigned optimize; /* parser_optimize() flags */
+};
+
+/**
+ * Lines can be kilobytes long and every one is hashed, so the hash mixes a
+ * word at a time rather than a byte at a time.
+ */
+
+static uint64_t
+hash(const char *s, size_t n)
+{
+	uint64_t h, w;
+	size_t i;
+
+	h = 0x9e3779b97f4a7c15ULL ^ n;
+	for (i=0; (i + 8)<=n; i+=8) {
+		memcpy(&w, s + i, 8);
+		h = (h ^ w) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 32;
+	}
+	w = 0;
+	memcpy(&w, s + i, n - i);
+	h = (h ^ w) * 0xff51afd7ed558ccdULL;
+	return h ^ (h >> 29);
+}
+
+static int
+grow(void **p, size_t *capacity, size_t n, size_t size)
+{
+	size_t m;
+	void *q;
+
+	if (n < *capacity) {
+		return 0;
+	}
+	m = *capacity ? (2 * *capacity) : 64;
+	if (!(q = realloc(*p, m * size))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	*p = q;
+	*capacity = m;
+	return 0;
+}
+
+static void *
+compile(void *arg)
+{
+	struct compiler *compiler;
+	const struct parser_dag **dags;
+	struct entry **batch;
+	evaluate_t *table;
+	struct jitc *jitc;
+	size_t i, n;
+
+	compiler = (struct compiler *)arg;
+	for (;;) {
+		pthread_mutex_lock(&compiler->mutex);
+		while (!compiler->stop && !compiler->nqueue) {
+			pthread_cond_wait(&compiler->cond, &compiler->mutex);
+		}
+		if (compiler->stop) {
+			pthread_mutex_unlock(&compiler->mutex);
+			return NULL;
+		}
+		batch = compiler->queue;
+		n = compiler->nqueue;
+		compiler->queue = NULL;
+		compiler->nqueue = 0;
+		compiler->cqueue = 0;
+		pthread_mutex_unlock(&compiler->mutex);
+		dags = malloc(n * sizeof (dags[0]));
+		table = malloc(n * sizeof (table[0]));
+		jitc = NULL;
+		if (dags && table) {
+			for (i=0; i<n; ++i) {
+				dags[i] = parser_dag(batch[i]->parser);
+			}
+			jitc = jitc_build_many(dags, n, table);
+		}
+		pthread_mutex_lock(&compiler->mutex);
+		if (!jitc ||
+		    grow((void **)&compiler->jitc,
+			 &compiler->cjitc,
+			 compiler->njitc,
+			 sizeof (compiler->jitc[0]))) {
+			jitc_close(jitc);
+			TRACE(0); /* keep interpreting */
+		}
+		else {
+			compiler->jitc[compiler->njitc++] = jitc;
+			compiler->compiled += n;
+			for (i=0; i<n; ++i) {
+				__atomic_store_n(&batch[i]->fnc,
+						 table[i],
+						 __ATOMIC_RELEASE);
+			}
+		}
+		pthread_mutex_unlock(&compiler->mutex);
+		FREE(dags);
+		FREE(table);
+		FREE(batch);
+	}
+}
+
+static void
+submit(struct compiler *compiler, struct entry *entry)
+{
+	pthread_mutex_lock(&compiler->mutex);
+	if (grow((void **)&compiler->queue,
+		 &compiler->cqueue,
+		 compiler->nqueue,
+		 sizeof (compiler->queue[0]))) {
+		pthread_mutex_unlock(&compiler->mutex);
+		TRACE(0); /* keep interpreting */
+		return;
+	}
+	compiler->queue[compiler->nqueue++] = entry;
+	pthread_cond_signal(&compiler->cond);
+	pthread_mutex_unlock(&compiler->mutex);
+}
+
+/**
+ * Appends the name=value bindings of s, separated by blanks or commas, to
+ * bindings, which point into s.
+ */
+
+static int
+bind(struct bindings *bindings, const char *s)
+{
+	struct binding *binding;
+	const char *e;
+	char *end;
+
+	for (;;) {
+		while (isspace((unsigned char)*s) || (',' == *s)) {
+			++s;
+		}
+		if (!*s) {
+			return 0;
+		}
+		e = s + strcspn(s, "=, \t");
+		if (('=' != *e) ||
+		    (e == s) ||
+		    grow((void **)&bindings->binding,
+			 &bindings->capacity,
+			 bindings->n,
+			 sizeof (bindings->binding[0]))) {
+			return -1;
+		}
+		binding = &bindings->binding[bindings->n++];
+		binding->name = s;
+		binding->len = (size_t)(e - s);
+		binding->value = strtod(e + 1, &end);
+		if ((e + 1) == end) {
+			return -1;
+		}
+		s = end;
+	}
+}
+
+static const struct binding *
+lookup(const struct bindings *bindings, const char *name)
+{
+	size_t i, n;
+
+	n = safe_strlen(name);
+	for (i=bindings->n; 0<i; --i) {
+		if ((n == bindings->binding[i - 1].len) &&
+		    !strncmp(bindings->binding[i - 1].name, name, n)) {
+			return &bindings->binding[i - 1];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Returns the entry of the expression s[0 .. n), parsing it if it is new,
+ * or NULL if it does not parse.
+ */
+
+static struct entry *
+intern(struct stream *stream, const char *s, size_t n, uint64_t *distinct)
+{
+	struct entry **table, *entry;
+	size_t i, j, size;
+	uint64_t h;
+
+	h = hash(s, n);
+	i = h & (stream->size - 1);
+	while ((entry = stream->table[i])) {
+		if ((h == entry->hash) &&
+		    (n == entry->len) &&
+		    !memcmp(entry->text, s, n)) {
+			return entry;
+		}
+		i = (i + 1) & (stream->size - 1);
+	}
+	if (!(entry = malloc(sizeof (struct entry)))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(entry, 0, sizeof (struct entry));
+	entry->hash = h;
+	entry->len = n;
+	if (!(entry->text = malloc(n + 1))) {
+		FREE(entry);
+		TRACE("out of memory");
+		return NULL;
+	}
+	memcpy(entry->text, s, n);
+	entry->text[n] = '\0';
+	if (!(entry->parser = parser_open(entry->text)) ||
+	    parser_optimize(entry->parser, stream->optimize) ||
+	    !(entry->vm = vm_open(parser_dag(entry->parser)))) {
+		parser_close(entry->parser);
+		FREE(entry->text);
+		FREE(entry);
+		return NULL;
+	}
+	stream->table[i] = entry;
+	++stream->n;
+	++(*distinct);
+	if ((2 * stream->n) >= stream->size) {
+		size = 2 * stream->size;
+		if (!(table = malloc(size * sizeof (table[0])))) {
+			TRACE("out of memory");
+			return entry; /* still below full */
+		}
+		memset(table, 0, size * sizeof (table[0]));
+		for (i=0; i<stream->size; ++i) {
+			if (stream->table[i]) {
+				j = stream->table[i]->hash & (size - 1);
+				while (table[j]) {
+					j = (j + 1) & (size - 1);
+				}
+				table[j] = stream->table[i];
+			}
+		}
+		FREE(stream->table);
+		stream->table = table;
+		stream->size = size;
+	}
+	return entry;
+}
+
+/**
+ * Evaluates one line, the newline stripped, returning 0 and the value in
+ * *v, or -1 if the line is answered with "error".
+ */
+
+static int
+line(struct stream *stream,
+     char *s,
+     uint64_t threshold,
+     struct stream_stats *stats,
+     double *v)
+{
+	const struct binding *binding;
+	struct entry *entry;
+	evaluate_t fnc;
+	size_t i, n;
+	double *x;
+	char *e;
+
+	stream->line.n = 0;
+	if ((e = strchr(s, ';'))) {
+		*e = '\0';
+		if (bind(&stream->line, e + 1)) {
+			return -1;
+		}
+	}
+	while (isspace((unsigned char)*s)) {
+		++s;
+	}
+	n = safe_strlen(s);
+	while (n && isspace((unsigned char)s[n - 1])) {
+		--n;
+	}
+	if (!n || !(entry = intern(stream, s, n, &stats->distinct))) {
+		return -1;
+	}
+	n = parser_vars(entry->parser);
+	if (n > stream->nx) {
+		if (!(x = realloc(stream->x, n * sizeof (stream->x[0])))) {
+			TRACE("out of memory");
+			return -1;
+		}
+		stream->x = x;
+		stream->nx = n;
+	}
+	for (i=0; i<n; ++i) {
+		if (!(binding = lookup(&stream->line,
+				       parser_var(entry->parser, i))) &&
+		    !(binding = lookup(&stream->defaults,
+				       parser_var(entry->parser, i)))) {
+			return -1;
+		}
+		stream->x[i] = binding->value;
+	}
+	if ((fnc = __atomic_load_n(&entry->fnc, __ATOMIC_ACQUIRE))) {
+		*v = fnc(stream->x);
+		return 0;
+	}
+	if (threshold &&
+	    (1 < parser_dag(entry->parser)->n) && /* else nothing to gain */
+	    (threshold == ++entry->count)) {
+		submit(&stream->compiler, entry);
+	}
+	*v = vm_execute(entry->vm, stream->x);
+	return 0;
+}
+
+int
+stream_run(FILE *in,
+	   FILE *out,
+	   int argc,
+	   char *argv[],
+	   uint64_t threshold,
+	   unsigned optimize,
+	   struct stream_stats *stats)
+{
+	struct stream_stats stats_;
+	struct stream stream;
+	struct entry *entry;
+	size_t capacity, i;
+	char *s;
+	ssize_t n;
+	double v;
+	int j, err;
+
+	assert( in && out );
+
+	stats = stats ? stats : &stats_;
+	memset(stats, 0, sizeof (struct stream_stats));
+	memset(&stream, 0, sizeof (struct stream));
+	stream.optimize = optimize;
+	stream.size = 1024;
+	if (!(stream.table = malloc(stream.size * sizeof (stream.table[0])))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	memset(stream.table, 0, stream.size * sizeof (stream.table[0]));
+	err = 0;
+	for (j=0; !err && (j<argc); ++j) {
+		if (bind(&stream.defaults, argv[j])) {
+			fprintf(stderr, "invalid binding '%s'\n", argv[j]);
+			err = -1;
+		}
+	}
+	pthread_mutex_init(&stream.compiler.mutex, NULL);
+	pthread_cond_init(&stream.compiler.cond, NULL);
+	if (!err &&
+	    threshold &&
+	    pthread_create(&stream.compiler.thread,
+			   NULL,
+			   compile,
+			   &stream.compiler)) {
+		TRACE("pthread_create()");
+		err = -1;
+	}
+	stream.compiler.started = !err && threshold;
+	stats->ns = ref_time();
+	s = NULL;
+	capacity = 0;
+	while (!err && (0 <= (n = getline(&s, &capacity, in)))) {
+		while (n && (('\n' == s[n - 1]) || ('\r' == s[n - 1]))) {
+			s[--n] = '\0';
+		}
+		++stats->lines;
+		if (line(&stream, s, threshold, stats, &v)) {
+			++stats->errors;
+			fputs("error\n", out);
+		}
+		else {
+			/* no rule fixes the sign of a NaN: gcc may flip it */
+			fprintf(out, "%f\n", isnan(v) ? NAN : v);
+		}
+	}
+	FREE(s);
+	if (fflush(out) || ferror(in)) {
+		TRACE("I/O");
+		err = -1;
+	}
+	stats->ns = ref_time() - stats->ns;
+
+	/* the compiler thread drops what is queued, finishing a batch first */
+
+	if (stream.compiler.started) {
+		pthread_mutex_lock(&stream.compiler.mutex);
+		stream.compiler.stop = 1;
+		pthread_cond_signal(&stream.compiler.cond);
+		pthread_mutex_unlock(&stream.compiler.mutex);
+		pthread_join(stream.compiler.thread, NULL);
+	}
+	stats->compiled = stream.compiler.compiled;
+	for (i=0; i<stream.compiler.njitc; ++i) {
+		stats->faults += jitc_division_faults(stream.compiler.jitc[i]);
+		jitc_close(stream.compiler.jitc[i]);
+	}
+	FREE(stream.compiler.jitc);
+	FREE(stream.compiler.queue);
+	pthread_mutex_destroy(&stream.compiler.mutex);
+	pthread_cond_destroy(&stream.compiler.cond);
+	for (i=0; i<stream.size; ++i) {
+		if ((entry = stream.table[i])) {
+			stats->faults += vm_division_faults(entry->vm);
+			vm_close(entry->vm);
+			parser_close(entry->parser);
+			FREE(entry->text);
+			FREE(entry);
+		}
+	}
+	FREE(stream.table);
+	FREE(stream.defaults.binding);
+	FREE(stream.line.binding);
+	FREE(stream.x);
+	return err;
+}
@@ -0,0 +1,63 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * stream.h
+ */
+
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+#include "system.h"
+
+struct stream_stats {
+	uint64_t lines;    /* lines read */
+	uint64_t distinct; /* distinct expressions parsed */
+	uint64_t compiled; /* distinct expressions compiled by gcc */
+	uint64_t errors;   /* lines answered with "error" */
+	uint64_t faults;   /* divisions by zero, see vm_division_faults() */
+	uint64_t ns;       /* wall time */
+};
+
+/**
+ * Evaluates newline-delimited expressions read from in and writes the
+ * result of line k, formatted like main() does, as line k of out, or
+ * "error" if the line does not parse or leaves a variable unbound. A line
+ * is an expression optionally followed by ';' and name=value bindings,
+ * which take precedence over those of argv.
+ *
+ * Identical expressions are parsed and simplified with the flags optimize,
+ * see parser_optimize(), once. A new expression is interpreted; once it has
+ * been seen threshold times it is queued, and a background thread compiles
+ * the queue with jitc_build_many() whenever it is idle, so that expressions
+ * turning hot while gcc runs form the next batch. Later lines of a compiled
+ * expression call its compiled code. Expressions simplified to a single
+ * node, e.g., constants, are never compiled. Every line is answered as it
+ * is read, so the output stays in order. Both the interpreter and the
+ * compiled code follow the division mode selected by codegen_set_division(),
+ * so a line has the same value whichever answers it; a NaN, whose sign
+ * depends on how gcc arranged the code, is always written "nan".
+ *
+ * in       : the input stream
+ * out      : the output stream
+ * argc     : the number of default bindings
+ * argv     : the default name=value bindings
+ * threshold: the number of evaluations before compiling, or 0 to never
+ *            compile
+ * optimize : the PARSER_OPTIMIZE_* flags, or 0
+ * stats    : receives the counts of the run, may be NULL
+ *
+ * return: 0 on success, otherwise error
+ */
+
+int stream_run(FILE *in,
+	       FILE *out,
+	       int argc,
+	       char *argv[],
+	       uint64_t threshold,
+	       unsigned optimize,
+	       struct stream_stats *stats);
+
+#endif /* _STREAM_H_ */
@@ -9,15 +9,37 @@
 
 #define _GNU_SOURCE
 
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "system.h"
 
 /**
  * Needs:
+ *   clock_gettime()
+ *   open()
+ *   fstat()
+ *   mmap()
+ *   munmap()
  *   unlink()
  *   vsnprintf()
+ *   sysconf()
  */
 
+uint64_t
+ref_time(void)
+{
+	struct timespec timespec;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &timespec)) {
+		TRACE("clock_gettime()");
+		return 0;
+	}
+	return (uint64_t)timespec.tv_sec * 1000000000 +
+		(uint64_t)timespec.tv_nsec;
+}
+
 void
 file_delete(const char *pathname)
 {
@@ -28,6 +50,66 @@ file_delete(const char *pathname)
 	}
 }
 
+/**
+ * The file is mapped over an anonymous mapping one byte longer: the kernel
+ * zero fills the rest of the last page of a file, and if the file ends
+ * right at a page boundary, the anonymous page behind it provides the NUL.
+ */
+
+const char *
+file_map(const char *pathname, size_t *size)
+{
+	struct stat st;
+	size_t n;
+	void *p;
+	int fd;
+
+	assert( safe_strlen(pathname) && size );
+
+	if (0 > (fd = open(pathname, O_RDONLY))) {
+		TRACE("open()");
+		return NULL;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		TRACE("fstat()");
+		return NULL;
+	}
+	n = ((size_t)st.st_size + page_size()) & ~(page_size() - 1);
+	p = mmap(NULL, n, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == p) {
+		close(fd);
+		TRACE("mmap()");
+		return NULL;
+	}
+	if (st.st_size &&
+	    (MAP_FAILED == mmap(p,
+				(size_t)st.st_size,
+				PROT_READ,
+				MAP_PRIVATE | MAP_FIXED,
+				fd,
+				0))) {
+		munmap(p, n);
+		close(fd);
+		TRACE("mmap()");
+		return NULL;
+	}
+	close(fd);
+	*size = (size_t)st.st_size;
+	return (const char *)p;
+}
+
+void
+file_unmap(const char *p, size_t size)
+{
+	if (p) {
+		if (munmap((void *)p,
+			   (size + page_size()) & ~(page_size() - 1))) {
+			TRACE("munmap()");
+		}
+	}
+}
+
 void
 safe_sprintf(char *buf, size_t len, const char *format, ...)
 {
@@ -48,3 +130,15 @@ safe_strlen(const char *s)
 {
 	return s ? strlen(s) : 0;
 }
+
+size_t
+page_size(void)
+{
+	long size;
+
+	if ((0 >= (size = sysconf(_SC_PAGESIZE)))) {
+		EXIT("sysconf()");
+		return 0;
+	}
+	return (size_t)size;
+}
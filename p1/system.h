@@ -10,6 +10,7 @@
 #ifndef _SYSTEM_H_
 #define _SYSTEM_H_
 
+#include <time.h>
 #include <errno.h>
 #include <ctype.h>
 #include <stdio.h>
@@ -47,10 +48,20 @@
 		}				\
 	} while (0)
 
+uint64_t ref_time(void); /* monotonic nanoseconds */
+
 void file_delete(const char *pathname);
 
+/* maps a file read-only, NUL-terminated, *size excluding the NUL */
+
+const char *file_map(const char *pathname, size_t *size);
+
+void file_unmap(const char *p, size_t size);
+
 void safe_sprintf(char *buf, size_t len, const char *format, ...);
 
 size_t safe_strlen(const char *s);
 
+size_t page_size(void);
+
 #endif /* _SYSTEM_H_ */
@@ -0,0 +1,138 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * tier.c
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include "codegen.h"
+#include "parser.h"
+#include "jitc.h"
+#include "vm.h"
+#include "tier.h"
+
+/**
+ * Needs:
+ *   pthread_create()
+ *   pthread_join()
+ */
+
+/**
+ * The compiled entry point is published with a release store and read with
+ * an acquire load, so a caller either keeps interpreting or sees a fully
+ * loaded module; there is no lock on the evaluation path.
+ */
+
+struct tier {
+	uint64_t count; /* evaluations so far */
+	uint64_t threshold;
+	evaluate_t fnc; /* compiled entry point, NULL until promoted */
+	int started;
+	pthread_t thread;
+	struct parser *parser;
+	struct jitc *jitc;
+	struct vm *vm;
+};
+
+static void *
+promote(void *arg)
+{
+	struct tier *tier;
+	evaluate_t fnc;
+
+	tier = (struct tier *)arg;
+	if (!(tier->jitc = jitc_build(parser_dag(tier->parser))) ||
+	    !(fnc = (evaluate_t)jitc_lookup(tier->jitc, "evaluate"))) {
+		TRACE(0);
+		return NULL;
+	}
+	__atomic_store_n(&tier->fnc, fnc, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+struct tier *
+tier_open(const char *s, uint64_t threshold)
+{
+	struct tier *tier;
+
+	assert( safe_strlen(s) );
+
+	if (!(tier = malloc(sizeof (struct tier)))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(tier, 0, sizeof (struct tier));
+	tier->threshold = threshold;
+	if (!(tier->parser = parser_open(s)) ||
+	    !(tier->vm = vm_open(parser_dag(tier->parser)))) {
+		tier_close(tier);
+		TRACE(0);
+		return NULL;
+	}
+	return tier;
+}
+
+void
+tier_close(struct tier *tier)
+{
+	if (tier) {
+		if (tier->started) {
+			pthread_join(tier->thread, NULL);
+		}
+		jitc_close(tier->jitc);
+		vm_close(tier->vm);
+		parser_close(tier->parser);
+		memset(tier, 0, sizeof (struct tier));
+	}
+	FREE(tier);
+}
+
+double
+tier_evaluate(struct tier *tier, const double *x)
+{
+	evaluate_t fnc;
+
+	assert( tier );
+
+	if ((fnc = __atomic_load_n(&tier->fnc, __ATOMIC_ACQUIRE))) {
+		return fnc(x);
+	}
+	if (tier->threshold &&
+	    (tier->threshold ==
+	     __atomic_add_fetch(&tier->count, 1, __ATOMIC_RELAXED))) {
+		if (pthread_create(&tier->thread, NULL, promote, tier)) {
+			TRACE("pthread_create()"); /* keep interpreting */
+		}
+		else {
+			__atomic_store_n(&tier->started, 1, __ATOMIC_RELEASE);
+		}
+	}
+	return vm_execute(tier->vm, x);
+}
+
+int
+tier_compiled(const struct tier *tier)
+{
+	assert( tier );
+
+	return NULL != __atomic_load_n(&tier->fnc, __ATOMIC_ACQUIRE);
+}
+
+uint64_t
+tier_division_faults(const struct tier *tier)
+{
+	uint64_t faults;
+
+	assert( tier );
+
+	faults = vm_division_faults(tier->vm);
+	if (__atomic_load_n(&tier->fnc, __ATOMIC_ACQUIRE)) {
+		faults += jitc_division_faults(tier->jitc);
+	}
+	return faults;
+}
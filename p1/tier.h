@@ -0,0 +1,74 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * tier.h
+ */
+
+#ifndef _TIER_H_
+#define _TIER_H_
+
+#include "system.h"
+
+struct tier;
+
+/**
+ * Parses an expression and prepares it for evaluation by the bytecode
+ * interpreter. Once the expression has been evaluated threshold times, it
+ * is compiled by jitc_build() on a background thread and later calls
+ * switch to the compiled module. Both tiers follow the division mode
+ * selected by codegen_set_division() when tier_open() is called, which
+ * must stay selected until the module is compiled.
+ *
+ * s        : the expression
+ * threshold: the number of interpreted evaluations before compiling, or 0
+ *            to never compile
+ *
+ * return: an opaque handle or NULL on error
+ */
+
+struct tier *tier_open(const char *s, uint64_t threshold);
+
+/**
+ * Releases a handle, waiting for an outstanding background compile.
+ *
+ * tier: an opaque handle previously obtained by calling tier_open()
+ *
+ * Note: tier may be NULL
+ */
+
+void tier_close(struct tier *tier);
+
+/**
+ * Evaluates the expression with the fastest tier available. Safe to call
+ * concurrently.
+ *
+ * tier: an opaque handle previously obtained by calling tier_open()
+ * x   : the variables, numbered in order of first appearance in the
+ *       expression, may be NULL if there are none
+ *
+ * return: the sigmoid of the expression
+ */
+
+double tier_evaluate(struct tier *tier, const double *x);
+
+/**
+ * tier: an opaque handle previously obtained by calling tier_open()
+ *
+ * return: non-zero once evaluations run compiled code
+ */
+
+int tier_compiled(const struct tier *tier);
+
+/**
+ * tier: an opaque handle previously obtained by calling tier_open()
+ *
+ * return: the divisions by zero counted by both tiers so far, see
+ *         vm_division_faults()
+ */
+
+uint64_t tier_division_faults(const struct tier *tier);
+
+#endif /* _TIER_H_ */
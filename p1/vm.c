@@ -0,0 +1,357 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * vm.c
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include "sigmoid.h"
+#include "mathfn.h"
+#include "codegen.h"
+#include "vm.h"
+
+/**
+ * Every node of the dag owns one register, shared nodes included. Constants
+ * occupy the low registers, which are seeded from an image kept in the
+ * program; the remaining registers are written exactly once by the
+ * instructions, which appear in post-order. Dispatch is threaded through a
+ * table of label addresses (GNU computed goto), one indirect jump per
+ * instruction. Divisions are translated to the opcode of the division mode
+ * selected when the program is opened, so the loop never tests the mode.
+ */
+
+#define VM_REGS 256 /* register files up to this size live on the C stack */
+
+enum vm_op {
+	VM_OP_VAR,  /* dst = x[a] */
+	VM_OP_NEG,  /* dst = - b */
+	VM_OP_ADD,  /* dst = a + b */
+	VM_OP_SUB,  /* dst = a - b */
+	VM_OP_MUL,  /* dst = a * b */
+	VM_OP_DIV,  /* dst = b ? (a / b) : 0.0 */
+	VM_OP_DIVI, /* dst = a / b */
+	VM_OP_DIVC, /* dst = b ? (a / b) : 0.0, counting b == 0 */
+	VM_OP_EXP,  /* dst = mathfn_exp(b) */
+	VM_OP_LOG,  /* dst = mathfn_log(b) */
+	VM_OP_SQRT, /* dst = sqrt(b) */
+	VM_OP_ABS,  /* dst = fabs(b) */
+	VM_OP_POW,  /* dst = mathfn_pow(a, b) */
+	VM_OP_MIN,  /* dst = (a < b) ? a : b */
+	VM_OP_MAX,  /* dst = (a > b) ? a : b */
+	VM_OP_FMA,  /* dst = fma(a, b, c) */
+	VM_OP_RET   /* return sigmoid(a) */
+};
+
+struct vm_insn {
+	uint32_t op;
+	uint32_t dst;
+	uint32_t a;
+	uint32_t b;
+	uint32_t c;
+};
+
+struct vm {
+	uint32_t nconst;
+	uint32_t nreg;
+	uint32_t ninsn;
+	double *image; /* values of the constant registers */
+	struct vm_insn *insn;
+	uint64_t faults; /* divisions by zero under CODEGEN_DIVISION_CHECKED */
+};
+
+/**
+ * Register files larger than VM_REGS live in a per-thread buffer, grown on
+ * demand and released when the thread exits.
+ */
+
+struct file {
+	size_t size;
+	double reg[];
+};
+
+static pthread_key_t key;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static int key_ok;
+
+static void
+file_free(void *file)
+{
+	FREE(file);
+}
+
+static void
+file_init(void)
+{
+	key_ok = !pthread_key_create(&key, file_free);
+}
+
+static double *
+file_get(size_t size)
+{
+	struct file *file;
+	void *p;
+
+	pthread_once(&once, file_init);
+	if (!key_ok) {
+		TRACE("pthread_key_create()");
+		return NULL;
+	}
+	file = pthread_getspecific(key);
+	if (!file || (file->size < size)) {
+		if (!(p = realloc(file, sizeof (struct file) +
+				  size * sizeof (file->reg[0])))) {
+			TRACE("out of memory");
+			return NULL;
+		}
+		file = p;
+		file->size = size;
+		if (pthread_setspecific(key, file)) {
+			FREE(file);
+			TRACE("pthread_setspecific()");
+			return NULL;
+		}
+	}
+	return file->reg;
+}
+
+/**
+ * reg: by id, the register assigned to a node
+ * k  : the next free constant register
+ * t  : the next free temporary register
+ * div: the opcode of divisions
+ */
+
+struct translate {
+	struct vm *vm;
+	uint32_t *reg;
+	uint32_t k;
+	uint32_t t;
+	uint32_t div;
+};
+
+static void
+translate(const struct parser_dag *dag, uint32_t i, struct translate *translate)
+{
+	struct vm_insn *insn;
+	struct vm *vm;
+	uint32_t *reg;
+
+	vm = translate->vm;
+	reg = translate->reg;
+	if (PARSER_DAG_VAL == dag->op[i]) {
+		vm->image[translate->k] = dag->pool[dag->left[i]];
+		reg[i] = translate->k++;
+		return;
+	}
+	insn = &vm->insn[vm->ninsn++];
+	insn->dst = translate->t++;
+	insn->a = 0;
+	insn->b = 0;
+	insn->c = 0;
+	if (PARSER_DAG_VAR == dag->op[i]) {
+		insn->a = dag->left[i];
+	}
+	else {
+		insn->a = reg[dag->left[i]]; /* reg[0], unused, if none */
+		insn->b = reg[dag->right[i]];
+		insn->c = reg[dag->addend[i]];
+	}
+	switch (dag->op[i]) {
+	case PARSER_DAG_VAR: insn->op = VM_OP_VAR; break;
+	case PARSER_DAG_NEG: insn->op = VM_OP_NEG; break;
+	case PARSER_DAG_MUL: insn->op = VM_OP_MUL; break;
+	case PARSER_DAG_DIV: insn->op = translate->div; break;
+	case PARSER_DAG_ADD: insn->op = VM_OP_ADD; break;
+	case PARSER_DAG_SUB: insn->op = VM_OP_SUB; break;
+	case PARSER_DAG_EXP: insn->op = VM_OP_EXP; break;
+	case PARSER_DAG_LOG: insn->op = VM_OP_LOG; break;
+	case PARSER_DAG_SQRT: insn->op = VM_OP_SQRT; break;
+	case PARSER_DAG_ABS: insn->op = VM_OP_ABS; break;
+	case PARSER_DAG_POW: insn->op = VM_OP_POW; break;
+	case PARSER_DAG_MIN: insn->op = VM_OP_MIN; break;
+	case PARSER_DAG_MAX: insn->op = VM_OP_MAX; break;
+	case PARSER_DAG_FMA: insn->op = VM_OP_FMA; break;
+	default:
+		EXIT("software");
+	}
+	reg[i] = insn->dst;
+}
+
+struct vm *
+vm_open(const struct parser_dag *dag)
+{
+	struct translate translate_;
+	struct vm *vm;
+	uint32_t i;
+
+	assert( dag );
+
+	if (!(vm = malloc(sizeof (struct vm)))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(vm, 0, sizeof (struct vm));
+	for (i=1; i<=dag->n; ++i) {
+		if (PARSER_DAG_VAL == dag->op[i]) {
+			++vm->nconst;
+		}
+	}
+	vm->ninsn = dag->n - vm->nconst;
+	vm->nreg = dag->n;
+	memset(&translate_, 0, sizeof (struct translate));
+	translate_.vm = vm;
+	translate_.t = vm->nconst;
+	switch (codegen_get_division()) {
+	case CODEGEN_DIVISION_IEEE: translate_.div = VM_OP_DIVI; break;
+	case CODEGEN_DIVISION_CHECKED: translate_.div = VM_OP_DIVC; break;
+	default: translate_.div = VM_OP_DIV; break;
+	}
+	if (!(vm->image = malloc(vm->nconst * sizeof (vm->image[0]))) ||
+	    !(vm->insn = malloc((vm->ninsn + 1) * sizeof (vm->insn[0]))) ||
+	    !(translate_.reg = malloc(((size_t)dag->n + 1) *
+				      sizeof (translate_.reg[0])))) {
+		FREE(translate_.reg);
+		vm_close(vm);
+		TRACE("out of memory");
+		return NULL;
+	}
+	vm->ninsn = 0;
+	translate_.reg[0] = 0;
+	for (i=1; i<=dag->n; ++i) {
+		translate(dag, i, &translate_);
+	}
+	vm->insn[vm->ninsn].op = VM_OP_RET;
+	vm->insn[vm->ninsn].dst = 0;
+	vm->insn[vm->ninsn].a = translate_.reg[dag->n];
+	vm->insn[vm->ninsn].b = 0;
+	vm->insn[vm->ninsn].c = 0;
+	++vm->ninsn;
+	FREE(translate_.reg);
+	return vm;
+}
+
+void
+vm_close(struct vm *vm)
+{
+	if (vm) {
+		FREE(vm->image);
+		FREE(vm->insn);
+		memset(vm, 0, sizeof (struct vm));
+	}
+	FREE(vm);
+}
+
+double
+vm_execute(const struct vm *vm, const double *x)
+{
+	static const void * const LABEL[] = {
+		&&op_var,
+		&&op_neg,
+		&&op_add,
+		&&op_sub,
+		&&op_mul,
+		&&op_div,
+		&&op_divi,
+		&&op_divc,
+		&&op_exp,
+		&&op_log,
+		&&op_sqrt,
+		&&op_abs,
+		&&op_pow,
+		&&op_min,
+		&&op_max,
+		&&op_fma,
+		&&op_ret
+	};
+	const struct vm_insn *pc;
+	double reg_[VM_REGS], *reg, v;
+	uint64_t faults;
+
+	assert( vm );
+
+#define DISPATCH() goto *LABEL[(++pc)->op]
+
+	reg = reg_;
+	if ((VM_REGS < vm->nreg) && !(reg = file_get(vm->nreg))) {
+		return NAN;
+	}
+	faults = 0;
+	memcpy(reg, vm->image, vm->nconst * sizeof (reg[0]));
+	pc = vm->insn;
+	goto *LABEL[pc->op];
+
+ op_var:
+	reg[pc->dst] = x[pc->a];
+	DISPATCH();
+ op_neg:
+	reg[pc->dst] = - reg[pc->b];
+	DISPATCH();
+ op_add:
+	reg[pc->dst] = reg[pc->a] + reg[pc->b];
+	DISPATCH();
+ op_sub:
+	reg[pc->dst] = reg[pc->a] - reg[pc->b];
+	DISPATCH();
+ op_mul:
+	reg[pc->dst] = reg[pc->a] * reg[pc->b];
+	DISPATCH();
+ op_div:
+	reg[pc->dst] = reg[pc->b] ? (reg[pc->a] / reg[pc->b]) : 0.0;
+	DISPATCH();
+ op_divi:
+	reg[pc->dst] = reg[pc->a] / reg[pc->b];
+	DISPATCH();
+ op_divc:
+	v = reg[pc->b];
+	faults += !v;
+	reg[pc->dst] = v ? (reg[pc->a] / v) : 0.0;
+	DISPATCH();
+ op_exp:
+	reg[pc->dst] = mathfn_exp(reg[pc->b]);
+	DISPATCH();
+ op_log:
+	reg[pc->dst] = mathfn_log(reg[pc->b]);
+	DISPATCH();
+ op_sqrt:
+	reg[pc->dst] = __builtin_sqrt(reg[pc->b]);
+	DISPATCH();
+ op_abs:
+	reg[pc->dst] = __builtin_fabs(reg[pc->b]);
+	DISPATCH();
+ op_pow:
+	reg[pc->dst] = mathfn_pow(reg[pc->a], reg[pc->b]);
+	DISPATCH();
+ op_min:
+	v = reg[pc->a];
+	reg[pc->dst] = (v < reg[pc->b]) ? v : reg[pc->b];
+	DISPATCH();
+ op_max:
+	v = reg[pc->a];
+	reg[pc->dst] = (v > reg[pc->b]) ? v : reg[pc->b];
+	DISPATCH();
+ op_fma:
+	reg[pc->dst] = fma(reg[pc->a], reg[pc->b], reg[pc->c]);
+	DISPATCH();
+ op_ret:
+	if (faults) {
+		/* vm is const to its callers, not to its allocator */
+		__atomic_fetch_add(&((struct vm *)vm)->faults,
+				   faults,
+				   __ATOMIC_RELAXED);
+	}
+	return sigmoid(reg[pc->a]);
+
+#undef DISPATCH
+}
+
+uint64_t
+vm_division_faults(const struct vm *vm)
+{
+	assert( vm );
+
+	return __atomic_load_n(&vm->faults, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,63 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * vm.h
+ */
+
+#ifndef _VM_H_
+#define _VM_H_
+
+#include "system.h"
+#include "parser.h"
+
+struct vm;
+
+/**
+ * Translates dag into a compact register-based bytecode program. The program
+ * is independent of dag, which may be released afterwards. Its divisions
+ * follow the mode selected by codegen_set_division() at the time of the
+ * call.
+ *
+ * dag: the parsed expression
+ *
+ * return: an opaque handle or NULL on error
+ */
+
+struct vm *vm_open(const struct parser_dag *dag);
+
+/**
+ * Releases a bytecode program.
+ *
+ * vm: an opaque handle previously obtained by calling vm_open()
+ *
+ * Note: vm may be NULL
+ */
+
+void vm_close(struct vm *vm);
+
+/**
+ * Interprets the bytecode program, computing the same value as evaluate()
+ * of the module codegen() would have produced. Safe to call concurrently.
+ *
+ * vm: an opaque handle previously obtained by calling vm_open()
+ * x : the variables (see evaluate_t), may be NULL if there are none
+ *
+ * return: the sigmoid of the expression
+ */
+
+double vm_execute(const struct vm *vm, const double *x);
+
+/**
+ * vm: an opaque handle previously obtained by calling vm_open()
+ *
+ * return: the number of divisions by zero performed so far by vm_execute()
+ *         under CODEGEN_DIVISION_CHECKED, like division_faults of a module
+ *         of codegen(); always 0 under the other modes
+ */
+
+uint64_t vm_division_faults(const struct vm *vm);
+
+#endif /* _VM_H_ */
@@ -0,0 +1,241 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * bench.c
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/wait.h>
+#include <ucontext.h>
+#include <signal.h>
+#include <unistd.h>
+#include "system.h"
+#include "stack.h"
+#include "scheduler.h"
+
+/**
+ * usage: bench name [args...]
+ */
+
+#define SZ_UCONTEXT_STACK 65536
+
+static uint64_t rounds; /* yields per thread */
+
+static ucontext_t uc_main, uc[2];
+
+static void
+pingpong(void *arg)
+{
+	uint64_t i;
+
+	UNUSED(arg);
+
+	for (i=0; i<rounds; ++i) {
+		scheduler_yield();
+	}
+}
+
+static void
+uc_pingpong(int k)
+{
+	uint64_t i;
+
+	for (i=0; i<rounds; ++i) {
+		swapcontext(&uc[k], &uc[1 - k]);
+	}
+}
+
+/**
+ * Two threads yield to each other n times each, once through the
+ * scheduler and once through glibc's swapcontext(), which also saves the
+ * signal mask with a system call and the floating-point environment, and
+ * reports the nanoseconds per switch of each.
+ */
+
+static int
+bench_switch(int argc, char *argv[])
+{
+	void *stack[2];
+	uint64_t t[2];
+	int k;
+
+	rounds = (0 < argc) ? (uint64_t)atol(argv[0]) : 10000000;
+	if (!rounds) {
+		TRACE("bench setup");
+		return -1;
+	}
+
+	/* scheduler */
+
+	if (scheduler_create(pingpong, NULL) ||
+	    scheduler_create(pingpong, NULL)) {
+		TRACE(0);
+		return -1;
+	}
+	t[0] = ref_time();
+	scheduler_execute();
+	t[0] = ref_time() - t[0];
+
+	/* swapcontext() */
+
+	stack[0] = malloc(SZ_UCONTEXT_STACK);
+	stack[1] = malloc(SZ_UCONTEXT_STACK);
+	for (k=0; k<2; ++k) {
+		if (!stack[k] || getcontext(&uc[k])) {
+			FREE(stack[0]);
+			FREE(stack[1]);
+			TRACE("bench setup");
+			return -1;
+		}
+		uc[k].uc_stack.ss_sp = stack[k];
+		uc[k].uc_stack.ss_size = SZ_UCONTEXT_STACK;
+		uc[k].uc_link = &uc_main;
+		makecontext(&uc[k], (void (*)(void))uc_pingpong, 1, k);
+	}
+	t[1] = ref_time();
+	swapcontext(&uc_main, &uc[0]);
+	t[1] = ref_time() - t[1];
+	FREE(stack[0]);
+	FREE(stack[1]);
+	printf("%-16s %12s %12s\n", "", "switches", "ns/switch");
+	printf("%-16s %12lu %12.1f\n",
+	       "scheduler",
+	       (unsigned long)(2 * rounds),
+	       (double)t[0] / (double)(2 * rounds));
+	printf("%-16s %12lu %12.1f\n",
+	       "swapcontext",
+	       (unsigned long)(2 * rounds),
+	       (double)t[1] / (double)(2 * rounds));
+	return 0;
+}
+
+static void
+nothing(void *arg)
+{
+	UNUSED(arg);
+}
+
+static int
+deep(int depth)
+{
+	volatile char frame[256];
+
+	frame[0] = (char)depth;
+	frame[sizeof (frame) - 1] = frame[0];
+	if (!depth) {
+		return frame[sizeof (frame) - 1];
+	}
+	return deep(depth - 1) + frame[sizeof (frame) - 1];
+}
+
+static void
+overflow(void *arg)
+{
+	UNUSED(arg);
+
+	printf("%d\n", deep(1000000)); /* about 256 MiB of stack */
+}
+
+/**
+ * Runs rounds of k threads that return at once, with their stacks
+ * recycled from round to round and, for comparison, with the pool
+ * released after every round so that each stack is mapped anew, and
+ * reports the microseconds per thread of each. Then overflows the stack
+ * of a thread in a child process, which the guard page must kill with
+ * SIGSEGV.
+ */
+
+static int
+bench_stack(int argc, char *argv[])
+{
+	uint64_t t[2];
+	int n, k, r, i, j;
+	int status;
+	pid_t pid;
+
+	n = (0 < argc) ? atoi(argv[0]) : 1000;
+	k = (1 < argc) ? atoi(argv[1]) : 64;
+	if ((0 >= n) || (0 >= k)) {
+		TRACE("bench setup");
+		return -1;
+	}
+	for (j=0; j<2; ++j) {
+		stack_pool_release();
+		t[j] = ref_time();
+		for (r=0; r<n; ++r) {
+			for (i=0; i<k; ++i) {
+				if (scheduler_create(nothing, NULL)) {
+					TRACE(0);
+					return -1;
+				}
+			}
+			scheduler_execute();
+			if (j) {
+				stack_pool_release();
+			}
+		}
+		t[j] = ref_time() - t[j];
+	}
+	stack_pool_release();
+	printf("%-16s %12s %12s\n", "", "threads", "us/thread");
+	printf("%-16s %12lu %12.3f\n",
+	       "recycled",
+	       (unsigned long)n * k,
+	       1e-3 * (double)t[0] / ((double)n * k));
+	printf("%-16s %12lu %12.3f\n",
+	       "mapped",
+	       (unsigned long)n * k,
+	       1e-3 * (double)t[1] / ((double)n * k));
+
+	/* guard page */
+
+	fflush(stdout);
+	if (0 > (pid = fork())) {
+		TRACE("fork()");
+		return -1;
+	}
+	if (!pid) {
+		if (!scheduler_create_stack(overflow, NULL, 4 * page_size())) {
+			scheduler_execute();
+		}
+		_exit(0);
+	}
+	if ((pid != waitpid(pid, &status, 0)) ||
+	    !WIFSIGNALED(status) ||
+	    (SIGSEGV != WTERMSIG(status))) {
+		TRACE("stack overflow not caught");
+		return -1;
+	}
+	printf("%-16s %25s\n", "overflow", "SIGSEGV");
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const struct {
+		const char *name;
+		int (*fnc)(int argc, char *argv[]);
+	} BENCH[] = {
+		{ "stack", bench_stack },
+		{ "switch", bench_switch }
+	};
+	size_t i;
+
+	if (2 <= argc) {
+		for (i=0; i<ARRAY_SIZE(BENCH); ++i) {
+			if (!strcmp(argv[1], BENCH[i].name)) {
+				return BENCH[i].fnc(argc - 2, argv + 2);
+			}
+		}
+	}
+	printf("usage: %s benchmark [args...]\n", argv[0]);
+	for (i=0; i<ARRAY_SIZE(BENCH); ++i) {
+		printf("  %s\n", BENCH[i].name);
+	}
+	return -1;
+}
@@ -9,129 +9,213 @@
 
 #undef _FORTIFY_SOURCE
 
-#include <unistd.h>
-#include <signal.h>
-#include <setjmp.h>
 #include "system.h"
+#include "stack.h"
 #include "scheduler.h"
 
 /**
  * Needs:
- *   setjmp()
- *   longjmp()
+ *   malloc()
+ *   free()
  */
 
-/* research the above Needed API and design accordingly */
-
-#define SZ_STACK (2*page_size())
-
-typedef struct thread {
-    jmp_buf ctx;
-    enum {
-        STATUS_,
-        STATUS_RUNNING,
-        STATUS_SLEEPING,
-        STATUS_TERMINATED
-    } status;
-    struct {
-        void *memory_;
-        void *memory;
-    } stack;
-    struct thread *link;
-} Thread;
+/**
+ * A context is the stack pointer of a suspended thread. switch_context()
+ * pushes the callee-saved registers of the System V x86-64 ABI onto the
+ * current stack, then one more word holding the MXCSR and the x87 control
+ * word, whose control bits, the rounding modes and the exception masks,
+ * the ABI also makes callee-saved. It stores the stack pointer to *from,
+ * loads to, restores the word and the registers of the thread suspended
+ * there, and returns into it. Everything else, caller-saved registers
+ * included, is dead across the call by the ABI, so this is the whole
+ * context.
+ *
+ * A new thread's stack is laid out as if it had been suspended in
+ * switch_context() called from nowhere: the default MXCSR (0x1F80) and x87
+ * control word (0x037F), six zero registers, then the address of
+ * bootstrap() to return into, then a zero return address for bootstrap()
+ * itself, placed so that bootstrap() sees the stack aligned like any
+ * function entered by call.
+ */
+
+#define MXCSR_DEFAULT  0x1F80 /* round to nearest, all exceptions masked */
+#define FPU_CW_DEFAULT 0x037F /* the same, and double extended precision */
+
+#define SZ_STACK (16 * page_size()) /* default */
+
+void switch_context(void **from, void *to);
+
+__asm__(".text\n"
+	".globl switch_context\n"
+	".type switch_context, @function\n"
+	"switch_context:\n"
+	"\tpushq %rbp\n"
+	"\tpushq %rbx\n"
+	"\tpushq %r12\n"
+	"\tpushq %r13\n"
+	"\tpushq %r14\n"
+	"\tpushq %r15\n"
+	"\tsubq $8, %rsp\n"
+	"\tstmxcsr (%rsp)\n"
+	"\tfnstcw 4(%rsp)\n"
+	"\tmovq %rsp, (%rdi)\n"
+	"\tmovq %rsi, %rsp\n"
+	"\tldmxcsr (%rsp)\n"
+	"\tfldcw 4(%rsp)\n"
+	"\taddq $8, %rsp\n"
+	"\tpopq %r15\n"
+	"\tpopq %r14\n"
+	"\tpopq %r13\n"
+	"\tpopq %r12\n"
+	"\tpopq %rbx\n"
+	"\tpopq %rbp\n"
+	"\tret\n"
+	".size switch_context, .-switch_context\n");
+
+/**
+ * Runnable threads form a ring through next, in creation order; the
+ * current thread is on it. A thread leaves the ring when its function
+ * returns and moves to the done list. Its stack is still in use until
+ * bootstrap() switches away, so the done list is reaped, and the stacks
+ * returned to the pool of stack.h for the next threads, only by the
+ * following scheduler_create() or at the end of scheduler_execute().
+ */
+
+struct thread {
+	void *sp; /* saved context, see switch_context() */
+	scheduler_fnc_t fnc;
+	void *arg;
+	struct stack *stack;
+	struct thread *next;
+};
 
 static struct {
-    Thread *head;
-    Thread *cur_thread;
-    jmp_buf ctx;
+	struct thread *current;
+	struct thread *last; /* of the ring, where scheduler_create() appends */
+	struct thread *done;
+	void *sp; /* scheduler_execute(), while threads run */
 } state;
 
-Thread *thread_candidate(void) {
-    Thread *running = state.cur_thread;
-    Thread *start = running->link;
-    do {
-        if(start == NULL)
-            start = state.head;
-        if(start->status == STATUS_ || start->status == STATUS_SLEEPING)
-            return start;
-        else
-            start = start->link;
-    } while(start != running->link);
-    return NULL;
+static void
+thread_free(struct thread *thread)
+{
+	if (thread) {
+		stack_free(thread->stack);
+		memset(thread, 0, sizeof (struct thread));
+	}
+	FREE(thread);
 }
 
-void destroy(void) {
-    Thread *start = state.head;
-    Thread *temp;
-    
-    while(start != NULL) {
-        temp = start->link;
-        free(start->stack.memory_);
-        free(start);
-        start = temp;
-    }
-    
-    free(temp);
-    state.head = NULL;
-    state.cur_thread = NULL;
-}
+static void
+reap(void)
+{
+	struct thread *thread;
 
-int scheduler_create(scheduler_fnc_t fnc, void *arg) {
-    Thread *thread = (Thread *)malloc(sizeof(Thread));
-    /* Error handling for memory allocation failure */
-    if (!thread) {
-        fprintf(stderr, "Memory allocation failed for thread.\n");
-        free(thread);
-        return -1;
-    }
-
-    thread->link = state.head;
-    state.head = thread;
-    thread->status = STATUS_;
-
-    thread->stack.memory_ = malloc(SZ_STACK);
-
-    /* Error handling for stack allocation failure */
-    if (!thread->stack.memory_) {
-        fprintf(stderr, "Stack allocation failed for stack.\n");
-        free(thread);
-        return -1;
-    }
-
-    thread->stack.memory = memory_align(thread->stack.memory_, page_size());
-    
-    if (setjmp(thread->ctx) != 0) {
-        (*fnc)(arg);
-        thread->status = STATUS_TERMINATED;
-    }
-
-    return 0;
+	while ((thread = state.done)) {
+		state.done = thread->next;
+		thread_free(thread);
+	}
 }
 
-void schedule(void) {
-    Thread *next = thread_candidate();
+/**
+ * The first code a thread runs, returned into by its first switch.
+ */
+
+static void
+bootstrap(void)
+{
+	struct thread *thread, *prev;
+
+	thread = state.current;
+	thread->fnc(thread->arg);
+
+	/* unlink from the ring, then run the next thread or return */
+
+	prev = thread;
+	while (prev->next != thread) {
+		prev = prev->next;
+	}
+	if (prev == thread) {
+		state.current = NULL;
+		state.last = NULL;
+	}
+	else {
+		prev->next = thread->next;
+		state.current = thread->next;
+		if (state.last == thread) {
+			state.last = prev;
+		}
+	}
+	thread->next = state.done;
+	state.done = thread;
+	switch_context(&thread->sp,
+		       state.current ? state.current->sp : state.sp);
+	EXIT("software"); /* never resumed */
+}
 
-    if(next == NULL) {
-        fprintf(stderr, "No candidate thread found.\n");
-        return;
-    }
+int
+scheduler_create(scheduler_fnc_t fnc, void *arg)
+{
+	return scheduler_create_stack(fnc, arg, 0);
+}
 
-    state.cur_thread = next;
-    state.cur_thread->status = STATUS_RUNNING;
-    longjmp(next->ctx, 1);
+int
+scheduler_create_stack(scheduler_fnc_t fnc, void *arg, size_t size)
+{
+	struct thread *thread;
+	uint64_t *top;
+
+	assert( fnc );
+
+	reap();
+	if (!(thread = malloc(sizeof (struct thread)))) {
+		TRACE("out of memory");
+		return -1;
+	}
+	memset(thread, 0, sizeof (struct thread));
+	if (!(thread->stack = stack_alloc(size ? size : SZ_STACK))) {
+		thread_free(thread);
+		TRACE(0);
+		return -1;
+	}
+	thread->fnc = fnc;
+	thread->arg = arg;
+	top = (uint64_t *)thread->stack->top; /* page aligned */
+	*(--top) = 0;                          /* bootstrap() return address */
+	*(--top) = (uint64_t)(uintptr_t)bootstrap;
+	top -= 6;                              /* rbp, rbx, r12 .. r15 */
+	memset(top, 0, 6 * sizeof (top[0]));
+	*(--top) = MXCSR_DEFAULT | ((uint64_t)FPU_CW_DEFAULT << 32);
+	thread->sp = top;
+	if (state.last) {
+		thread->next = state.last->next;
+		state.last->next = thread;
+	}
+	else {
+		thread->next = thread;
+	}
+	state.last = thread;
+	return 0;
 }
 
-void scheduler_execute(void) {
-    if(setjmp(state.ctx) == 0) {
-        schedule();
-        destroy();
-    }
-    schedule();
+void
+scheduler_execute(void)
+{
+	if (state.last) {
+		state.current = state.last->next;
+		switch_context(&state.sp, state.current->sp);
+	}
+	reap();
 }
 
-void scheduler_yield(void) {
-    if(setjmp(state.cur_thread->ctx) == 0) {
-        state.cur_thread->status = STATUS_SLEEPING;
-        longjmp(state.ctx, 1);
-    }
-}
\ No newline at end of file
+void
+scheduler_yield(void)
+{
+	struct thread *thread;
+
+	thread = state.current;
+	if (thread && (thread->next != thread)) {
+		state.current = thread->next;
+		switch_context(&thread->sp, state.current->sp);
+	}
+}
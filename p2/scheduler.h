@@ -10,6 +10,8 @@
 #ifndef _SCHEDULER_H_
 #define _SCHEDULER_H_
 
+#include "system.h"
+
 /**
  * scheduler_fnc_t defines the signature of the user thread function to
  * be scheduled by the scheduler. The user thread function will be supplied
@@ -19,23 +21,30 @@
 typedef void (*scheduler_fnc_t)(void *arg);
 
 /**
- * Creates a new user thread.
+ * Creates a new user thread, which first runs once scheduler_execute() is
+ * called. Threads run in creation order.
  *
  * fnc: the start function of the user thread (see scheduler_fnc_t)
  * arg: a pass-through pointer defining the context of the user thread
  *
  * return: 0 on success, otherwise error
+ */
 
-        page_size ?
-        allocate thread obj use malloc
-        initialize object (*fnc,arg; allocate stack-malloc needed)
-
-        link it to state head
+int scheduler_create(scheduler_fnc_t fnc, void *arg);
 
-        return 0 for success
+/**
+ * Creates a new user thread, like scheduler_create(), on a stack of the
+ * given size. Every thread runs on a stack of its own, mapped with a guard
+ * page below it so that an overflow faults; the stacks of terminated
+ * threads are recycled for new threads of the same stack size.
+ *
+ * size: the stack size in bytes, rounded up to a multiple of the page
+ *       size, or 0 for the default of 16 pages
+ *
+ * return: 0 on success, otherwise error
  */
 
-int scheduler_create(scheduler_fnc_t fnc, void *arg);
+int scheduler_create_stack(scheduler_fnc_t fnc, void *arg, size_t size);
 
 /**
  * Called to execute the user threads previously created by calling
@@ -47,36 +56,17 @@ int scheduler_create(scheduler_fnc_t fnc, void *arg);
  *   * This function returns after all user threads (previously created)
  *     have terminated.
  *   * This function is not re-enterant.
-
-    create checkpoint and store in state ctx (this is the place where we come to decide what to run next, the state ctx)
-    schedule() (implement this)
-    destroy() (not able to schedule anything, thread candidate returned null, all done)
-
  */
 
 void scheduler_execute(void);
 
 /**
  * Called from within a user thread to yield the CPU to another user thread.
-
-    checkpoint to the thread that is currently running (state.thread -> ctx). this is also the point where the next thread from future continues running.
-    two paths after checkpoint. 
-
-    in one of the paths:
-     do nothing which means there is nobody to run and we are done. 
-    
-    in other path:
-     state.thread -> status = SLEEP
-     longjmp(state.ctx)
-
+ * The CPU goes directly to the next runnable thread, round-robin, with a
+ * single switch that saves and restores only the callee-saved registers;
+ * the call returns at once if no other thread is runnable.
  */
 
 void scheduler_yield(void);
 
-void schedule(void);
-
-struct thread *thread_candidate(void);
-
-void destroy(void);
-
-#endif /* _SCHEDULER_H_ */
\ No newline at end of file
+#endif /* _SCHEDULER_H_ */
@@ -0,0 +1,103 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * stack.c
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include "stack.h"
+
+/**
+ * Needs:
+ *   mmap()
+ *   mprotect()
+ *   munmap()
+ */
+
+/**
+ * The pool is a list of released stacks. Lookups are linear, which suits
+ * the few distinct sizes a program uses.
+ */
+
+static struct stack *pool;
+
+static void
+unmap(struct stack *stack)
+{
+	if (stack) {
+		if (stack->map_ &&
+		    munmap(stack->map_, stack->size + page_size())) {
+			TRACE("munmap()");
+		}
+		memset(stack, 0, sizeof (struct stack));
+	}
+	FREE(stack);
+}
+
+struct stack *
+stack_alloc(size_t size)
+{
+	struct stack *stack, **p;
+	void *map;
+
+	assert( size );
+
+	size = (size + page_size() - 1) / page_size() * page_size();
+	for (p=&pool; (stack = *p); p=&stack->next_) {
+		if (size == stack->size) {
+			*p = stack->next_;
+			stack->next_ = NULL;
+			return stack;
+		}
+	}
+	if (!(stack = malloc(sizeof (struct stack)))) {
+		TRACE("out of memory");
+		return NULL;
+	}
+	memset(stack, 0, sizeof (struct stack));
+	map = mmap(NULL,
+		   size + page_size(),
+		   PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK,
+		   -1,
+		   0);
+	if (MAP_FAILED == map) {
+		unmap(stack);
+		TRACE("mmap()");
+		return NULL;
+	}
+	stack->map_ = map;
+	stack->size = size;
+	if (mprotect(map, page_size(), PROT_NONE)) {
+		unmap(stack);
+		TRACE("mprotect()");
+		return NULL;
+	}
+	stack->top = (char *)map + page_size() + size;
+	return stack;
+}
+
+void
+stack_free(struct stack *stack)
+{
+	if (stack) {
+		stack->next_ = pool;
+		pool = stack;
+	}
+}
+
+void
+stack_pool_release(void)
+{
+	struct stack *stack;
+
+	while ((stack = pool)) {
+		pool = stack->next_;
+		unmap(stack);
+	}
+}
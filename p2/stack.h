@@ -0,0 +1,52 @@
+/**
+ * Tony Givargis
+ * Copyright (C), 2023
+ * University of California, Irvine
+ *
+ * CS 238P - Operating Systems
+ * stack.h
+ */
+
+#ifndef _STACK_H_
+#define _STACK_H_
+
+#include "system.h"
+
+/**
+ * Thread stacks, each its own mapping with an inaccessible guard page below
+ * it, so that overflowing a stack faults instead of corrupting memory.
+ * Released stacks are kept in a pool and handed out again to requests of
+ * the same size, sparing the system calls of mapping a new one.
+ */
+
+struct stack {
+	void *top;   /* one past the highest usable byte, page aligned */
+	size_t size; /* usable bytes, a multiple of the page size */
+	void *map_;
+	struct stack *next_;
+};
+
+/**
+ * size: the usable bytes, rounded up to a multiple of the page size
+ *
+ * return: a stack, recycled if the pool has one of the same size, or NULL
+ *         on error
+ */
+
+struct stack *stack_alloc(size_t size);
+
+/**
+ * Returns a stack to the pool. Nothing may run on it any longer.
+ *
+ * Note: stack may be NULL
+ */
+
+void stack_free(struct stack *stack);
+
+/**
+ * Unmaps every stack in the pool.
+ */
+
+void stack_pool_release(void);
+
+#endif /* _STACK_H_ */
@@ -14,12 +14,26 @@
 
 /**
  * Needs:
+ *   clock_gettime()
  *   nanosleep()
  *   unlink()
  *   vsnprintf()
  *   sysconf()
  */
 
+uint64_t
+ref_time(void)
+{
+	struct timespec timespec;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &timespec)) {
+		TRACE("clock_gettime()");
+		return 0;
+	}
+	return (uint64_t)timespec.tv_sec * 1000000000 +
+		(uint64_t)timespec.tv_nsec;
+}
+
 void
 us_sleep(uint64_t us)
 {
@@ -53,6 +53,8 @@
 		}				\
 	} while (0)
 
+uint64_t ref_time(void); /* monotonic nanoseconds */
+
 void us_sleep(uint64_t us);
 
 void file_delete(const char *pathname);